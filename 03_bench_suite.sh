@@ -0,0 +1,21 @@
+#!/bin/bash
+
+# Runs the suite for every dictionary type over the synthetic keys and the sample dataset,
+# writing a CSV to track regressions per label pool.
+
+out_name=${1:-bench_suite.csv}
+num_keys=200000
+
+./build/bench_suite 1 - 0 - 0 0 csv_header > $out_name
+
+for key_name in url id text sample.txt
+do
+  for dist in uniform zipf
+  do
+    for dic_type in {1..8}
+    do
+      echo "$dic_type $key_name $dist"
+      ./build/bench_suite $dic_type $key_name $num_keys $dist 0.2 0.5 csv >> $out_name
+    done
+  done
+done
@@ -1,93 +1,18 @@
-#include <chrono>
+#include <algorithm>
 #include <cassert>
-#include <fstream>
 #include <iostream>
 
 #include <DynPDT.hpp>
 
+#include "bench_tools.hpp"
+
 using namespace dynpdt;
 
 namespace {
 
-class StopWatch {
-public:
-  enum Times {
-    SEC, MILLI, MICRO
-  };
-
-  StopWatch() : tp_(std::chrono::high_resolution_clock::now()) {}
-  ~StopWatch() {}
-
-  double operator()(Times type) const {
-    auto tp = std::chrono::high_resolution_clock::now() - tp_;
-    switch (type) {
-      case Times::SEC:
-        return std::chrono::duration<double>(tp).count();
-      case Times::MILLI:
-        return std::chrono::duration<double, std::milli>(tp).count();
-      case Times::MICRO:
-        return std::chrono::duration<double, std::micro>(tp).count();
-    }
-    return 0.0;
-  }
-
-  StopWatch(const StopWatch&) = delete;
-  StopWatch& operator=(const StopWatch&) = delete;
-
-private:
-  std::chrono::high_resolution_clock::time_point tp_;
-};
-
-class KeyReader {
-public:
-  KeyReader(const char* file_name) {
-    std::ios::sync_with_stdio(false);
-    buf_.reserve(1 << 10);
-    ifs_.open(file_name);
-  }
-  ~KeyReader() {}
-
-  bool is_ready() const {
-    return !ifs_.fail();
-  }
-
-  const std::string& next() {
-    std::getline(ifs_, buf_);
-    return buf_;
-  }
-
-  KeyReader(const KeyReader&) = delete;
-  KeyReader& operator=(const KeyReader&) = delete;
-
-private:
-  std::ifstream ifs_;
-  std::string buf_;
-};
-
-std::vector<std::string> read_keys(const char* file_name) {
-  std::ifstream ifs(file_name);
-  if (!ifs) {
-    std::cerr << "ERROR : failed to open " << file_name << std::endl;
-    return {};
-  }
-
-  std::string line;
-  std::vector<std::string> keys;
-
-  while (std::getline(ifs, line)) {
-    if (line.empty()) {
-      continue;
-    }
-    keys.push_back(line);
-  }
-
-  return keys;
-}
-
 template <typename LabelPoolType>
 void run_insert(DynPDT<LabelPoolType>& dic, KeyReader& reader) {
   size_t num_keys = 0;
-  const auto limit = static_cast<size_t>(dic.get_trie()->num_slots() * 0.98);
   StopWatch sw;
 
   while (true) {
@@ -97,11 +22,6 @@ void run_insert(DynPDT<LabelPoolType>& dic, KeyReader& reader) {
     }
     *dic.update(key) = 1;
     ++num_keys;
-
-    if (limit < dic.get_trie()->num_nodes()) {
-      std::cerr << "*** Load Factor exceeds 0.98 ***" << std::endl;
-      exit(1);
-    }
   }
 
   auto us = sw(StopWatch::MICRO);
@@ -111,8 +31,59 @@ void run_insert(DynPDT<LabelPoolType>& dic, KeyReader& reader) {
   std::cout << " - insert time:\t" << us / num_keys << " us/key" << std::endl;
 }
 
+// Builds another dictionary from the sorted keys, compared with inserting them in order
 template <typename LabelPoolType>
-void run_search(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys) {
+void run_build(const Setting& setting, std::vector<std::string> keys) {
+  std::sort(keys.begin(), keys.end());
+  keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+  StopWatch sw;
+  {
+    DynPDT<LabelPoolType> dic(setting);
+    dic.build(keys, [](uint64_t) { return 1; });
+  }
+  const auto us = sw(StopWatch::MICRO);
+
+  StopWatch sw_insert;
+  {
+    DynPDT<LabelPoolType> dic(setting);
+    for (const auto& key : keys) {
+      *dic.update(key) = 1;
+    }
+  }
+  const auto us_insert = sw_insert(StopWatch::MICRO);
+
+  std::cout << "Bench: run_build" << std::endl;
+  std::cout << " - num_keys:\t" << keys.size() << std::endl;
+  std::cout << " - build time:\t" << us / keys.size() << " us/key" << std::endl;
+  std::cout << " - sorted insert time:\t" << us_insert / keys.size() << " us/key" << std::endl;
+}
+
+// Tunes the setting on a sample of the keys within the bytes per key of the given setting
+template <typename LabelPoolType>
+void run_tune(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys) {
+  const size_t max_sample_size = 1U << 16;
+  std::vector<std::string> sample;
+  for (size_t i = 0; i < keys.size(); i += (keys.size() + max_sample_size - 1) / max_sample_size) {
+    sample.push_back(keys[i]);
+  }
+
+  TuneBudget budget;
+  budget.bytes_per_key = static_cast<double>(dic.size_in_bytes()) / dic.num_keys();
+
+  StopWatch sw;
+  const auto result = DynPDT<LabelPoolType>::tune(sample, dic.get_setting(), budget);
+  const auto ms = sw(StopWatch::MILLI);
+
+  std::cout << "Bench: run_tune" << std::endl;
+  std::cout << " - sample_size:\t" << sample.size() << std::endl;
+  std::cout << " - budget_bytes_per_key:\t" << budget.bytes_per_key << std::endl;
+  std::cout << " - tune time:\t" << ms << " ms" << std::endl;
+  result.show_stat(std::cout);
+}
+
+template <typename LabelPoolType>
+double run_search(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys) {
   size_t ok = 0, ng = 0;
   StopWatch sw;
 
@@ -132,6 +103,108 @@ void run_search(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>
   std::cout << " - ok:\t" << ok << std::endl;
   std::cout << " - ng:\t" << ng << std::endl;
   std::cout << " - search time:\t" << us / keys.size() << " us/key" << std::endl;
+  return us / keys.size();
+}
+
+template <typename LabelPoolType>
+void run_search_batch(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys,
+                      double search_time) {
+  const size_t batch_size = 256;
+
+  std::vector<std::string> batch;
+  std::vector<const int*> out;
+  batch.reserve(batch_size);
+
+  size_t ok = 0, ng = 0;
+  double us = 0.0;
+
+  for (size_t i = 0; i < keys.size(); i += batch_size) {
+    // Copying a batch is not measured
+    batch.assign(keys.begin() + i, keys.begin() + std::min(i + batch_size, keys.size()));
+
+    StopWatch sw;
+    dic.find_batch(batch, out);
+    us += sw(StopWatch::MICRO);
+
+    for (auto ptr : out) {
+      if (ptr != nullptr && *ptr == 1) {
+        ++ok;
+      } else {
+        ++ng;
+      }
+    }
+  }
+
+  std::cout << "Bench: run_search_batch" << std::endl;
+  std::cout << " - num_keys:\t" << keys.size() << std::endl;
+  std::cout << " - batch_size:\t" << batch_size << std::endl;
+  std::cout << " - ok:\t" << ok << std::endl;
+  std::cout << " - ng:\t" << ng << std::endl;
+  std::cout << " - search time:\t" << us / keys.size() << " us/key" << std::endl;
+  std::cout << " - speedup:\t" << search_time / (us / keys.size()) << std::endl;
+}
+
+// Compares common_prefix_search() with find() for every prefix of the queries
+template <typename LabelPoolType>
+void run_common_prefix_search(const DynPDT<LabelPoolType>& dic,
+                              const std::vector<std::string>& keys) {
+  size_t num_found = 0;
+  StopWatch sw;
+  for (const auto& key : keys) {
+    dic.common_prefix_search(key, [&](uint64_t, const int*) {
+      ++num_found;
+      return true;
+    });
+  }
+  const auto us = sw(StopWatch::MICRO);
+
+  size_t num_found_by_find = 0;
+  std::string prefix;
+  StopWatch sw_find;
+  for (const auto& key : keys) {
+    for (size_t len = 1; len <= key.size(); ++len) {
+      prefix.assign(key, 0, len);
+      if (dic.find(prefix)) {
+        ++num_found_by_find;
+      }
+    }
+  }
+  const auto us_find = sw_find(StopWatch::MICRO);
+
+  std::cout << "Bench: run_common_prefix_search" << std::endl;
+  std::cout << " - num_keys:\t" << keys.size() << std::endl;
+  std::cout << " - num_found:\t" << num_found << std::endl;
+  std::cout << " - ng:\t" << (num_found != num_found_by_find) << std::endl;
+  std::cout << " - search time:\t" << us / keys.size() << " us/key" << std::endl;
+  std::cout << " - search time by find:\t" << us_find / keys.size() << " us/key" << std::endl;
+}
+
+// Full scans by for_each() in the order of slots and by for_each_prefix() in key order
+template <typename LabelPoolType>
+void run_scan(const DynPDT<LabelPoolType>& dic) {
+  size_t num_keys = 0;
+  StopWatch sw;
+  dic.for_each([&](const std::string&, int) {
+    ++num_keys;
+    return true;
+  });
+  const auto us = sw(StopWatch::MICRO);
+
+  std::cout << "Bench: run_scan" << std::endl;
+  std::cout << " - num_keys:\t" << num_keys << std::endl;
+  std::cout << " - scan time:\t" << us / num_keys << " us/key" << std::endl;
+
+  num_keys = 0;
+  StopWatch sw_ordered;
+  dic.for_each_prefix("", [&](const std::string&, int) {
+    ++num_keys;
+    return true;
+  });
+  const auto us_ordered = sw_ordered(StopWatch::MICRO);
+
+  std::cout << "Bench: run_scan_ordered" << std::endl;
+  std::cout << " - num_keys:\t" << num_keys << std::endl;
+  std::cout << " - scan time:\t" << us_ordered / num_keys << " us/key" << std::endl;
 }
 
 template <typename LabelPoolType>
@@ -161,9 +234,15 @@ int bench(const char* argv[]) {
 
   if (std::strcmp(query_name, "-") != 0) {
     auto keys = read_keys(query_name);
-    run_search(dic, keys);
+    run_build<LabelPoolType>(setting, keys);
+    const auto search_time = run_search(dic, keys);
+    run_search_batch(dic, keys, search_time);
+    run_common_prefix_search(dic, keys);
+    run_tune(dic, keys);
   }
 
+  run_scan(dic);
+
   dic.show_stat(std::cout);
   return 0;
 }
@@ -190,6 +269,12 @@ int main(int argc, const char* argv[]) {
       return bench<LabelPool_BitMap<int, 2>>(argv);
     case '5':
       return bench<LabelPool_BitMap<int, 3>>(argv);
+    case '6':
+      return bench<LabelPool_Arena<int>>(argv);
+    case '7':
+      return bench<LabelPool_BitMap<int, 3, true>>(argv);
+    case '8':
+      return bench<LabelPool_BitMap<int, 3, true, 8>>(argv);
     default:
       break;
   }
@@ -0,0 +1,100 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+
+#include <simd_tools.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+struct Pair {
+  std::string stored;
+  std::string query;
+  uint64_t expected;
+};
+
+/*
+ * Makes pairs of labels whose lengths are in [min_length, max_length). Half of the queries
+ * match the stored labels entirely, and the others differ at a random position.
+ * */
+std::vector<Pair> make_pairs(uint64_t num_pairs, uint64_t min_length, uint64_t max_length) {
+  std::mt19937_64 rnd(13);
+  std::vector<Pair> pairs(num_pairs);
+
+  for (auto& pair : pairs) {
+    const auto length = min_length + rnd() % (max_length - min_length);
+    for (uint64_t i = 0; i < length; ++i) {
+      pair.stored += static_cast<char>('a' + rnd() % 26);
+    }
+    pair.query = pair.stored;
+    pair.expected = length;
+    if (rnd() % 2) {
+      pair.expected = rnd() % length;
+      pair.query[pair.expected] = 'A';
+    }
+  }
+  return pairs;
+}
+
+double run(const std::vector<Pair>& pairs, simd_tools::MismatchKernel kernel, uint64_t num_runs) {
+  uint64_t ng = 0;
+  StopWatch sw;
+  for (uint64_t r = 0; r < num_runs; ++r) {
+    for (const auto& pair : pairs) {
+      auto a = reinterpret_cast<const uint8_t*>(pair.stored.data());
+      auto b = reinterpret_cast<const uint8_t*>(pair.query.data());
+      if (kernel(a, b, pair.stored.size()) != pair.expected) {
+        ++ng;
+      }
+    }
+  }
+  const auto ns = sw(StopWatch::MICRO) * 1000;
+  if (ng != 0) {
+    std::cerr << "ERROR: " << ng << " wrong results" << std::endl;
+    exit(1);
+  }
+  return ns / (pairs.size() * num_runs);
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <#pairs> <#runs>";
+
+  if (argc != 3) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  const auto num_pairs = static_cast<uint64_t>(std::atoll(argv[1]));
+  const auto num_runs = static_cast<uint64_t>(std::atoll(argv[2]));
+
+  const std::vector<std::pair<uint64_t, uint64_t>> buckets = {
+    {1, 16}, {16, 32}, {32, 64}, {64, 128}, {128, 256}, {256, 512}
+  };
+
+  std::cout << "Bench: mismatch" << std::endl;
+  std::cout << " - avx2:\t" << (cpu_features::has_avx2() ? "yes" : "no") << std::endl;
+  for (const auto& bucket : buckets) {
+    const auto pairs = make_pairs(num_pairs, bucket.first, bucket.second);
+    std::cout << " - length [" << bucket.first << ", " << bucket.second << "):" << std::endl;
+    std::cout << "   - scalar:\t" << run(pairs, simd_tools::mismatch_scalar, num_runs)
+              << " ns/compare" << std::endl;
+#if defined(__x86_64__)
+    std::cout << "   - sse2:\t" << run(pairs, simd_tools::mismatch_sse2, num_runs)
+              << " ns/compare" << std::endl;
+    if (cpu_features::has_avx2()) {
+      std::cout << "   - avx2:\t" << run(pairs, simd_tools::mismatch_avx2, num_runs)
+                << " ns/compare" << std::endl;
+    }
+#endif
+    std::cout << "   - dispatched:\t" << run(pairs, simd_tools::mismatch, num_runs)
+              << " ns/compare" << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,166 @@
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+
+#include <DynPDT.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+struct ReaderStat {
+  size_t num_lookups = 0;
+  size_t ng = 0;
+  double us = 0.0;
+};
+
+/*
+ * Each reader looks up the stored keys repeatedly, at least once and until done is set.
+ * */
+template <typename LabelPoolType>
+std::vector<ReaderStat> run_readers(const DynPDT<LabelPoolType>& dic,
+                                    const std::vector<std::string>& keys, size_t num_stored,
+                                    size_t num_readers, const std::atomic<bool>& done,
+                                    std::atomic<size_t>& num_started) {
+  std::vector<ReaderStat> stats(num_readers);
+  std::vector<std::thread> readers;
+
+  for (size_t t = 0; t < num_readers; ++t) {
+    readers.emplace_back([&, t]() {
+      auto& stat = stats[t];
+      int value = 0;
+      ++num_started;
+      StopWatch sw;
+      do {
+        // Threads start at different positions so as not to walk in lockstep
+        for (size_t i = 0; i < num_stored; ++i) {
+          const auto& key = keys[(i + t * num_stored / num_readers) % num_stored];
+          if (!dic.find(key, value) || value != 1) {
+            ++stat.ng;
+          }
+        }
+        stat.num_lookups += num_stored;
+      } while (!done);
+      stat.us = sw(StopWatch::MICRO);
+    });
+  }
+
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  return stats;
+}
+
+void show_readers(const char* title, const std::vector<ReaderStat>& stats) {
+  size_t num_lookups = 0, ng = 0;
+  double us = 0.0;
+  for (const auto& stat : stats) {
+    num_lookups += stat.num_lookups;
+    ng += stat.ng;
+    us = std::max(us, stat.us);
+  }
+
+  std::cout << "Bench: " << title << std::endl;
+  std::cout << " - num_readers:\t" << stats.size() << std::endl;
+  std::cout << " - num_lookups:\t" << num_lookups << std::endl;
+  std::cout << " - ng:\t" << ng << std::endl;
+  std::cout << " - throughput:\t" << num_lookups / us << " Mlookups/sec" << std::endl;
+}
+
+template <typename LabelPoolType>
+int bench(const char* argv[]) {
+  auto key_name = argv[2];
+  const auto num_readers = static_cast<size_t>(std::atoi(argv[3]));
+
+  Setting setting;
+  setting.num_keys = static_cast<uint64_t>(std::atoll(argv[4]));
+  setting.load_factor = std::atof(argv[5]);
+  setting.fixed_len = static_cast<uint64_t>(std::atoi(argv[6]));
+  setting.width_1st = static_cast<uint8_t>(std::atoi(argv[7]));
+  setting.concurrent = true;
+
+  const auto keys = read_keys(key_name);
+  const auto num_stored = keys.size() / 2;
+
+  DynPDT<LabelPoolType> dic(setting);
+  for (size_t i = 0; i < num_stored; ++i) {
+    dic.update(keys[i], 1);
+  }
+
+  {
+    std::atomic<bool> done(true);
+    std::atomic<size_t> num_started(0);
+    auto stats = run_readers(dic, keys, num_stored, num_readers, done, num_started);
+    show_readers("run_readers", stats);
+  }
+
+  {
+    // The others are inserted by the writer during lookups
+    std::atomic<bool> done(false);
+    std::atomic<size_t> num_started(0);
+    std::vector<ReaderStat> stats;
+
+    std::thread readers([&]() {
+      stats = run_readers(dic, keys, num_stored, num_readers, done, num_started);
+    });
+    while (num_started < num_readers) {
+      std::this_thread::yield();
+    }
+
+    StopWatch sw;
+    for (size_t i = num_stored; i < keys.size(); ++i) {
+      dic.update(keys[i], 1);
+    }
+    const auto us = sw(StopWatch::MICRO);
+
+    done = true;
+    readers.join();
+
+    std::cout << "Bench: run_writer" << std::endl;
+    std::cout << " - num_keys:\t" << keys.size() - num_stored << std::endl;
+    std::cout << " - insert time:\t" << us / (keys.size() - num_stored) << " us/key" << std::endl;
+    show_readers("run_readers_with_writer", stats);
+  }
+
+  dic.show_stat(std::cout);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <dic_type> <key> <#readers> <#keys> <LF> <len> <w1>";
+
+  if (argc != 8) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  switch (*argv[1]) {
+    case '1':
+      return bench<LabelPool_Plain<int>>(argv);
+    case '2':
+      return bench<LabelPool_BitMap<int, 0>>(argv);
+    case '3':
+      return bench<LabelPool_BitMap<int, 1>>(argv);
+    case '4':
+      return bench<LabelPool_BitMap<int, 2>>(argv);
+    case '5':
+      return bench<LabelPool_BitMap<int, 3>>(argv);
+    case '6':
+      return bench<LabelPool_Arena<int>>(argv);
+    case '7':
+      return bench<LabelPool_BitMap<int, 3, true>>(argv);
+    case '8':
+      return bench<LabelPool_BitMap<int, 3, true, 8>>(argv);
+    default:
+      break;
+  }
+
+  std::cerr << usage.str() << std::endl;
+  return 1;
+}
@@ -0,0 +1,137 @@
+#include <cassert>
+#include <iostream>
+
+#include <DynPDT.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+constexpr uint64_t kFixedLen = 16;
+constexpr uint8_t kWidth1st = 6;
+
+struct Result {
+  double insert_us = 0.0;
+  double find_us = 0.0;
+};
+
+// Setting fixed_len and width_1st also for the runtime-configured DicType
+template <typename DicType>
+Result run(const std::vector<std::string>& keys, const std::vector<std::string>& queries) {
+  Setting setting;
+  setting.num_keys = keys.size();
+  setting.load_factor = 0.8;
+  setting.fixed_len = kFixedLen;
+  setting.width_1st = kWidth1st;
+
+  Result result;
+  DicType dic(setting);
+  {
+    StopWatch sw;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      *dic.update(keys[i]) = static_cast<int>(i + 1);
+    }
+    result.insert_us = sw(StopWatch::MICRO) / keys.size();
+  }
+  {
+    size_t ng = 0;
+    StopWatch sw;
+    for (const auto& query : queries) {
+      int value = 0;
+      if (!dic.find(query, value) || value == 0) {
+        ++ng;
+      }
+    }
+    result.find_us = sw(StopWatch::MICRO) / queries.size();
+    if (ng != 0) {
+      std::cerr << "ERROR: " << ng << " keys are not found" << std::endl;
+      exit(1);
+    }
+  }
+  return result;
+}
+
+template <typename LabelPoolType>
+int bench(const char* argv[]) {
+  const std::string key_name = argv[2];
+  const auto num_keys = static_cast<uint64_t>(std::atoll(argv[3]));
+  const auto num_runs = static_cast<uint64_t>(std::atoll(argv[4]));
+
+  auto keys = make_keys(key_name, num_keys, 13);
+  if (keys.empty()) {
+    keys = read_keys(key_name.c_str());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(13));
+    if (num_keys != 0 && num_keys < keys.size()) {
+      keys.resize(num_keys);
+    }
+  }
+  if (keys.empty()) {
+    std::cerr << "ERROR: no keys" << std::endl;
+    return 1;
+  }
+
+  // Looked up in an order other than the insertion
+  auto queries = keys;
+  std::shuffle(queries.begin(), queries.end(), std::mt19937(17));
+
+  // Alternated so that both see the same state of caches and frequencies
+  Result runtime, fixed;
+  for (uint64_t r = 0; r < num_runs; ++r) {
+    const auto a = run<DynPDT<LabelPoolType>>(keys, queries);
+    const auto b = run<FixedDynPDT<LabelPoolType, kFixedLen, kWidth1st>>(keys, queries);
+    runtime.insert_us += a.insert_us / num_runs;
+    runtime.find_us += a.find_us / num_runs;
+    fixed.insert_us += b.insert_us / num_runs;
+    fixed.find_us += b.find_us / num_runs;
+  }
+
+  std::cout << "Bench: fixed setting of " << DynPDT<LabelPoolType>::name() << std::endl;
+  std::cout << " - num_keys:\t" << keys.size() << std::endl;
+  std::cout << " - fixed_len:\t" << kFixedLen << std::endl;
+  std::cout << " - width_1st:\t" << static_cast<uint32_t>(kWidth1st) << std::endl;
+  std::cout << " - runtime insert time:\t" << runtime.insert_us << " us/key" << std::endl;
+  std::cout << " - fixed insert time:\t" << fixed.insert_us << " us/key" << std::endl;
+  std::cout << " - runtime search time:\t" << runtime.find_us << " us/key" << std::endl;
+  std::cout << " - fixed search time:\t" << fixed.find_us << " us/key" << std::endl;
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <dic_type> <url|id|text|key_file> <#keys> <#runs>";
+
+  if (argc != 5) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  switch (*argv[1]) {
+    case '1':
+      return bench<LabelPool_Plain<int>>(argv);
+    case '2':
+      return bench<LabelPool_BitMap<int, 0>>(argv);
+    case '3':
+      return bench<LabelPool_BitMap<int, 1>>(argv);
+    case '4':
+      return bench<LabelPool_BitMap<int, 2>>(argv);
+    case '5':
+      return bench<LabelPool_BitMap<int, 3>>(argv);
+    case '6':
+      return bench<LabelPool_Arena<int>>(argv);
+    case '7':
+      return bench<LabelPool_BitMap<int, 3, true>>(argv);
+    case '8':
+      return bench<LabelPool_BitMap<int, 3, true, 8>>(argv);
+    default:
+      break;
+  }
+
+  std::cerr << usage.str() << std::endl;
+  return 1;
+}
@@ -0,0 +1,96 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+
+#include <SimpleBonsai.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+struct Transition {
+  uint64_t parent_id;
+  uint64_t symbol;
+  uint64_t child_id;
+};
+
+/*
+ * Builds a random trie at the load factor and measures get_child() for every edge.
+ * With blocked, slots are packed per cache line.
+ * */
+template <typename HashType>
+void bench(uint64_t num_slots, double load_factor, uint64_t alphabet_size, uint8_t width_1st,
+           bool blocked) {
+  SimpleBonsai<HashType> trie(num_slots, alphabet_size, width_1st, false, false, blocked);
+  const auto num_nodes = static_cast<uint64_t>(trie.num_slots() * load_factor);
+
+  std::mt19937_64 rnd(13);
+  std::vector<uint64_t> node_ids = {trie.get_root()};
+  std::vector<Transition> transitions;
+  transitions.reserve(num_nodes);
+
+  StopWatch sw_insert;
+  while (trie.num_nodes() < num_nodes) {
+    const auto parent_id = node_ids[rnd() % node_ids.size()];
+    const auto symbol = rnd() % alphabet_size;
+    auto node_id = parent_id;
+    if (trie.add_child(node_id, symbol)) {
+      node_ids.push_back(node_id);
+      transitions.push_back({parent_id, symbol, node_id});
+    }
+  }
+  const auto insert_ns = sw_insert(StopWatch::MICRO) * 1000;
+
+  std::shuffle(transitions.begin(), transitions.end(), rnd);
+
+  StopWatch sw_search;
+  uint64_t ok = 0;
+  for (const auto& t : transitions) {
+    auto node_id = t.parent_id;
+    if (trie.get_child(node_id, t.symbol) && node_id == t.child_id) {
+      ++ok;
+    }
+  }
+  const auto search_ns = sw_search(StopWatch::MICRO) * 1000;
+
+  std::cout << "Bench: " << trie.name() << (blocked ? " (blocked)" : "") << std::endl;
+  std::cout << " - num_slots:\t" << trie.num_slots() << std::endl;
+  std::cout << " - load_factor:\t" << static_cast<double>(trie.num_nodes()) / trie.num_slots() << std::endl;
+  std::cout << " - average_dsp:\t" << trie.average_dsp() << std::endl;
+  std::cout << " - ok:\t" << ok << std::endl;
+  std::cout << " - ng:\t" << transitions.size() - ok << std::endl;
+  std::cout << " - insert time:\t" << insert_ns / transitions.size() << " ns/transition" << std::endl;
+  std::cout << " - search time:\t" << search_ns / transitions.size() << " ns/transition" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <#nodes> <LF> <len> <w1>";
+
+  if (argc != 5) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  const auto num_nodes = static_cast<uint64_t>(std::atoll(argv[1]));
+  const auto load_factor = std::atof(argv[2]);
+  const auto fixed_len = static_cast<uint64_t>(std::atoi(argv[3]));
+  const auto width_1st = static_cast<uint8_t>(std::atoi(argv[4]));
+
+  // same as DynPDT
+  const auto alphabet_size = (fixed_len << 8) - 3;
+
+  // Both use the same power-of-two number of slots to compare at the same load factor
+  const auto num_slots = Hash_Bijective::adjust_num_slots(num_nodes / load_factor);
+
+  for (bool blocked : {false, true}) {
+    bench<Hash_Prime>(num_slots, load_factor, alphabet_size, width_1st, blocked);
+    bench<Hash_Bijective>(num_slots, load_factor, alphabet_size, width_1st, blocked);
+  }
+
+  return 0;
+}
@@ -0,0 +1,115 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+
+#include <bit_tools.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+using RankKernel = uint64_t (*)(uint64_t, uint64_t);
+
+struct Query {
+  uint64_t bitmap_id;
+  uint64_t pos;
+  uint64_t other_id;
+};
+
+/*
+ * Measures rank on random bitmaps. Each query also touches a random slot of the other data,
+ * which stands for the trie competing with the popcount table for the cache.
+ * */
+double run(const std::vector<uint64_t>& bitmaps, const std::vector<uint64_t>& others,
+           const std::vector<Query>& queries, RankKernel kernel, uint64_t& checksum) {
+  checksum = 0;
+  StopWatch sw;
+  for (const auto& query : queries) {
+    checksum += kernel(bitmaps[query.bitmap_id], query.pos);
+    if (!others.empty()) {
+      checksum += others[query.other_id];
+    }
+  }
+  return sw(StopWatch::MICRO) * 1000 / queries.size();
+}
+
+uint64_t rank_table(uint64_t x, uint64_t i) {
+  return bit_tools::popcount_table(x & ((1ULL << i) - 1));
+}
+uint64_t rank_swar(uint64_t x, uint64_t i) {
+  return bit_tools::popcount_swar(x & ((1ULL << i) - 1));
+}
+#if defined(__x86_64__)
+uint64_t rank_popcnt(uint64_t x, uint64_t i) {
+  return bit_tools::popcount_hw(x & ((1ULL << i) - 1));
+}
+uint64_t rank_bzhi(uint64_t x, uint64_t i) {
+  return bit_tools::popcount_hw(x, i);
+}
+#endif
+uint64_t rank_dispatched(uint64_t x, uint64_t i) {
+  return bit_tools::popcount(x, i);
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <#bitmaps> <#other_bytes> <#queries>";
+
+  if (argc != 4) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  const auto num_bitmaps = static_cast<uint64_t>(std::atoll(argv[1]));
+  const auto num_others = static_cast<uint64_t>(std::atoll(argv[2])) / sizeof(uint64_t);
+  const auto num_queries = static_cast<uint64_t>(std::atoll(argv[3]));
+
+  std::mt19937_64 rnd(13);
+  std::vector<uint64_t> bitmaps(num_bitmaps), others(num_others);
+  for (auto& bitmap : bitmaps) {
+    bitmap = rnd();
+  }
+  for (auto& other : others) {
+    other = rnd() % 2;
+  }
+  std::vector<Query> queries(num_queries);
+  for (auto& query : queries) {
+    query = {rnd() % num_bitmaps, rnd() % 64, num_others ? rnd() % num_others : 0};
+  }
+
+  std::vector<std::pair<const char*, RankKernel>> kernels = {
+    {"table", rank_table}, {"swar", rank_swar}
+  };
+#if defined(__x86_64__)
+  if (cpu_features::has_popcnt()) {
+    kernels.push_back({"popcnt", rank_popcnt});
+  }
+  if (cpu_features::has_popcnt() && cpu_features::has_bmi2()) {
+    kernels.push_back({"popcnt+bzhi", rank_bzhi});
+  }
+#endif
+  kernels.push_back({"dispatched", rank_dispatched});
+
+  std::cout << "Bench: rank" << std::endl;
+  std::cout << " - popcnt:\t" << (cpu_features::has_popcnt() ? "yes" : "no") << std::endl;
+  std::cout << " - bmi2:\t" << (cpu_features::has_bmi2() ? "yes" : "no") << std::endl;
+
+  uint64_t expected = 0;
+  for (size_t k = 0; k < kernels.size(); ++k) {
+    uint64_t checksum = 0;
+    const auto ns = run(bitmaps, others, queries, kernels[k].second, checksum);
+    if (k == 0) {
+      expected = checksum;
+    } else if (checksum != expected) {
+      std::cerr << "ERROR: " << kernels[k].first << " is wrong" << std::endl;
+      return 1;
+    }
+    std::cout << " - " << kernels[k].first << ":\t" << ns << " ns/rank" << std::endl;
+  }
+
+  return 0;
+}
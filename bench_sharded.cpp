@@ -0,0 +1,91 @@
+#include <cassert>
+#include <iostream>
+
+#include <ShardedDynPDT.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+template <typename LabelPoolType>
+int bench(const char* argv[]) {
+  auto key_name = argv[2];
+  const auto num_shards = static_cast<uint64_t>(std::atoll(argv[3]));
+  const auto num_threads = static_cast<uint64_t>(std::atoll(argv[4]));
+
+  Setting setting;
+  setting.num_keys = static_cast<uint64_t>(std::atoll(argv[5]));
+  setting.load_factor = std::atof(argv[6]);
+  setting.fixed_len = static_cast<uint64_t>(std::atoi(argv[7]));
+  setting.width_1st = static_cast<uint8_t>(std::atoi(argv[8]));
+
+  ShardedDynPDT<LabelPoolType> dic(setting, num_shards);
+  {
+    StopWatch sw;
+    dic.bulk_load(std::string(key_name), num_threads, [](uint64_t) { return 1; });
+    const auto us = sw(StopWatch::MICRO);
+
+    std::cout << "Bench: run_bulk_load" << std::endl;
+    std::cout << " - num_threads:\t" << num_threads << std::endl;
+    std::cout << " - num_keys:\t" << dic.num_keys() << std::endl;
+    std::cout << " - insert time:\t" << us / dic.num_keys() << " us/key" << std::endl;
+  }
+
+  {
+    const auto keys = read_keys(key_name);
+    size_t ng = 0;
+    StopWatch sw;
+    for (const auto& key : keys) {
+      int value = 0;
+      if (!dic.find(key, value) || value != 1) {
+        ++ng;
+      }
+    }
+    const auto us = sw(StopWatch::MICRO);
+
+    std::cout << "Bench: run_search" << std::endl;
+    std::cout << " - ng:\t" << ng << std::endl;
+    std::cout << " - search time:\t" << us / keys.size() << " us/key" << std::endl;
+  }
+
+  dic.show_stat(std::cout);
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <dic_type> <key> <#shards> <#threads> <#keys> <LF> <len> <w1>";
+
+  if (argc != 9) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  switch (*argv[1]) {
+    case '1':
+      return bench<LabelPool_Plain<int>>(argv);
+    case '2':
+      return bench<LabelPool_BitMap<int, 0>>(argv);
+    case '3':
+      return bench<LabelPool_BitMap<int, 1>>(argv);
+    case '4':
+      return bench<LabelPool_BitMap<int, 2>>(argv);
+    case '5':
+      return bench<LabelPool_BitMap<int, 3>>(argv);
+    case '6':
+      return bench<LabelPool_Arena<int>>(argv);
+    case '7':
+      return bench<LabelPool_BitMap<int, 3, true>>(argv);
+    case '8':
+      return bench<LabelPool_BitMap<int, 3, true, 8>>(argv);
+    default:
+      break;
+  }
+
+  std::cerr << usage.str() << std::endl;
+  return 1;
+}
@@ -0,0 +1,352 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include <sys/resource.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <DynPDT.hpp>
+
+#include "bench_tools.hpp"
+
+using namespace dynpdt;
+
+namespace {
+
+struct Workload {
+  std::string key_name; // "url", "id", "text" or a file of keys
+  uint64_t num_keys = 0;
+  bool zipf = false; // or uniform
+  double negative_ratio = 0.0; // of lookups for absent keys
+  double insert_ratio = 0.0; // of operations in the mixed phase
+  std::string format; // "text", "json" or "csv"
+};
+
+// Latencies of the operations of a phase in nanoseconds, allocated for the number of them
+struct Phase {
+  std::string name;
+  std::vector<double> latencies;
+  uint64_t ng = 0;
+
+  double mean() const {
+    double sum = 0.0;
+    for (auto ns : latencies) {
+      sum += ns;
+    }
+    return latencies.empty() ? 0.0 : sum / latencies.size();
+  }
+
+  // latencies must be sorted
+  double percentile(double p) const {
+    if (latencies.empty()) {
+      return 0.0;
+    }
+    const auto i = static_cast<uint64_t>(p * (latencies.size() - 1) + 0.5);
+    return latencies[i];
+  }
+};
+
+// in bytes (ru_maxrss is in kilobytes on Linux)
+uint64_t get_peak_rss() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+}
+
+// in bytes, or 0 where /proc is not available
+uint64_t get_current_rss() {
+  std::ifstream ifs("/proc/self/statm");
+  uint64_t size = 0, resident = 0;
+  if (!(ifs >> size >> resident)) {
+    return 0;
+  }
+  return resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+}
+
+/*
+ * Draws queries over the first num_stored keys and absent ones. Ranks follow Zipf's law in the
+ * order of insertion with zipf, so the oldest keys are the hottest.
+ * */
+class QueryGenerator {
+public:
+  QueryGenerator(const Workload& workload, uint64_t num_stored,
+                 const std::vector<std::string>& absents)
+    : zipf_(workload.zipf ? num_stored : 1, 0.99), zipf_enabled_(workload.zipf),
+      num_stored_(num_stored), negative_ratio_(workload.negative_ratio), absents_(absents),
+      rnd_(13) {}
+
+  // Returns the index of a stored key, or UINT64_MAX for an absent one set to absent_id
+  uint64_t next(uint64_t& absent_id) {
+    if (!absents_.empty() && std::uniform_real_distribution<double>(0.0, 1.0)(rnd_)
+                             < negative_ratio_) {
+      absent_id = rnd_() % absents_.size();
+      return UINT64_MAX;
+    }
+    return zipf_enabled_ ? zipf_(rnd_) : rnd_() % num_stored_;
+  }
+
+private:
+  ZipfGenerator zipf_;
+  bool zipf_enabled_;
+  uint64_t num_stored_;
+  double negative_ratio_;
+  const std::vector<std::string>& absents_;
+  std::mt19937_64 rnd_;
+};
+
+// Measures an operation, including about two reads of the clock
+template <typename Func>
+double time_op(Func func) {
+  const auto begin = std::chrono::steady_clock::now();
+  func();
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+  return elapsed.count();
+}
+
+template <typename LabelPoolType>
+void run_find(const DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys,
+              const std::vector<std::string>& absents, uint64_t num_stored,
+              const Workload& workload, Phase& phase) {
+  QueryGenerator queries(workload, num_stored, absents);
+
+  for (auto& latency : phase.latencies) {
+    uint64_t absent_id = 0;
+    const auto key_id = queries.next(absent_id);
+    const auto& key = (key_id == UINT64_MAX) ? absents[absent_id] : keys[key_id];
+    const int* ptr = nullptr;
+    latency = time_op([&]() { ptr = dic.find(key); });
+    if ((key_id == UINT64_MAX) != (ptr == nullptr)) {
+      ++phase.ng;
+    }
+  }
+}
+
+// Inserts the rest of the keys interleaved with lookups of the stored ones
+template <typename LabelPoolType>
+void run_mixed(DynPDT<LabelPoolType>& dic, const std::vector<std::string>& keys,
+               const std::vector<std::string>& absents, uint64_t num_stored,
+               const Workload& workload, Phase& phase) {
+  QueryGenerator queries(workload, num_stored, absents);
+  std::mt19937_64 rnd(17);
+  uint64_t next_id = num_stored;
+
+  for (auto& latency : phase.latencies) {
+    const bool insert = std::uniform_real_distribution<double>(0.0, 1.0)(rnd)
+                        < workload.insert_ratio;
+    if (insert && next_id < keys.size()) {
+      const auto& key = keys[next_id++];
+      latency = time_op([&]() { *dic.update(key) = 1; });
+      continue;
+    }
+    uint64_t absent_id = 0;
+    const auto key_id = queries.next(absent_id);
+    const auto& key = (key_id == UINT64_MAX) ? absents[absent_id] : keys[key_id];
+    const int* ptr = nullptr;
+    latency = time_op([&]() { ptr = dic.find(key); });
+    if ((key_id == UINT64_MAX) != (ptr == nullptr)) {
+      ++phase.ng;
+    }
+  }
+}
+
+void write_text(const std::string& dic_name, const Workload& workload,
+                const std::vector<Phase>& phases, uint64_t size_in_bytes, uint64_t peak_rss,
+                uint64_t dic_rss) {
+  using std::endl;
+  std::cout << "Bench: " << dic_name << " on " << workload.key_name << endl;
+  for (const auto& phase : phases) {
+    std::cout << " - " << phase.name << ":" << endl;
+    std::cout << "   - ops:\t" << phase.latencies.size() << endl;
+    std::cout << "   - ng:\t" << phase.ng << endl;
+    std::cout << "   - mean:\t" << phase.mean() << " ns" << endl;
+    std::cout << "   - p50:\t" << phase.percentile(0.5) << " ns" << endl;
+    std::cout << "   - p99:\t" << phase.percentile(0.99) << " ns" << endl;
+    std::cout << "   - p999:\t" << phase.percentile(0.999) << " ns" << endl;
+  }
+  std::cout << " - size_in_bytes:\t" << size_in_bytes << endl;
+  std::cout << " - peak_rss:\t" << peak_rss << endl;
+  std::cout << " - rss_of_dic:\t" << dic_rss << endl;
+}
+
+void write_json(const std::string& dic_name, const Workload& workload,
+                const std::vector<Phase>& phases, uint64_t size_in_bytes, uint64_t peak_rss,
+                uint64_t dic_rss) {
+  std::cout << "{\"dic\":\"" << dic_name << "\",\"keys\":\"" << workload.key_name
+            << "\",\"num_keys\":" << workload.num_keys
+            << ",\"dist\":\"" << (workload.zipf ? "zipf" : "uniform")
+            << "\",\"negative_ratio\":" << workload.negative_ratio
+            << ",\"insert_ratio\":" << workload.insert_ratio << ",\"phases\":[";
+  for (size_t i = 0; i < phases.size(); ++i) {
+    const auto& phase = phases[i];
+    std::cout << (i ? "," : "") << "{\"name\":\"" << phase.name
+              << "\",\"ops\":" << phase.latencies.size() << ",\"ng\":" << phase.ng
+              << ",\"mean_ns\":" << phase.mean() << ",\"p50_ns\":" << phase.percentile(0.5)
+              << ",\"p99_ns\":" << phase.percentile(0.99)
+              << ",\"p999_ns\":" << phase.percentile(0.999) << "}";
+  }
+  std::cout << "],\"size_in_bytes\":" << size_in_bytes << ",\"peak_rss\":" << peak_rss
+            << ",\"rss_of_dic\":" << dic_rss << "}" << std::endl;
+}
+
+// One row per phase, without the header unless the phases are empty
+void write_csv(const std::string& dic_name, const Workload& workload,
+               const std::vector<Phase>& phases, uint64_t size_in_bytes, uint64_t peak_rss,
+               uint64_t dic_rss) {
+  if (phases.empty()) {
+    std::cout << "dic,keys,num_keys,dist,negative_ratio,insert_ratio,phase,ops,ng,"
+              << "mean_ns,p50_ns,p99_ns,p999_ns,size_in_bytes,peak_rss,rss_of_dic"
+              << std::endl;
+    return;
+  }
+  for (const auto& phase : phases) {
+    std::cout << dic_name << "," << workload.key_name << "," << workload.num_keys << ","
+              << (workload.zipf ? "zipf" : "uniform") << "," << workload.negative_ratio << ","
+              << workload.insert_ratio << "," << phase.name << "," << phase.latencies.size()
+              << "," << phase.ng << "," << phase.mean() << "," << phase.percentile(0.5) << ","
+              << phase.percentile(0.99) << "," << phase.percentile(0.999) << ","
+              << size_in_bytes << "," << peak_rss << "," << dic_rss << std::endl;
+  }
+}
+
+template <typename LabelPoolType>
+int bench(const Workload& workload) {
+  std::vector<std::string> keys, absents;
+  if (workload.key_name == "url" || workload.key_name == "id" || workload.key_name == "text") {
+    // The absent keys are made with another seed and filtered
+    keys = make_keys(workload.key_name, workload.num_keys, 13);
+    absents = make_keys(workload.key_name, workload.num_keys, 17);
+  } else {
+    keys = read_keys(workload.key_name.c_str());
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(13));
+    if (workload.num_keys < keys.size()) {
+      // The rest are absent from the dictionary
+      absents.assign(keys.begin() + workload.num_keys, keys.end());
+      keys.resize(workload.num_keys);
+    }
+  }
+  if (keys.empty()) {
+    std::cerr << "ERROR: no keys of " << workload.key_name << std::endl;
+    return 1;
+  }
+  {
+    auto sorted = keys;
+    std::sort(sorted.begin(), sorted.end());
+    absents.erase(std::remove_if(absents.begin(), absents.end(), [&](const std::string& key) {
+      return std::binary_search(sorted.begin(), sorted.end(), key);
+    }), absents.end());
+  }
+
+  // Half of the keys are left to the mixed phase if any
+  const auto num_loaded = workload.insert_ratio == 0.0 ? keys.size() : keys.size() / 2;
+  std::vector<Phase> phases = {{"insert", std::vector<double>(num_loaded)},
+                               {"find", std::vector<double>(num_loaded)}};
+  if (num_loaded < keys.size()) {
+    const auto num_ops = static_cast<uint64_t>((keys.size() - num_loaded) / workload.insert_ratio);
+    phases.push_back({"mixed", std::vector<double>(num_ops)});
+  }
+
+  // The growth of the resident set while the dictionary is made and used. The memory freed by
+  // making the keys is returned first so that the dictionary does not reuse it unnoticed.
+#ifdef __GLIBC__
+  malloc_trim(0);
+#endif
+  const auto base_rss = get_current_rss();
+
+  Setting setting;
+  setting.num_keys = num_loaded;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 16;
+  setting.width_1st = 6;
+
+  DynPDT<LabelPoolType> dic(setting);
+  for (uint64_t i = 0; i < num_loaded; ++i) {
+    phases[0].latencies[i] = time_op([&]() { *dic.update(keys[i]) = 1; });
+  }
+  run_find(dic, keys, absents, num_loaded, workload, phases[1]);
+  if (phases.size() == 3) {
+    run_mixed(dic, keys, absents, num_loaded, workload, phases[2]);
+  }
+
+  for (auto& phase : phases) {
+    if (phase.ng != 0) {
+      std::cerr << "ERROR: " << phase.ng << " wrong results in " << phase.name << std::endl;
+      return 1;
+    }
+    std::sort(phase.latencies.begin(), phase.latencies.end());
+  }
+
+  const auto name = DynPDT<LabelPoolType>::name();
+  const auto size_in_bytes = dic.size_in_bytes();
+  const auto peak_rss = get_peak_rss();
+  const auto current_rss = get_current_rss();
+  const auto dic_rss = base_rss < current_rss ? current_rss - base_rss : 0;
+  if (workload.format == "json") {
+    write_json(name, workload, phases, size_in_bytes, peak_rss, dic_rss);
+  } else if (workload.format == "csv") {
+    write_csv(name, workload, phases, size_in_bytes, peak_rss, dic_rss);
+  } else {
+    write_text(name, workload, phases, size_in_bytes, peak_rss, dic_rss);
+  }
+  return 0;
+}
+
+} // namespace
+
+int main(int argc, const char* argv[]) {
+  std::ostringstream usage;
+  usage << argv[0] << " <dic_type> <url|id|text|key_file> <#keys> <uniform|zipf>"
+        << " <negative_ratio> <insert_ratio> <text|json|csv|csv_header>";
+
+  if (argc != 8) {
+    std::cerr << usage.str() << std::endl;
+    return 1;
+  }
+
+  Workload workload;
+  workload.key_name = argv[2];
+  workload.num_keys = static_cast<uint64_t>(std::atoll(argv[3]));
+  workload.zipf = std::strcmp(argv[4], "zipf") == 0;
+  workload.negative_ratio = std::atof(argv[5]);
+  workload.insert_ratio = std::atof(argv[6]);
+  workload.format = argv[7];
+
+  if (workload.format == "csv_header") {
+    write_csv("", workload, {}, 0, 0, 0);
+    return 0;
+  }
+  if (workload.insert_ratio < 0.0 || 1.0 < workload.insert_ratio) {
+    std::cerr << "ERROR: insert_ratio must be in [0, 1]" << std::endl;
+    return 1;
+  }
+
+  // Peak RSS is of the process, so a run measures one type
+  switch (*argv[1]) {
+    case '1':
+      return bench<LabelPool_Plain<int>>(workload);
+    case '2':
+      return bench<LabelPool_BitMap<int, 0>>(workload);
+    case '3':
+      return bench<LabelPool_BitMap<int, 1>>(workload);
+    case '4':
+      return bench<LabelPool_BitMap<int, 2>>(workload);
+    case '5':
+      return bench<LabelPool_BitMap<int, 3>>(workload);
+    case '6':
+      return bench<LabelPool_Arena<int>>(workload);
+    case '7':
+      return bench<LabelPool_BitMap<int, 3, true>>(workload);
+    case '8':
+      return bench<LabelPool_BitMap<int, 3, true, 8>>(workload);
+    default:
+      break;
+  }
+
+  std::cerr << usage.str() << std::endl;
+  return 1;
+}
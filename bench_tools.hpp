@@ -0,0 +1,191 @@
+#ifndef DYNPDT_BENCH_TOOLS_HPP
+#define DYNPDT_BENCH_TOOLS_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace dynpdt {
+
+class StopWatch {
+public:
+  enum Times {
+    SEC, MILLI, MICRO
+  };
+
+  StopWatch() : tp_(std::chrono::high_resolution_clock::now()) {}
+  ~StopWatch() {}
+
+  double operator()(Times type) const {
+    auto tp = std::chrono::high_resolution_clock::now() - tp_;
+    switch (type) {
+      case Times::SEC:
+        return std::chrono::duration<double>(tp).count();
+      case Times::MILLI:
+        return std::chrono::duration<double, std::milli>(tp).count();
+      case Times::MICRO:
+        return std::chrono::duration<double, std::micro>(tp).count();
+    }
+    return 0.0;
+  }
+
+  StopWatch(const StopWatch&) = delete;
+  StopWatch& operator=(const StopWatch&) = delete;
+
+private:
+  std::chrono::high_resolution_clock::time_point tp_;
+};
+
+class KeyReader {
+public:
+  KeyReader(const char* file_name) {
+    std::ios::sync_with_stdio(false);
+    buf_.reserve(1 << 10);
+    ifs_.open(file_name);
+  }
+  ~KeyReader() {}
+
+  bool is_ready() const {
+    return !ifs_.fail();
+  }
+
+  const std::string& next() {
+    std::getline(ifs_, buf_);
+    return buf_;
+  }
+
+  KeyReader(const KeyReader&) = delete;
+  KeyReader& operator=(const KeyReader&) = delete;
+
+private:
+  std::ifstream ifs_;
+  std::string buf_;
+};
+
+inline std::vector<std::string> read_keys(const char* file_name) {
+  std::ifstream ifs(file_name);
+  if (!ifs) {
+    std::cerr << "ERROR : failed to open " << file_name << std::endl;
+    return {};
+  }
+
+  std::string line;
+  std::vector<std::string> keys;
+
+  while (std::getline(ifs, line)) {
+    if (line.empty()) {
+      continue;
+    }
+    keys.push_back(line);
+  }
+
+  return keys;
+}
+
+/*
+ * Draws ranks in [0, n) where rank i is drawn with probability proportional to 1 / (i + 1)^theta,
+ * by a binary search on the cumulative distribution.
+ * */
+class ZipfGenerator {
+public:
+  ZipfGenerator(uint64_t n, double theta) : cdf_(n) {
+    double sum = 0.0;
+    for (uint64_t i = 0; i < n; ++i) {
+      sum += 1.0 / std::pow(static_cast<double>(i + 1), theta);
+      cdf_[i] = sum;
+    }
+    for (auto& p : cdf_) {
+      p /= sum;
+    }
+  }
+
+  template <typename Random>
+  uint64_t operator()(Random& rnd) {
+    const auto p = std::uniform_real_distribution<double>(0.0, 1.0)(rnd);
+    const auto it = std::lower_bound(cdf_.begin(), cdf_.end(), p);
+    return std::min<uint64_t>(it - cdf_.begin(), cdf_.size() - 1);
+  }
+
+private:
+  std::vector<double> cdf_;
+};
+
+/*
+ * Synthetic keys of num_keys distinct strings in random order, made from a seed:
+ *  - "url": URLs over a few thousand hosts with paths of common words, sharing long prefixes.
+ *  - "id": decimal numbers up to 12 digits, over a small alphabet without shared structure.
+ *  - "text": phrases of one to four words whose frequencies follow Zipf's law.
+ * Returns an empty vector for an unknown kind.
+ * */
+inline std::vector<std::string> make_keys(const std::string& kind, uint64_t num_keys,
+                                          uint64_t seed) {
+  std::mt19937_64 rnd(seed);
+
+  auto make_word = [&](uint64_t min_syllables, uint64_t max_syllables) {
+    static const char* consonants = "bcdfghklmnprstvwz";
+    static const char* vowels = "aeiou";
+    std::string word;
+    const auto num_syllables = min_syllables + rnd() % (max_syllables - min_syllables + 1);
+    for (uint64_t i = 0; i < num_syllables; ++i) {
+      word += consonants[rnd() % 17];
+      word += vowels[rnd() % 5];
+    }
+    return word;
+  };
+
+  std::vector<std::string> vocabulary(1U << 12);
+  for (auto& word : vocabulary) {
+    word = make_word(1, 4);
+  }
+  ZipfGenerator zipf(vocabulary.size(), 1.0);
+
+  std::vector<std::string> hosts(1U << 11);
+  for (auto& host : hosts) {
+    static const char* tlds[] = {".com", ".org", ".net", ".jp", ".de"};
+    host = "https://www." + make_word(2, 4) + tlds[rnd() % 5];
+  }
+  ZipfGenerator host_zipf(hosts.size(), 1.0);
+
+  std::vector<std::string> keys;
+  keys.reserve(num_keys);
+  // Duplicates are removed in rounds until enough distinct keys are made
+  while (keys.size() < num_keys) {
+    for (uint64_t i = keys.size(); i < num_keys; ++i) {
+      std::string key;
+      if (kind == "url") {
+        key = hosts[host_zipf(rnd)];
+        const auto num_segments = 1 + rnd() % 4;
+        for (uint64_t j = 0; j < num_segments; ++j) {
+          key += "/" + vocabulary[zipf(rnd)];
+        }
+        if (rnd() % 4 == 0) {
+          key += "?id=" + std::to_string(rnd() % 100000);
+        }
+      } else if (kind == "id") {
+        key = std::to_string(rnd() % 1000000000000ULL);
+      } else if (kind == "text") {
+        const auto num_words = 1 + rnd() % 4;
+        for (uint64_t j = 0; j < num_words; ++j) {
+          key += (j ? " " : "") + vocabulary[zipf(rnd)];
+        }
+      } else {
+        return {};
+      }
+      keys.push_back(std::move(key));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+
+  std::shuffle(keys.begin(), keys.end(), rnd);
+  return keys;
+}
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_BENCH_TOOLS_HPP
@@ -0,0 +1,343 @@
+#ifndef DYNPDT_AUX_TABLE_HPP
+#define DYNPDT_AUX_TABLE_HPP
+
+#include <atomic>
+
+#include "basics.hpp"
+#include "EpochReclaimer.hpp"
+
+namespace dynpdt {
+
+/*
+ * Displacement values exceeding the 1st layer of SimpleBonsai, keyed by slot positions.
+ *
+ * As in m-Bonsai, they are layered. The 2nd layer packs a position and a displacement of
+ * kDspBits2nd bits into a word, which holds almost all of them; the 3rd layer takes the rest in
+ * two words. Each layer is a hash table based on linear probing.
+ *
+ * find() is safe while a single writer inserts: an entry is published by writing its key after
+ * (or with) its value, and a grown table replaces the old one atomically. The old table is
+ * retired to the reclaimer if given, or deleted at once.
+ * */
+class AuxTable {
+public:
+  static constexpr uint64_t kDspBits2nd = 16;
+
+  AuxTable() {}
+  ~AuxTable() {}
+
+  // Returns UINT64_MAX if pos is not registered
+  uint64_t find(uint64_t pos) const {
+    if (mapped_) {
+      return find_mapped_(pos);
+    }
+    const auto dsp = layer_2nd_.find(pos + 1);
+    return dsp != UINT64_MAX ? dsp : layer_3rd_.find(pos + 1);
+  }
+
+  void insert(uint64_t pos, uint64_t dsp) {
+    assert(!mapped_);
+    assert(find(pos) == UINT64_MAX);
+    if (PackedEntry::fits(pos + 1, dsp)) {
+      layer_2nd_.insert(pos + 1, dsp);
+    } else {
+      layer_3rd_.insert(pos + 1, dsp);
+    }
+  }
+
+  // Calls func(pos, dsp) for every entry in arbitrary order
+  template<typename Func>
+  void for_each(Func func) const {
+    if (mapped_) {
+      for (uint64_t i = 0; i < num_mapped_2nd_; ++i) {
+        func(PackedEntry{mapped_2nd_[i]}.key() - 1, PackedEntry{mapped_2nd_[i]}.dsp());
+      }
+      for (uint64_t i = 0; i < num_mapped_3rd_; ++i) {
+        func(mapped_3rd_[i].key - 1, mapped_3rd_[i].dsp);
+      }
+      return;
+    }
+    layer_2nd_.for_each([&](uint64_t key, uint64_t dsp) { func(key - 1, dsp); });
+    layer_3rd_.for_each([&](uint64_t key, uint64_t dsp) { func(key - 1, dsp); });
+  }
+
+  void set_reclaimer(EpochReclaimer* reclaimer) {
+    layer_2nd_.set_reclaimer(reclaimer);
+    layer_3rd_.set_reclaimer(reclaimer);
+  }
+
+  uint64_t size() const {
+    return size_2nd() + size_3rd();
+  }
+  uint64_t size_2nd() const {
+    return mapped_ ? num_mapped_2nd_ : layer_2nd_.size();
+  }
+  uint64_t size_3rd() const {
+    return mapped_ ? num_mapped_3rd_ : layer_3rd_.size();
+  }
+
+  uint64_t size_in_bytes() const {
+    if (mapped_) {
+      return num_mapped_2nd_ * sizeof(PackedEntry) + num_mapped_3rd_ * sizeof(WideEntry);
+    }
+    return layer_2nd_.size_in_bytes() + layer_3rd_.size_in_bytes();
+  }
+
+  // The entries of each layer are written in the order of positions so that map() can search them.
+  void save(std::ostream& os) const {
+    std::vector<uint64_t> words;
+    std::vector<WideEntry> wides;
+    for_each([&](uint64_t pos, uint64_t dsp) {
+      if (PackedEntry::fits(pos + 1, dsp)) {
+        words.push_back(PackedEntry::make(pos + 1, dsp).word);
+      } else {
+        wides.push_back({pos + 1, dsp});
+      }
+    });
+    std::sort(words.begin(), words.end());
+    std::sort(wides.begin(), wides.end(), [](const WideEntry& a, const WideEntry& b) {
+      return a.key < b.key;
+    });
+    save_array(os, words.data(), words.size());
+    save_array(os, wides.data(), wides.size());
+  }
+
+  void load(std::istream& is) {
+    std::vector<uint64_t> words;
+    std::vector<WideEntry> wides;
+    load_array(is, words);
+    load_array(is, wides);
+
+    layer_2nd_.clear();
+    layer_3rd_.clear();
+    mapped_ = false;
+    for (auto word : words) {
+      layer_2nd_.insert(PackedEntry{word}.key(), PackedEntry{word}.dsp());
+    }
+    for (const auto& wide : wides) {
+      layer_3rd_.insert(wide.key, wide.dsp);
+    }
+  }
+
+  // Refers to the entries written by save() without copying; insert() is no longer allowed.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    mapped_2nd_ = map_array<uint64_t>(ptr, end, num_mapped_2nd_);
+    mapped_3rd_ = map_array<WideEntry>(ptr, end, num_mapped_3rd_);
+    layer_2nd_.clear();
+    layer_3rd_.clear();
+    mapped_ = true;
+  }
+
+  AuxTable(const AuxTable&) = delete;
+  AuxTable& operator=(const AuxTable&) = delete;
+
+private:
+  static constexpr uint64_t kMinCapacity = 16;
+
+  // Key (pos + 1, or 0 for empty) and displacement in a word, published at once
+  struct PackedEntry {
+    uint64_t word;
+
+    static bool fits(uint64_t key, uint64_t dsp) {
+      return (key >> (64 - kDspBits2nd)) == 0 && (dsp >> kDspBits2nd) == 0;
+    }
+    static PackedEntry make(uint64_t key, uint64_t dsp) {
+      return {(key << kDspBits2nd) | dsp};
+    }
+
+    uint64_t key() const {
+      return word >> kDspBits2nd;
+    }
+    uint64_t dsp() const {
+      return word & ((1ULL << kDspBits2nd) - 1);
+    }
+    uint64_t acquire(uint64_t& dsp) const {
+      const PackedEntry entry{__atomic_load_n(&word, __ATOMIC_ACQUIRE)};
+      dsp = entry.dsp();
+      return entry.key();
+    }
+    void publish(uint64_t key, uint64_t dsp) {
+      __atomic_store_n(&word, make(key, dsp).word, __ATOMIC_RELEASE);
+    }
+  };
+
+  // Key (pos + 1, or 0 for empty) published after the displacement
+  struct WideEntry {
+    uint64_t key;
+    uint64_t dsp;
+
+    uint64_t acquire(uint64_t& dsp) const {
+      const auto ret = __atomic_load_n(&this->key, __ATOMIC_ACQUIRE);
+      dsp = this->dsp;
+      return ret;
+    }
+    void publish(uint64_t key, uint64_t dsp) {
+      this->dsp = dsp;
+      __atomic_store_n(&this->key, key, __ATOMIC_RELEASE);
+    }
+  };
+
+  static uint64_t key_of_(const PackedEntry& entry) {
+    return entry.key();
+  }
+  static uint64_t key_of_(const WideEntry& entry) {
+    return entry.key;
+  }
+  static uint64_t dsp_of_(const PackedEntry& entry) {
+    return entry.dsp();
+  }
+  static uint64_t dsp_of_(const WideEntry& entry) {
+    return entry.dsp;
+  }
+
+  template<typename Entry>
+  class Layer {
+  public:
+    Layer() {}
+
+    ~Layer() {
+      delete table_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t find(uint64_t key) const {
+      const auto table = table_.load(std::memory_order_acquire);
+      if (!table) {
+        return UINT64_MAX;
+      }
+      for (auto i = hash_(key, table->mask);; i = (i + 1) & table->mask) {
+        uint64_t dsp = 0;
+        const auto stored = table->entries[i].acquire(dsp);
+        if (stored == 0) {
+          return UINT64_MAX;
+        }
+        if (stored == key) {
+          return dsp;
+        }
+      }
+    }
+
+    void insert(uint64_t key, uint64_t dsp) {
+      auto table = table_.load(std::memory_order_relaxed);
+      if (!table || table->capacity() < (size_ + 1) * 2) {
+        table = expand_(table);
+      }
+      insert_(*table, key, dsp);
+      ++size_;
+    }
+
+    // Calls func(key, dsp) for every entry in arbitrary order
+    template<typename Func>
+    void for_each(Func func) const {
+      const auto table = table_.load(std::memory_order_acquire);
+      if (!table) {
+        return;
+      }
+      for (const auto& entry : table->entries) {
+        if (key_of_(entry) != 0) {
+          func(key_of_(entry), dsp_of_(entry));
+        }
+      }
+    }
+
+    void clear() {
+      delete table_.exchange(nullptr, std::memory_order_relaxed);
+      size_ = 0;
+    }
+
+    void set_reclaimer(EpochReclaimer* reclaimer) {
+      reclaimer_ = reclaimer;
+    }
+
+    uint64_t size() const {
+      return size_;
+    }
+
+    uint64_t size_in_bytes() const {
+      const auto table = table_.load(std::memory_order_relaxed);
+      return table ? sizeof(Table) + table->capacity() * sizeof(Entry) : 0;
+    }
+
+    Layer(const Layer&) = delete;
+    Layer& operator=(const Layer&) = delete;
+
+  private:
+    struct Table {
+      std::vector<Entry> entries;
+      uint64_t mask;
+
+      uint64_t capacity() const {
+        return entries.size();
+      }
+    };
+
+    std::atomic<Table*> table_{nullptr};
+    uint64_t size_ = 0;
+    EpochReclaimer* reclaimer_ = nullptr;
+
+    static uint64_t hash_(uint64_t key, uint64_t mask) {
+      return (((key - 1) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+    }
+
+    static void insert_(Table& table, uint64_t key, uint64_t dsp) {
+      auto i = hash_(key, table.mask);
+      while (key_of_(table.entries[i]) != 0) {
+        i = (i + 1) & table.mask;
+      }
+      table.entries[i].publish(key, dsp);
+    }
+
+    Table* expand_(Table* table) {
+      const auto capacity = table ? table->capacity() * 2 : kMinCapacity;
+
+      auto new_table = std::make_unique<Table>();
+      new_table->entries.resize(capacity, Entry{});
+      new_table->mask = capacity - 1;
+      if (table) {
+        for (const auto& entry : table->entries) {
+          if (key_of_(entry) != 0) {
+            insert_(*new_table, key_of_(entry), dsp_of_(entry));
+          }
+        }
+      }
+
+      auto ret = new_table.release();
+      table_.store(ret, std::memory_order_release);
+
+      std::unique_ptr<Table> old_table(table);
+      if (reclaimer_ && old_table) {
+        reclaimer_->retire(std::move(old_table));
+      }
+      return ret;
+    }
+  };
+
+  Layer<PackedEntry> layer_2nd_;
+  Layer<WideEntry> layer_3rd_;
+
+  // sorted entries on a mapped region
+  bool mapped_ = false;
+  const uint64_t* mapped_2nd_ = nullptr;
+  uint64_t num_mapped_2nd_ = 0;
+  const WideEntry* mapped_3rd_ = nullptr;
+  uint64_t num_mapped_3rd_ = 0;
+
+  uint64_t find_mapped_(uint64_t pos) const {
+    const auto key = pos + 1;
+    if (PackedEntry::fits(key, 0)) {
+      auto end = mapped_2nd_ + num_mapped_2nd_;
+      auto it = std::lower_bound(mapped_2nd_, end, PackedEntry::make(key, 0).word);
+      if (it != end && PackedEntry{*it}.key() == key) {
+        return PackedEntry{*it}.dsp();
+      }
+    }
+    auto end = mapped_3rd_ + num_mapped_3rd_;
+    auto it = std::lower_bound(mapped_3rd_, end, key, [](const WideEntry& entry, uint64_t key) {
+      return entry.key < key;
+    });
+    return (it == end || it->key != key) ? UINT64_MAX : it->dsp;
+  }
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_AUX_TABLE_HPP
@@ -1,9 +1,17 @@
 #ifndef DYNPDT_DYNPDT_HPP
 #define DYNPDT_DYNPDT_HPP
 
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <random>
+
+#include "MappedFile.hpp"
 #include "SimpleBonsai.hpp"
 #include "LabelPool_Plain.hpp"
 #include "LabelPool_BitMap.hpp"
+#include "LabelPool_Arena.hpp"
+#include "key_codec.hpp"
 
 namespace dynpdt {
 
@@ -12,6 +20,25 @@ struct Setting {
   double load_factor = 0.0;
   uint64_t fixed_len = 0; // of node labels
   uint8_t width_1st = 0;
+  // The trie is incrementally rebuilt into a larger one when its load factor exceeds
+  // max_load_factor (0 disables it), and the new one has growth_factor times more slots.
+  double max_load_factor = 0.9;
+  double growth_factor = 2.0;
+  // The trie is incrementally compacted when the erased keys exceed compaction_ratio of
+  // the stored labels, or the dead bytes of rewritten values exceed it of the label bytes
+  // (0 disables it).
+  double compaction_ratio = 0.25;
+  // Enables the single-writer, many-reader mode, where find(key, value) can be called from any
+  // thread while one thread updates. Slots are padded to widths dividing 64, and a rebuild is
+  // completed at once on copies of the labels and published as a whole.
+  bool concurrent = false;
+  // Marks the nodes having children, and those having children for keys ending inside their
+  // labels, with two bits per slot, so that for_each_prefix() and common_prefix_search() do not
+  // probe nodes without such children.
+  bool child_marks = false;
+  // Packs slots per 64-byte line so that no slot straddles cache lines, costing up to one slot
+  // width of bits per line (no effect with concurrent).
+  bool blocked_slots = false;
 
   void show_stat(std::ostream& os) const {
     using std::endl;
@@ -20,46 +47,841 @@ struct Setting {
     os << " - load_factor:\t" << load_factor << endl;
     os << " - fixed_len:\t" << fixed_len << endl;
     os << " - width_1st:\t" << static_cast<uint32_t>(width_1st) << endl;
+    os << " - max_load_factor:\t" << max_load_factor << endl;
+    os << " - growth_factor:\t" << growth_factor << endl;
+    os << " - compaction_ratio:\t" << compaction_ratio << endl;
+    os << " - concurrent:\t" << concurrent << endl;
+    os << " - child_marks:\t" << child_marks << endl;
+    os << " - blocked_slots:\t" << blocked_slots << endl;
+  }
+
+  void save(std::ostream& os) const {
+    save_value(os, num_keys);
+    save_value(os, load_factor);
+    save_value(os, fixed_len);
+    save_value(os, width_1st);
+    save_value(os, max_load_factor);
+    save_value(os, growth_factor);
+    save_value(os, compaction_ratio);
+    save_value(os, concurrent);
+    save_value(os, child_marks);
+    save_value(os, blocked_slots);
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_keys);
+    load_value(is, load_factor);
+    load_value(is, fixed_len);
+    load_value(is, width_1st);
+    load_value(is, max_load_factor);
+    load_value(is, growth_factor);
+    load_value(is, compaction_ratio);
+    load_value(is, concurrent);
+    load_value(is, child_marks);
+    load_value(is, blocked_slots);
+  }
+
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_keys);
+    map_value(ptr, end, load_factor);
+    map_value(ptr, end, fixed_len);
+    map_value(ptr, end, width_1st);
+    map_value(ptr, end, max_load_factor);
+    map_value(ptr, end, growth_factor);
+    map_value(ptr, end, compaction_ratio);
+    map_value(ptr, end, concurrent);
+    map_value(ptr, end, child_marks);
+    map_value(ptr, end, blocked_slots);
+  }
+};
+
+// Target cost per key for DynPDT::tune(), where 0 means no limit
+struct TuneBudget {
+  double bytes_per_key = 0.0;
+  double ns_per_lookup = 0.0;
+};
+
+// Setting chosen by DynPDT::tune() and its cost measured on the sample
+struct TuneResult {
+  Setting setting;
+  double bytes_per_key = 0.0;
+  double ns_per_lookup = 0.0;
+  bool within_budget = false;
+
+  void show_stat(std::ostream& os) const {
+    using std::endl;
+    os << "Show statistics of TuneResult" << endl;
+    os << " - fixed_len:\t" << setting.fixed_len << endl;
+    os << " - width_1st:\t" << static_cast<uint32_t>(setting.width_1st) << endl;
+    os << " - bytes_per_key:\t" << bytes_per_key << endl;
+    os << " - ns_per_lookup:\t" << ns_per_lookup << endl;
+    os << " - within_budget:\t" << within_budget << endl;
   }
 };
 
-template<typename _LabelPoolType>
+// StatsType is NoStats or LookupStats, which counts the hot paths of lookups (see stats()).
+// FixedLen and Width1st fix setting.fixed_len and setting.width_1st at compile time if nonzero,
+// so that the step nodes and the slots are handled with constants (see FixedDynPDT).
+template<typename _LabelPoolType, typename _HashType = Hash_Prime, typename _StatsType = NoStats,
+         uint64_t FixedLen = 0, uint8_t Width1st = 0>
 class DynPDT {
 public:
   using LabelPoolType = _LabelPoolType;
   using ValueType = typename _LabelPoolType::ValueType;
+  using HashType = _HashType;
+  using StatsType = _StatsType;
 
   static constexpr uint8_t kAdjustAlphabet = 3; // heuristic
+  static constexpr uint64_t kFixedLen = FixedLen; // 0 if given by Setting
+  static constexpr uint8_t kWidth1st = Width1st; // 0 if given by Setting
+  static_assert((kFixedLen & (kFixedLen - 1)) == 0, "FixedLen must be a power of 2");
+
+  using TrieType = SimpleBonsai<HashType, StatsType,
+                                kFixedLen ? (kFixedLen << 8) - kAdjustAlphabet : 0, kWidth1st>;
+
   static constexpr uint8_t kLabelMax = UINT8_MAX - kAdjustAlphabet;
   static constexpr uint64_t kStepSymbol = UINT8_MAX; // <UINT8_MAX, 0>
+  static constexpr uint64_t kMinNumSlots = 1U << 8;
+  static constexpr uint64_t kBatchWidth = 16; // lookups interleaved in find_batch()
+  static constexpr uint64_t kTuneSampleSize = 1U << 14; // keys sampled by retune()
+  static constexpr uint64_t kTerminalMark = TrieType::kChildMark << 1; // see marks_of_()
+
+  // Refers to the value of a key by its node, which does not move while the trie is unchanged.
+  // A handle is invalidated when a rebuild completes, since the nodes are then renumbered.
+  struct ValueHandle {
+    uint64_t node_id = UINT64_MAX;
+    uint64_t generation = 0; // num_rebuilds() when the handle was made
+
+    bool is_valid() const {
+      return node_id != UINT64_MAX;
+    }
+  };
 
   static std::string name() {
     std::ostringstream oss;
-    oss << "DynPDT_" << LabelPoolType::name().substr(std::strlen("LabelPool_"));
+    oss << "DynPDT_" << LabelPoolType::name().substr(std::strlen("LabelPool_"))
+        << "_" << HashType::name().substr(std::strlen("Hash_"));
     return oss.str();
   }
 
+  // An empty dictionary to be loaded or mapped
+  DynPDT() {}
+
+  // Zero fixed_len and width_1st take the template arguments if given
   DynPDT(Setting setting) : setting_(setting) {
+    if (kFixedLen && setting_.fixed_len == 0) {
+      setting_.fixed_len = kFixedLen;
+    }
+    if (kWidth1st && setting_.width_1st == 0) {
+      setting_.width_1st = kWidth1st;
+    }
+    check_constants_();
     if (!is_power2(setting_.fixed_len)) {
       std::cerr << "ERROR: fixed_len must be a power of 2." << std::endl;
       exit(1);
     }
+    if (setting_.max_load_factor != 0.0 && setting_.growth_factor <= 1.0) {
+      std::cerr << "ERROR: growth_factor must be greater than 1." << std::endl;
+      exit(1);
+    }
 
-    trie_ = std::make_unique<SimpleBonsai>(setting_.num_keys / setting_.load_factor,
-                                           (setting_.fixed_len << 8) - kAdjustAlphabet,
-                                           setting_.width_1st);
-    label_pool_ = std::make_unique<LabelPoolType>(trie_->num_slots());
+    if (setting_.concurrent) {
+      reclaimer_ = std::make_unique<EpochReclaimer>();
+    }
+
+    const auto num_slots = static_cast<uint64_t>(setting_.num_keys / setting_.load_factor);
+    trie_ = make_trie_(std::max<uint64_t>(num_slots, +kMinNumSlots));
+    label_pool_ = make_label_pool_(trie_->num_slots());
     table_.fill(UINT8_MAX);
+    publish_view_();
   }
 
-  ~DynPDT() {}
+  ~DynPDT() {
+    delete view_.load();
+  }
 
+  // In the concurrent mode, only the writer thread may use the returned pointer.
   const ValueType* find(const std::string& key) const {
     return find_(key);
   }
 
+  // Copies the value of key if found. In the concurrent mode, this can be called from any thread
+  // while another one updates; readers take no locks and see the trie and the labels as published
+  // by the writer, which should set values by update(key, value) for such readers.
+  bool find(const std::string& key, ValueType& value) const {
+    return find_(key, value);
+  }
+
+  // Looks up the keys as find() does, but interleaves kBatchWidth lookups so that the cache
+  // misses of each one are overlapped with the work of the others by prefetching.
+  // In the concurrent mode, only the writer thread may call this.
+  void find_batch(const std::vector<std::string>& keys, std::vector<const ValueType*>& out) const {
+    out.resize(keys.size());
+
+    if (next_trie_) {
+      // Labels are split into two pools during the rebuild
+      for (uint64_t i = 0; i < keys.size(); ++i) {
+        out[i] = find_(keys[i]);
+      }
+      return;
+    }
+
+    std::array<Lookup, kBatchWidth> lookups;
+    uint64_t num_started = 0, num_running = 0;
+
+    for (auto& lookup : lookups) {
+      if (num_started < keys.size()) {
+        start_lookup_(lookup, num_started, keys[num_started]);
+        ++num_started;
+        ++num_running;
+      }
+    }
+
+    while (num_running != 0) {
+      for (auto& lookup : lookups) {
+        if (lookup.stage == Lookup::kDone || !advance_lookup_(lookup)) {
+          continue;
+        }
+        out[lookup.index] = lookup.value;
+        if (num_started < keys.size()) {
+          start_lookup_(lookup, num_started, keys[num_started]);
+          ++num_started;
+        } else {
+          lookup.stage = Lookup::kDone;
+          --num_running;
+        }
+      }
+    }
+  }
+
+  // Calls callback(key, value) for every stored key in the order of slots, until it returns
+  // false. Each key is restored by following the parents of its node, which is much faster than
+  // for_each_prefix() probing children. In the concurrent mode, only the writer thread may call
+  // this, as well as for_each_prefix().
+  template<typename Callback>
+  void for_each(Callback callback) const {
+    const auto chars = make_char_table_();
+    std::vector<std::pair<uint64_t, uint64_t>> path;
+    std::string key;
+
+    for (uint64_t node_id = 0; node_id < trie_->num_slots(); ++node_id) {
+      if (!trie_->is_used(node_id)) {
+        continue;
+      }
+      // Step nodes have no labels
+      CharRange label;
+      const ValueType* value_ptr = get_label_(node_id, label);
+      if (!value_ptr || is_erased_(node_id)) {
+        continue;
+      }
+      restore_prefix_(node_id, chars, path, key);
+      key.append(label.begin, label.end);
+      if (!callback(key, *value_ptr)) {
+        return;
+      }
+    }
+  }
+
+  // Calls callback(key, value) for the stored keys starting with prefix in lexicographic order,
+  // until it returns false. Since the trie cannot list the children of a node, they are found by
+  // probing every character used so far at every position of the node label; leaves are not
+  // probed with Setting::child_marks.
+  template<typename Callback>
+  void for_each_prefix(const std::string& prefix, Callback callback) const {
+    std::vector<uint8_t> alphabet; // in ascending order
+    for (uint32_t c = 0; c < 256; ++c) {
+      if (get_code_(static_cast<uint8_t>(c)) != UINT8_MAX) {
+        alphabet.push_back(static_cast<uint8_t>(c));
+      }
+    }
+
+    // Goes down to the node whose label covers the rest of prefix
+    auto node_id = trie_->get_root();
+    auto rest = CharRange(prefix);
+    --rest.end; // without the terminator
+    std::string key;
+
+    while (true) {
+      CharRange label;
+      if (!get_label_(node_id, label)) {
+        // Empty
+        return;
+      }
+
+      uint64_t num_match = 0;
+      while (num_match < rest.length() && num_match < label.length()
+             && rest.begin[num_match] == label.begin[num_match]) {
+        ++num_match;
+      }
+      if (num_match == rest.length()) {
+        break;
+      }
+
+      for (uint64_t i = 0; i < num_match / fixed_len_(); ++i) {
+        if (!trie_->get_child(node_id, kStepSymbol)) {
+          return;
+        }
+      }
+      const auto c = rest.begin[num_match];
+      if (get_code_(c) == UINT8_MAX
+          || !trie_->get_child(node_id, make_symbol_(c, num_match % fixed_len_()))) {
+        return;
+      }
+
+      key.append(rest.begin, rest.begin + num_match + 1);
+      rest.begin += num_match + 1;
+    }
+
+    visit_(node_id, rest.length(), alphabet, key, callback);
+  }
+
+  // Calls callback(length, value_ptr) for each stored key that is a prefix of key, including key
+  // itself, in ascending order of length until it returns false, in a single pass along key.
+  // A key ending inside the label of a node on the path is found by probing its child for '\0'
+  // at each matched position; Setting::child_marks skips nodes without such children.
+  template<typename Callback>
+  void common_prefix_search(const std::string& key, Callback callback) const {
+    // No key has ended inside a label if '\0' has never been a branching character
+    const bool has_terminals = get_code_('\0') != UINT8_MAX;
+
+    auto node_id = trie_->get_root();
+    auto rest = CharRange(key);
+    --rest.end; // without the terminator
+    uint64_t length = 0; // of the consumed part of key
+
+    while (true) {
+      CharRange label;
+      const ValueType* value_ptr = get_label_(node_id, label);
+      if (!value_ptr) {
+        // Empty
+        return;
+      }
+
+      uint64_t num_match = 0;
+      while (num_match < rest.length() && num_match < label.length()
+             && rest.begin[num_match] == label.begin[num_match]) {
+        ++num_match;
+      }
+
+      // Keys ending at the matched positions, i.e., children for '\0' under the step nodes
+      auto step_id = node_id;
+      uint64_t num_steps = 0;
+      bool has_steps = true;
+      const auto end_pos = has_terminals ? std::min(num_match + 1, label.length()) : 0;
+      for (uint64_t pos = 0; pos < end_pos; ++pos) {
+        if (pos == (num_steps + 1) * fixed_len_()) {
+          if (!trie_->has_children(step_id) || !trie_->get_child(step_id, kStepSymbol)) {
+            has_steps = false;
+            break;
+          }
+          ++num_steps;
+        }
+        if (!trie_->has_marks(step_id, kTerminalMark)) {
+          // Skips to the next step node
+          pos = (num_steps + 1) * fixed_len_() - 1;
+          continue;
+        }
+        auto child_id = step_id;
+        if (!trie_->get_child(child_id, make_symbol_('\0', pos % fixed_len_()))) {
+          continue;
+        }
+        CharRange child_label;
+        const ValueType* child_value_ptr = get_label_(child_id, child_label);
+        if (!is_erased_(child_id) && !callback(length + pos, child_value_ptr)) {
+          return;
+        }
+      }
+
+      if (num_match == label.length() && !is_erased_(node_id)) {
+        if (!callback(length + num_match, value_ptr)) {
+          return;
+        }
+      }
+      if (num_match == rest.length()) {
+        return;
+      }
+
+      // Goes down at the mismatched position
+      while ((num_steps + 1) * fixed_len_() <= num_match) {
+        if (!has_steps || !trie_->get_child(step_id, kStepSymbol)) {
+          return;
+        }
+        ++num_steps;
+      }
+      const auto c = rest.begin[num_match];
+      if (get_code_(c) == UINT8_MAX
+          || !trie_->get_child(step_id, make_symbol_(c, num_match % fixed_len_()))) {
+        return;
+      }
+
+      node_id = step_id;
+      length += num_match + 1;
+      rest.begin += num_match + 1;
+    }
+  }
+
+  // The returned pointer can be invalidated by the next update or erase, since the label pool
+  // may reallocate or shift the labels around it; use update_handle() to keep referring to it.
+  // In the concurrent mode, readers can see the key before the value is written through the
+  // pointer, so update(key, value) should be used instead.
   ValueType* update(const std::string& key) {
-    return update_(key);
+    check_writable_();
+    uint64_t node_id = 0;
+    return update_(key, node_id);
+  }
+
+  // Sets the value of key, inserting key if not stored. The value is written before the label
+  // of key is published, and in the concurrent mode readers see either the old value or the new
+  // one, which are never written in place.
+  void update(const std::string& key, const ValueType& value) {
+    static_assert(!std::is_same<ValueType, VarBytes>::value, "use update_bytes() for VarBytes");
+    check_writable_();
+    uint64_t node_id = 0;
+    update_(key, node_id, &value);
+  }
+
+  // Inserts key if not stored, and returns the handle to its value for value_at()
+  ValueHandle update_handle(const std::string& key) {
+    check_writable_();
+    ValueHandle handle;
+    update_(key, handle.node_id);
+    handle.generation = num_rebuilds_;
+    return handle;
+  }
+
+  // Returns the handle to the value of key, or an invalid one if not found
+  ValueHandle find_handle(const std::string& key) const {
+    ValueHandle handle;
+    uint64_t found_id = UINT64_MAX;
+    find_(*trie_, key, [&](uint64_t node_id, CharRange label, uint64_t& num_match) {
+      // Saved before locate_label_() translates it, since value_at() translates it again
+      const auto trie_id = node_id;
+      auto& label_pool = locate_label_(node_id);
+      auto value_ptr = compare_label_(label_pool, node_id, label, num_match);
+      if (value_ptr) {
+        found_id = trie_id;
+      }
+      return value_ptr;
+    });
+    handle.node_id = found_id;
+    handle.generation = num_rebuilds_;
+    return handle;
+  }
+
+  // Returns the pointer to the value of the handle without traversing the trie, or nullptr if
+  // the key was erased or the handle is invalidated by a rebuild. The pointer follows the same
+  // rule as the one of update(). In the concurrent mode, only the writer thread may call this.
+  const ValueType* value_at(const ValueHandle& handle) const {
+    if (!handle.is_valid() || handle.generation != num_rebuilds_) {
+      return nullptr;
+    }
+    auto node_id = handle.node_id;
+    auto& label_pool = locate_label_(node_id);
+    CharRange label;
+    auto value_ptr = label_pool.get_label(node_id, label);
+    return (value_ptr && !label_pool.is_erased(node_id)) ? value_ptr : nullptr;
+  }
+  // The value must not be written through the pointer if the dictionary is read-only.
+  ValueType* value_at(const ValueHandle& handle) {
+    return const_cast<ValueType*>(static_cast<const DynPDT*>(this)->value_at(handle));
+  }
+
+  // With VarBytes values, sets the value of key to the bytes, inserting key if not stored.
+  // The value is rewritten in place if it fits in the space of the old one, or moved otherwise.
+  ByteSpan update_bytes(const std::string& key, const uint8_t* data, uint64_t size) {
+    check_writable_();
+    // Rewritten values leave their old records behind, which are released as erased keys
+    prepare_erase_();
+    uint64_t node_id = 0;
+    update_(key, node_id);
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.set_value(node_id, data, size)->span();
+  }
+
+  ByteSpan update_bytes(const std::string& key, const std::string& bytes) {
+    return update_bytes(key, reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+  }
+
+  // With VarBytes values, copies the value of key if found. As find(key, value), this can be
+  // called from any thread in the concurrent mode.
+  bool find_bytes(const std::string& key, std::string& bytes) const {
+    auto copy = [&](const ValueType* ptr) {
+      if (ptr) {
+        const auto span = ptr->span();
+        bytes.assign(reinterpret_cast<const char*>(span.data), span.size);
+      }
+      return ptr != nullptr;
+    };
+    if (!reclaimer_) {
+      return copy(find_(key));
+    }
+
+    const auto guard = reclaimer_->pin();
+    const auto view = view_.load(std::memory_order_acquire);
+    auto label_pool = view->label_pool;
+    return copy(find_(*view->trie, key, [this, label_pool](uint64_t node_id, CharRange label,
+                                                           uint64_t& num_match) {
+      return compare_label_(*label_pool, node_id, label, num_match);
+    }));
+  }
+
+  bool erase(const std::string& key) {
+    check_writable_();
+    return erase_(key);
+  }
+
+  // Binary keys of any bytes, including zeros. They are stored encoded by key_codec, whose
+  // functions decode the keys given by for_each() and the prefix searches. Encoded keys use
+  // most byte values, so they should not be mixed with text keys in a dictionary.
+  ValueType* update_binary(const uint8_t* data, uint64_t size) {
+    check_writable_();
+    std::string key;
+    key_codec::encode_bytes(data, size, key);
+    uint64_t node_id = 0;
+    return update_(key, node_id);
+  }
+
+  const ValueType* find_binary(const uint8_t* data, uint64_t size) const {
+    std::string key;
+    key_codec::encode_bytes(data, size, key);
+    return find_(key);
+  }
+
+  bool find_binary(const uint8_t* data, uint64_t size, ValueType& value) const {
+    std::string key;
+    key_codec::encode_bytes(data, size, key);
+    return find_(key, value);
+  }
+
+  bool erase_binary(const uint8_t* data, uint64_t size) {
+    check_writable_();
+    std::string key;
+    key_codec::encode_bytes(data, size, key);
+    return erase_(key);
+  }
+
+  // Integer keys, encoded by key_codec into kIntLength bytes on the stack without allocation.
+  // As binary keys, they should not be mixed with other keys in a dictionary.
+  ValueType* update_int(uint64_t key) {
+    check_writable_();
+    IntKey codes;
+    uint64_t node_id = 0;
+    return update_(make_int_key_(key, codes), node_id);
+  }
+
+  const ValueType* find_int(uint64_t key) const {
+    IntKey codes;
+    return find_(make_int_key_(key, codes));
+  }
+
+  bool find_int(uint64_t key, ValueType& value) const {
+    IntKey codes;
+    return find_(make_int_key_(key, codes), value);
+  }
+
+  bool erase_int(uint64_t key) {
+    check_writable_();
+    IntKey codes;
+    return erase_(make_int_key_(key, codes));
+  }
+
+  // Builds the empty dictionary from keys sorted without duplicates, setting the value of
+  // keys[i] to value_of(i). Since each key branches off the path of the previous one, nodes are
+  // added without comparing labels, the trie is sized for the exact number of nodes, and the
+  // labels are appended in the order of ids. The result can be updated as usual.
+  template<typename ValueOf>
+  void build(const std::vector<std::string>& keys, ValueOf value_of) {
+    check_writable_();
+    if (num_keys_ != 0 || trie_->num_nodes() != 1 || next_trie_) {
+      std::cerr << "ERROR: build() needs an empty dictionary" << std::endl;
+      exit(1);
+    }
+    if (keys.empty()) {
+      return;
+    }
+
+    // Not less than the number of slots given by the setting
+    const auto num_nodes = count_build_nodes_(keys);
+    const auto num_slots = static_cast<uint64_t>(num_nodes / setting_.load_factor);
+    auto old_trie = std::move(trie_);
+    auto old_label_pool = std::move(label_pool_);
+    trie_ = make_trie_(std::max(num_slots, old_trie->num_slots()));
+    label_pool_ = make_label_pool_(trie_->num_slots());
+
+    std::vector<LabelItem<ValueType>> items(keys.size());
+    items[0] = {trie_->get_root(), CharRange(keys[0]), value_of(0)};
+
+    // Nodes on the path of the previous key, whose labels begin at the positions
+    struct Branch {
+      uint64_t node_id;
+      uint64_t begin;
+      uint64_t steps_begin; // in steps
+    };
+    std::vector<Branch> path = {{trie_->get_root(), 0, 0}};
+    std::vector<uint64_t> steps; // step nodes under the nodes in path
+
+    for (uint64_t i = 1; i < keys.size(); ++i) {
+      const auto pos = build_branch_pos_(keys[i - 1], keys[i]);
+      while (pos < path.back().begin) {
+        steps.resize(path.back().steps_begin);
+        path.pop_back();
+      }
+
+      const auto& top = path.back();
+      const auto num_match = pos - top.begin;
+      const auto num_steps = num_match / fixed_len_();
+      while (steps.size() - top.steps_begin < num_steps) {
+        auto node_id = (steps.size() == top.steps_begin) ? top.node_id : steps.back();
+        trie_->add_child(node_id, kStepSymbol);
+        steps.push_back(node_id);
+        ++num_steps_;
+      }
+
+      const auto c = static_cast<uint8_t>(keys[i][pos]);
+      if (table_[c] == UINT8_MAX) {
+        __atomic_store_n(&table_[c], num_chars_++, __ATOMIC_RELAXED);
+        if (kLabelMax < num_chars_) {
+          std::cerr << "ERROR: kLabelMax < alphabet_count_" << std::endl;
+          exit(1);
+        }
+      }
+
+      auto node_id = num_steps ? steps[top.steps_begin + num_steps - 1] : top.node_id;
+      const auto symbol = make_symbol_(c, num_match % fixed_len_());
+      trie_->add_child(node_id, symbol, marks_of_(symbol));
+
+      CharRange label(keys[i]);
+      label.begin += pos + 1;
+      items[i] = {node_id, label, value_of(i)};
+      path.push_back({node_id, pos + 1, steps.size()});
+    }
+    assert(trie_->num_nodes() == num_nodes);
+
+    std::sort(items.begin(), items.end(), [](const LabelItem<ValueType>& a,
+                                             const LabelItem<ValueType>& b) {
+      return a.id < b.id;
+    });
+    label_pool_->append_sorted(items);
+    num_keys_ = keys.size();
+
+    publish_view_();
+    retire_(std::move(old_trie));
+    retire_(std::move(old_label_pool));
+  }
+
+  void build(const std::vector<std::string>& keys) {
+    build(keys, [](uint64_t) { return ValueType(); });
+  }
+
+  // Chooses fixed_len and width_1st for keys like the sample, taking the other fields from base.
+  // Each candidate is measured by building this type of dictionary from the sample and looking
+  // up all of it, so the cost reflects the step nodes, the aux displacements and the labels of
+  // the actual keys. Among the candidates within budget, the smallest one is chosen if only
+  // ns_per_lookup is limited, and the fastest one otherwise; if none is within, the one
+  // exceeding it the least in ratio. The costs are those on the sample, where keys share shorter
+  // prefixes than in the whole set. The group size of a label pool is a template parameter,
+  // so it is chosen by comparing the results of the pool types.
+  static TuneResult tune(std::vector<std::string> sample, const Setting& base,
+                         const TuneBudget& budget) {
+    std::sort(sample.begin(), sample.end());
+    sample.erase(std::unique(sample.begin(), sample.end()), sample.end());
+    if (sample.empty()) {
+      std::cerr << "ERROR: tune() needs a non-empty sample" << std::endl;
+      exit(1);
+    }
+
+    // Looked up in random order, as they are rarely in key order
+    auto queries = sample;
+    std::shuffle(queries.begin(), queries.end(), std::mt19937(13));
+
+    TuneResult best;
+    // The template arguments leave no choice if given
+    const uint64_t min_fixed_len = kFixedLen ? kFixedLen : kMinTuneFixedLen;
+    const uint64_t max_fixed_len = kFixedLen ? kFixedLen : kMaxTuneFixedLen;
+    const uint8_t min_width_1st = kWidth1st ? kWidth1st : kMinTuneWidth1st;
+    const uint8_t max_width_1st = kWidth1st ? kWidth1st : kMaxTuneWidth1st;
+    for (uint64_t fixed_len = min_fixed_len; fixed_len <= max_fixed_len; fixed_len *= 2) {
+      for (uint8_t width_1st = min_width_1st; width_1st <= max_width_1st; ++width_1st) {
+        TuneResult result;
+        result.setting = base;
+        result.setting.num_keys = sample.size();
+        result.setting.fixed_len = fixed_len;
+        result.setting.width_1st = width_1st;
+        result.setting.concurrent = false;
+
+        DynPDT dic(result.setting);
+        dic.build(sample);
+        result.bytes_per_key = static_cast<double>(dic.size_in_bytes()) / sample.size();
+        result.ns_per_lookup = dic.measure_lookups_(queries);
+
+        result.setting.num_keys = base.num_keys;
+        result.setting.concurrent = base.concurrent;
+        result.within_budget = tune_ratio_(result, budget) <= 1.0;
+        if (best.setting.fixed_len == 0 || is_better_tuned_(result, best, budget)) {
+          best = result;
+        }
+      }
+    }
+    return best;
+  }
+
+  // Rebuilds the dictionary with the setting chosen by tune() from a sample of the stored keys,
+  // taken at even intervals in key order. The stored keys and values are copied meanwhile.
+  // This is not allowed in the concurrent mode, since readers depend on fixed_len.
+  TuneResult retune(const TuneBudget& budget, uint64_t max_sample_size = kTuneSampleSize) {
+    check_writable_();
+    if (reclaimer_) {
+      std::cerr << "ERROR: retune() is not allowed in the concurrent mode" << std::endl;
+      exit(1);
+    }
+    static_assert(!std::is_same<ValueType, VarBytes>::value,
+                  "retune() does not support VarBytes values");
+
+    std::vector<std::pair<std::string, ValueType>> entries;
+    entries.reserve(num_keys_);
+    for_each([&](const std::string& key, const ValueType& value) {
+      entries.emplace_back(key, value);
+      return true;
+    });
+    if (entries.empty()) {
+      return TuneResult();
+    }
+    std::sort(entries.begin(), entries.end(), [](const std::pair<std::string, ValueType>& a,
+                                                 const std::pair<std::string, ValueType>& b) {
+      return a.first < b.first;
+    });
+
+    std::vector<std::string> keys(entries.size());
+    for (uint64_t i = 0; i < entries.size(); ++i) {
+      keys[i] = std::move(entries[i].first);
+    }
+    std::vector<std::string> sample;
+    const auto interval = (keys.size() + max_sample_size - 1) / max_sample_size;
+    for (uint64_t i = 0; i < keys.size(); i += interval) {
+      sample.push_back(keys[i]);
+    }
+
+    const auto result = tune(std::move(sample), setting_, budget);
+    setting_.fixed_len = result.setting.fixed_len;
+    setting_.width_1st = result.setting.width_1st;
+
+    // The codes are kept, and handles are invalidated as by a rebuild
+    next_trie_.reset();
+    next_label_pool_.reset();
+    id_map_.reset();
+    rebuild_pos_ = 0;
+    next_num_steps_ = 0;
+    num_keys_ = 0;
+    num_steps_ = 0;
+    trie_ = make_trie_(kMinNumSlots);
+    label_pool_ = make_label_pool_(trie_->num_slots());
+    build(keys, [&](uint64_t i) { return entries[i].second; });
+    ++num_rebuilds_;
+    return result;
+  }
+
+  // An in-progress rebuild is completed before writing.
+  void save(std::ostream& os) {
+    if (next_trie_) {
+      advance_rebuild_(trie_->num_slots());
+    }
+
+    save_string(os, name());
+    setting_.save(os);
+    save_value(os, num_keys_);
+    save_value(os, num_steps_);
+    save_value(os, num_rebuilds_);
+    save_array(os, table_.data(), table_.size());
+    save_value(os, num_chars_);
+    trie_->save(os);
+    label_pool_->save(os);
+  }
+
+  void save(const std::string& file_name) {
+    std::ofstream ofs(file_name, std::ios::binary);
+    if (!ofs) {
+      std::cerr << "ERROR: failed to open " << file_name << std::endl;
+      exit(1);
+    }
+    save(ofs);
+  }
+
+  void load(std::istream& is) {
+    if (load_string(is) != name()) {
+      std::cerr << "ERROR: not a dictionary of " << name() << std::endl;
+      exit(1);
+    }
+
+    clear_();
+    setting_.load(is);
+    load_value(is, num_keys_);
+    load_value(is, num_steps_);
+    load_value(is, num_rebuilds_);
+    std::vector<uint8_t> table;
+    load_array(is, table);
+    check_consistent(table.size() == table_.size());
+    std::copy(table.begin(), table.end(), table_.begin());
+    load_value(is, num_chars_);
+    check_constants_();
+    trie_ = std::make_unique<TrieType>();
+    trie_->load(is);
+    trie_->set_stats(&stats_);
+    label_pool_ = std::make_unique<LabelPoolType>();
+    label_pool_->load(is);
+
+    if (setting_.concurrent) {
+      reclaimer_ = std::make_unique<EpochReclaimer>();
+      trie_->set_reclaimer(reclaimer_.get());
+      label_pool_->set_reclaimer(reclaimer_.get());
+      publish_view_();
+    }
+  }
+
+  void load(const std::string& file_name) {
+    std::ifstream ifs(file_name, std::ios::binary);
+    if (!ifs) {
+      std::cerr << "ERROR: failed to open " << file_name << std::endl;
+      exit(1);
+    }
+    load(ifs);
+  }
+
+  // Makes a read-only dictionary working directly on the memory-mapped file written by save().
+  // The file is shared among processes. Its labels are checked once when mapped, and the trie
+  // is paged in on demand.
+  void map(const std::string& file_name) {
+    clear_();
+    mapped_file_ = std::make_unique<MappedFile>(file_name.c_str());
+
+    auto ptr = mapped_file_->data();
+    const auto end = ptr + mapped_file_->size();
+    if (map_string(ptr, end) != name()) {
+      std::cerr << "ERROR: not a dictionary of " << name() << std::endl;
+      exit(1);
+    }
+
+    setting_.map(ptr, end);
+    map_value(ptr, end, num_keys_);
+    map_value(ptr, end, num_steps_);
+    map_value(ptr, end, num_rebuilds_);
+    uint64_t table_size = 0;
+    auto table = map_array<uint8_t>(ptr, end, table_size);
+    check_consistent(table_size == table_.size());
+    std::copy(table, table + table_size, table_.begin());
+    map_value(ptr, end, num_chars_);
+    check_constants_();
+    trie_ = std::make_unique<TrieType>();
+    trie_->map(ptr, end);
+    trie_->set_stats(&stats_);
+    label_pool_ = std::make_unique<LabelPoolType>();
+    label_pool_->map(ptr, end);
+  }
+
+  bool is_read_only() const {
+    return mapped_file_ != nullptr;
+  }
+  bool is_concurrent() const {
+    return reclaimer_ != nullptr;
   }
 
   uint64_t num_keys() const {
@@ -71,11 +893,38 @@ public:
   uint8_t num_chars() const {
     return num_chars_;
   }
+  uint64_t num_erased() const {
+    return label_pool_->num_erased() + (next_label_pool_ ? next_label_pool_->num_erased() : 0);
+  }
+  uint64_t num_rebuilds() const {
+    return num_rebuilds_;
+  }
+  bool is_rebuilding() const {
+    return next_trie_ != nullptr;
+  }
+
+  const Setting& get_setting() const {
+    return setting_;
+  }
+
+  // Estimated memory of the trie and the labels, including those of an in-progress rebuild
+  uint64_t size_in_bytes() const {
+    uint64_t ret = trie_->size_in_bytes() + label_pool_->size_in_bytes();
+    if (next_trie_) {
+      ret += next_trie_->size_in_bytes() + next_label_pool_->size_in_bytes()
+             + id_map_->size_in_bytes();
+    }
+    return ret;
+  }
 
-  const SimpleBonsai* get_trie() const {
+  const TrieType* get_trie() const {
     return trie_.get();
   }
 
+  const LabelPoolType* get_label_pool() const {
+    return label_pool_.get();
+  }
+
   void show_stat(std::ostream& os) const {
     using std::endl;
     setting_.show_stat(os);
@@ -83,15 +932,31 @@ public:
     os << " - num_keys:\t" << num_keys() << endl;
     os << " - num_steps:\t" << num_steps() << endl;
     os << " - num_chars:\t" << static_cast<uint32_t>(num_chars()) << endl;
+    os << " - num_erased:\t" << num_erased() << endl;
+    os << " - num_rebuilds:\t" << num_rebuilds() << endl;
+    os << " - size_in_bytes:\t" << size_in_bytes() << endl;
     trie_->show_stat(os);
     label_pool_->show_stat(os);
+    if (StatsType::kEnabled) {
+      stats().show_stat(os);
+    }
+  }
+
+  // Counters of the lookups since the last reset_stats(), all zero with NoStats. find_() and
+  // find_batch() count the traversals, and get_child() counts its calls also from updates.
+  StatsSnapshot stats() const {
+    return stats_.snapshot();
+  }
+
+  void reset_stats() {
+    stats_.reset();
   }
 
   DynPDT(const DynPDT&) = delete;
   DynPDT& operator=(const DynPDT&) = delete;
 
 private:
-  const Setting setting_;
+  Setting setting_;
   uint64_t num_keys_ = 0;
   uint64_t num_steps_ = 0;
 
@@ -99,104 +964,831 @@ private:
   std::array<uint8_t, 256> table_;
   uint8_t num_chars_ = 0;
 
-  std::unique_ptr<SimpleBonsai> trie_;
+  std::unique_ptr<TrieType> trie_;
   std::unique_ptr<LabelPoolType> label_pool_;
 
+  // States of the incremental rebuild. While it is in progress, trie_ still holds all nodes and
+  // is used to traverse. The nodes are migrated into next_trie_ in the order of slots, and the
+  // labels of migrated nodes whose ids are less than rebuild_pos_ are in next_label_pool_.
+  // Nodes that do not lead to any live label are not migrated, which reclaims erased keys.
+  std::unique_ptr<TrieType> next_trie_;
+  std::unique_ptr<LabelPoolType> next_label_pool_;
+  std::unique_ptr<FitVector<>> id_map_; // old id -> new id + 1 (0 means not migrated)
+  uint64_t rebuild_pos_ = 0;
+  uint64_t next_num_steps_ = 0;
+  uint64_t num_rebuilds_ = 0;
+  std::vector<std::pair<uint64_t, uint64_t>> path_; // buffer used in migrate_node_()
+
+  std::unique_ptr<MappedFile> mapped_file_;
+
+  // Trie and label pool published to the readers in the concurrent mode.
+  // Replaced objects are retired to reclaimer_ instead of being deleted.
+  struct View {
+    const TrieType* trie;
+    LabelPoolType* label_pool;
+  };
+  std::atomic<View*> view_{nullptr};
+  std::unique_ptr<EpochReclaimer> reclaimer_;
+
+  // Counted also by const lookups and the tries through set_stats()
+  mutable StatsType stats_;
+
+  // State of a lookup in find_batch(). Each stage prefetches what the next one touches.
+  struct Lookup {
+    enum Stage : uint8_t {
+      kLoadLabel, // to prefetch the label through the prefetched pointer
+      kCompare, // to compare the prefetched label
+      kGetStep, // to probe the prefetched slot for a step node
+      kGetChild, // to probe the prefetched slot for a child
+      kDone
+    };
+
+    Stage stage = kDone;
+    uint64_t index = 0;
+    CharRange key;
+    uint64_t node_id = 0;
+    uint64_t num_match = 0;
+    HashValue hv;
+    const ValueType* value = nullptr;
+  };
+
+  static constexpr uint64_t kMinTuneFixedLen = 4;
+  static constexpr uint64_t kMaxTuneFixedLen = 64;
+  static constexpr uint8_t kMinTuneWidth1st = 2;
+  static constexpr uint8_t kMaxTuneWidth1st = 7;
+
+  // Returns the nanoseconds per lookup of the queries, the faster of two passes
+  double measure_lookups_(const std::vector<std::string>& queries) const {
+    double best_ns = 0.0;
+    for (int pass = 0; pass < 2; ++pass) {
+      uint64_t num_found = 0;
+      const auto begin = std::chrono::steady_clock::now();
+      for (const auto& query : queries) {
+        num_found += find_(query) != nullptr;
+      }
+      const std::chrono::duration<double, std::nano> elapsed
+        = std::chrono::steady_clock::now() - begin;
+      if (num_found != queries.size()) {
+        std::cerr << "ERROR: a sampled key is not found" << std::endl;
+        exit(1);
+      }
+      const auto ns = elapsed.count() / queries.size();
+      best_ns = (pass == 0) ? ns : std::min(best_ns, ns);
+    }
+    return best_ns;
+  }
+
+  // Ratio of the cost to the budget in the tighter term, which is 0 without any limit
+  static double tune_ratio_(const TuneResult& result, const TuneBudget& budget) {
+    double ratio = 0.0;
+    if (budget.bytes_per_key != 0.0) {
+      ratio = std::max(ratio, result.bytes_per_key / budget.bytes_per_key);
+    }
+    if (budget.ns_per_lookup != 0.0) {
+      ratio = std::max(ratio, result.ns_per_lookup / budget.ns_per_lookup);
+    }
+    return ratio;
+  }
+
+  static bool is_better_tuned_(const TuneResult& lhs, const TuneResult& rhs,
+                               const TuneBudget& budget) {
+    if (lhs.within_budget != rhs.within_budget) {
+      return lhs.within_budget;
+    }
+    if (!lhs.within_budget) {
+      return tune_ratio_(lhs, budget) < tune_ratio_(rhs, budget);
+    }
+    if (budget.ns_per_lookup != 0.0 && budget.bytes_per_key == 0.0) {
+      return lhs.bytes_per_key < rhs.bytes_per_key;
+    }
+    return lhs.ns_per_lookup < rhs.ns_per_lookup;
+  }
+
+  void check_writable_() const {
+    if (mapped_file_) {
+      std::cerr << "ERROR: the dictionary is read-only" << std::endl;
+      exit(1);
+    }
+  }
+
+  void clear_() {
+    label_pool_.reset();
+    trie_.reset();
+    next_label_pool_.reset();
+    next_trie_.reset();
+    id_map_.reset();
+    mapped_file_.reset();
+    rebuild_pos_ = 0;
+    next_num_steps_ = 0;
+    reclaimer_.reset();
+    delete view_.exchange(nullptr);
+  }
+
+  void publish_view_() {
+    if (!reclaimer_) {
+      return;
+    }
+    auto old_view = view_.exchange(new View{trie_.get(), label_pool_.get()});
+    if (old_view) {
+      reclaimer_->retire(std::unique_ptr<View>(old_view));
+    }
+  }
+
+  template<typename T>
+  void retire_(std::unique_ptr<T> data) {
+    if (reclaimer_) {
+      reclaimer_->retire(std::move(data));
+    }
+  }
+
   const ValueType* find_(CharRange key) const {
+    return find_(*trie_, key, [this](uint64_t node_id, CharRange label, uint64_t& num_match) {
+      auto& label_pool = locate_label_(node_id);
+      return compare_label_(label_pool, node_id, label, num_match);
+    });
+  }
+
+  // find(key, value) for any thread in the concurrent mode
+  bool find_(CharRange key, ValueType& value) const {
+    if (!reclaimer_) {
+      auto ptr = find_(key);
+      if (ptr) {
+        value = *ptr;
+      }
+      return ptr != nullptr;
+    }
+
+    const auto guard = reclaimer_->pin();
+    const auto view = view_.load(std::memory_order_acquire);
+    auto label_pool = view->label_pool;
+    auto ptr = find_(*view->trie, key, [this, label_pool](uint64_t node_id, CharRange label,
+                                                          uint64_t& num_match) {
+      return compare_label_(*label_pool, node_id, label, num_match);
+    });
+    if (ptr) {
+      // The value was written before the label holding it was published and is never rewritten
+      // in place, so the acquire loads of compare_and_get() order this copy after the write
+      std::memcpy(&value, ptr, sizeof(ValueType));
+    }
+    return ptr != nullptr;
+  }
+
+  // compare_and_get(node_id, label, num_match) compares label with that of node_id
+  template<typename CompareAndGet>
+  const ValueType* find_(const TrieType& trie, CharRange key,
+                         CompareAndGet compare_and_get) const {
     assert(key.begin != key.end);
 
-    auto node_id = trie_->get_root();
+    if (StatsType::kEnabled) {
+      stats_.count_find();
+    }
+    auto node_id = trie.get_root();
 
     while (key.begin != key.end) {
       uint64_t num_match = 0;
-      auto value_ptr = label_pool_->compare_and_get(node_id, key, num_match);
+      auto value_ptr = compare_and_get(node_id, key, num_match);
 
       if (value_ptr) {
         return value_ptr;
       }
+      if (num_match == key.length()) {
+        // Erased
+        return nullptr;
+      }
 
       key.begin += num_match;
 
       // Follow step nodes
-      while (setting_.fixed_len <= num_match) {
-        if (!trie_->get_child(node_id, kStepSymbol)) {
+      while (fixed_len_() <= num_match) {
+        if (StatsType::kEnabled) {
+          stats_.count_step();
+        }
+        if (!trie.get_child(node_id, kStepSymbol)) {
           return nullptr;
         }
-        num_match -= setting_.fixed_len;
+        num_match -= fixed_len_();
       }
 
-      if (table_[*key.begin] == UINT8_MAX) {
+      if (get_code_(*key.begin) == UINT8_MAX) {
         // Useless character
         return nullptr;
       }
 
-      if (!trie_->get_child(node_id, make_symbol_(*key.begin++, num_match))) {
+      if (!trie.get_child(node_id, make_symbol_(*key.begin++, num_match))) {
         return nullptr;
       }
     }
 
-    return label_pool_->compare_and_get(node_id, key);
+    uint64_t num_match = 0;
+    return compare_and_get(node_id, key, num_match);
   }
 
-  ValueType* update_(CharRange key) {
+  void start_lookup_(Lookup& lookup, uint64_t index, CharRange key) const {
     assert(key.begin != key.end);
 
-    auto node_id = trie_->get_root();
+    lookup.stage = Lookup::kLoadLabel;
+    lookup.index = index;
+    lookup.key = key;
+    lookup.node_id = trie_->get_root();
+    lookup.value = nullptr;
+    label_pool_->prefetch_ptr(lookup.node_id);
+    if (StatsType::kEnabled) {
+      stats_.count_find();
+    }
+  }
 
-    if (num_keys_ == 0) {
+  // Runs the current stage of the lookup, and returns true if it is finished.
+  // The steps are the same as find_() without rebuilding.
+  bool advance_lookup_(Lookup& lookup) const {
+    switch (lookup.stage) {
+      case Lookup::kLoadLabel:
+        label_pool_->prefetch_label(lookup.node_id);
+        lookup.stage = Lookup::kCompare;
+        return false;
+      case Lookup::kCompare: {
+        uint64_t num_match = 0;
+        lookup.value = compare_label_(*label_pool_, lookup.node_id, lookup.key, num_match);
+        if (lookup.value || num_match == lookup.key.length()) {
+          // Found, erased, or the key is consumed
+          return true;
+        }
+        lookup.key.begin += num_match;
+        lookup.num_match = num_match;
+        return !prepare_transition_(lookup);
+      }
+      case Lookup::kGetStep:
+        if (StatsType::kEnabled) {
+          stats_.count_step();
+        }
+        if (!trie_->get_child(lookup.node_id, lookup.hv)) {
+          return true;
+        }
+        lookup.num_match -= fixed_len_();
+        return !prepare_transition_(lookup);
+      case Lookup::kGetChild:
+        if (!trie_->get_child(lookup.node_id, lookup.hv)) {
+          return true;
+        }
+        label_pool_->prefetch_ptr(lookup.node_id);
+        lookup.stage = Lookup::kLoadLabel;
+        return false;
+      default:
+        break;
+    }
+    return true;
+  }
+
+  // Hashes the next transition prefetching its slot, and returns false if it cannot exist
+  bool prepare_transition_(Lookup& lookup) const {
+    if (fixed_len_() <= lookup.num_match) {
+      lookup.hv = trie_->prepare_child(lookup.node_id, kStepSymbol);
+      lookup.stage = Lookup::kGetStep;
+      return true;
+    }
+    if (get_code_(*lookup.key.begin) == UINT8_MAX) {
+      // Useless character
+      return false;
+    }
+    const auto symbol = make_symbol_(*lookup.key.begin++, lookup.num_match);
+    lookup.hv = trie_->prepare_child(lookup.node_id, symbol);
+    lookup.stage = Lookup::kGetChild;
+    return true;
+  }
+
+  // Also sets node_id to the node of key in trie_, whose label is found by locate_label_().
+  // The value is set to *value if given, or initialized for a new key.
+  ValueType* update_(CharRange key, uint64_t& node_id, const ValueType* value = nullptr) {
+    assert(key.begin != key.end);
+
+    const auto new_value = value ? *value : ValueType();
+    prepare_update_(key);
+    node_id = trie_->get_root();
+
+    if (trie_->num_nodes() == 1 && label_pool_->num_labels() == 0 && !next_trie_) {
       // First insert
       ++num_keys_;
-      return label_pool_->append(node_id, key);
+      return append_(node_id, key, new_value);
     }
 
     while (key.begin != key.end) {
       uint64_t num_match = 0;
-      auto value_ptr = label_pool_->compare_and_get(node_id, key, num_match);
+      auto value_ptr = compare_and_get_(node_id, key, num_match);
 
       if (value_ptr) {
-        return value_ptr;
+        return value ? set_value_(node_id, *value) : value_ptr;
+      }
+      if (num_match == key.length()) {
+        ++num_keys_;
+        return restore_(node_id, new_value);
       }
 
       key.begin += num_match;
 
-      while (setting_.fixed_len <= num_match) {
+      while (fixed_len_() <= num_match) {
         if (trie_->add_child(node_id, kStepSymbol)) {
           ++num_steps_;
         }
-        num_match -= setting_.fixed_len;
+        num_match -= fixed_len_();
       }
 
       if (table_[*key.begin] == UINT8_MAX) {
         // Update table
-        table_[*key.begin] = num_chars_++;
+        __atomic_store_n(&table_[*key.begin], num_chars_++, __ATOMIC_RELAXED);
         if (kLabelMax < num_chars_) {
           std::cerr << "ERROR: kLabelMax < alphabet_count_" << std::endl;
           exit(1);
         }
       }
 
-      if (trie_->add_child(node_id, make_symbol_(*key.begin++, num_match))) {
+      const auto symbol = make_symbol_(*key.begin++, num_match);
+      if (trie_->add_child(node_id, symbol, marks_of_(symbol))) {
         ++num_keys_;
-        return label_pool_->append(node_id, key);
+        return append_(node_id, key, new_value);
       }
     }
 
-    auto value_ptr = label_pool_->compare_and_get(node_id, key);
+    uint64_t num_match = 0;
+    auto value_ptr = compare_and_get_(node_id, key, num_match);
     if (value_ptr) {
-      return value_ptr;
+      return value ? set_value_(node_id, *value) : value_ptr;
     }
 
     ++num_keys_;
-    return label_pool_->append(node_id, key);
+    if (is_erased_(node_id)) {
+      return restore_(node_id, new_value);
+    }
+    return append_(node_id, key, new_value);
+  }
+
+  bool erase_(CharRange key) {
+    assert(key.begin != key.end);
+
+    auto node_id = trie_->get_root();
+    bool found = false;
+
+    while (true) {
+      uint64_t num_match = 0;
+      if (compare_and_get_(node_id, key, num_match)) {
+        found = true;
+        break;
+      }
+      if (key.begin == key.end || num_match == key.length()) {
+        break;
+      }
+
+      key.begin += num_match;
+
+      while (fixed_len_() <= num_match) {
+        if (!trie_->get_child(node_id, kStepSymbol)) {
+          return false;
+        }
+        num_match -= fixed_len_();
+      }
+
+      if (table_[*key.begin] == UINT8_MAX) {
+        return false;
+      }
+      if (!trie_->get_child(node_id, make_symbol_(*key.begin++, num_match))) {
+        return false;
+      }
+    }
+
+    if (!found) {
+      return false;
+    }
+
+    auto& label_pool = locate_label_(node_id);
+    label_pool.erase(node_id);
+    --num_keys_;
+
+    prepare_erase_();
+    return true;
+  }
+
+  // Returns the position where key branches off the path of prev, after checking the order
+  static uint64_t build_branch_pos_(const std::string& prev, const std::string& key) {
+    if (key <= prev) {
+      std::cerr << "ERROR: keys given to build() are not sorted without duplicates" << std::endl;
+      exit(1);
+    }
+    // prev can be a prefix of key, branching at its terminator
+    return simd_tools::mismatch(reinterpret_cast<const uint8_t*>(prev.data()),
+                                reinterpret_cast<const uint8_t*>(key.data()),
+                                std::min(prev.size(), key.size()));
+  }
+
+  // Counts the nodes build() makes, tracing the steps under the nodes on the current path
+  uint64_t count_build_nodes_(const std::vector<std::string>& keys) const {
+    std::vector<std::pair<uint64_t, uint64_t>> path = {{0, 0}}; // beginning of label, #steps
+    uint64_t num_nodes = 1;
+
+    for (uint64_t i = 1; i < keys.size(); ++i) {
+      const auto pos = build_branch_pos_(keys[i - 1], keys[i]);
+      while (pos < path.back().first) {
+        path.pop_back();
+      }
+      auto& top = path.back();
+      const auto num_steps = (pos - top.first) / fixed_len_();
+      if (top.second < num_steps) {
+        num_nodes += num_steps - top.second;
+        top.second = num_steps;
+      }
+      path.emplace_back(pos + 1, 0);
+      ++num_nodes;
+    }
+    return num_nodes;
+  }
+
+  // Encoded integer key with the terminator
+  using IntKey = std::array<uint8_t, key_codec::kIntLength + 1>;
+
+  static CharRange make_int_key_(uint64_t key, IntKey& codes) {
+    key_codec::encode_int(key, codes.data());
+    codes[key_codec::kIntLength] = '\0';
+    return CharRange(codes.data(), codes.data() + codes.size());
+  }
+
+  uint64_t fixed_len_() const {
+    return kFixedLen ? kFixedLen : setting_.fixed_len;
+  }
+
+  void check_constants_() const {
+    if ((kFixedLen && setting_.fixed_len != kFixedLen)
+        || (kWidth1st && setting_.width_1st != kWidth1st)) {
+      std::cerr << "ERROR: fixed_len or width_1st differs from the template argument" << std::endl;
+      exit(1);
+    }
+  }
+
+  std::unique_ptr<TrieType> make_trie_(uint64_t num_slots) const {
+    auto trie = std::make_unique<TrieType>(num_slots, (fixed_len_() << 8) - kAdjustAlphabet,
+                                           setting_.width_1st, setting_.concurrent,
+                                           setting_.child_marks, setting_.blocked_slots);
+    trie->set_reclaimer(reclaimer_.get());
+    trie->set_stats(&stats_);
+    return trie;
+  }
+
+  std::unique_ptr<LabelPoolType> make_label_pool_(uint64_t num_slots) const {
+    auto label_pool = std::make_unique<LabelPoolType>(num_slots);
+    label_pool->set_reclaimer(reclaimer_.get());
+    return label_pool;
+  }
+
+  // Returns the label pool and the id in it holding the label of node_id
+  LabelPoolType& locate_label_(uint64_t& node_id) const {
+    if (next_trie_ && node_id < rebuild_pos_) {
+      const auto new_id = id_map_->get(node_id);
+      if (new_id != 0) {
+        node_id = new_id - 1;
+        return *next_label_pool_;
+      }
+    }
+    return *label_pool_;
+  }
+
+  // compare_and_get() of lookups, counting the matched bytes and the skipped labels
+  ValueType* compare_label_(LabelPoolType& label_pool, uint64_t node_id, CharRange key,
+                            uint64_t& num_match) const {
+    auto value_ptr = label_pool.compare_and_get(node_id, key, num_match);
+    if (StatsType::kEnabled) {
+      stats_.count_compare(num_match, label_pool.skip_length(node_id));
+    }
+    return value_ptr;
+  }
+
+  ValueType* compare_and_get_(uint64_t node_id, CharRange key, uint64_t& num_match) const {
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.compare_and_get(node_id, key, num_match);
+  }
+
+  bool is_erased_(uint64_t node_id) const {
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.is_erased(node_id);
+  }
+
+  ValueType* restore_(uint64_t node_id, const ValueType& value) {
+    if (next_trie_ && node_id < rebuild_pos_) {
+      // The node may be left behind the migration because it was erased
+      migrate_node_(node_id);
+    }
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.restore(node_id, value);
+  }
+
+  ValueType* append_(uint64_t node_id, CharRange key, const ValueType& value) {
+    if (next_trie_ && node_id < rebuild_pos_) {
+      // The node is created behind the migration, so it is migrated right now
+      return next_label_pool_->append(migrate_node_(node_id), key, value);
+    }
+    return label_pool_->append(node_id, key, value);
+  }
+
+  ValueType* set_value_(uint64_t node_id, const ValueType& value) {
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.set_value(node_id, value);
+  }
+
+  // Advances the incremental rebuild so that it completes before trie_ becomes full
+  void prepare_update_(CharRange key) {
+    // Upper bound of the number of nodes added by the update
+    const auto max_new_nodes = key.length() / fixed_len_() + 2;
+
+    if (!next_trie_) {
+      if (setting_.max_load_factor == 0.0) {
+        return;
+      }
+      const auto max_nodes = setting_.max_load_factor * trie_->num_slots();
+      if (trie_->num_nodes() + max_new_nodes <= max_nodes) {
+        return;
+      }
+      const auto num_slots = static_cast<uint64_t>(trie_->num_slots() * setting_.growth_factor);
+      start_rebuild_(std::max(num_slots, trie_->num_slots() + 1));
+      if (reclaimer_) {
+        advance_rebuild_(trie_->num_slots());
+        prepare_update_(key);
+        return;
+      }
+    }
+
+    const auto num_slots = trie_->num_slots();
+    const auto num_frees = num_slots - trie_->num_nodes();
+
+    if (num_frees <= 2 * max_new_nodes) {
+      advance_rebuild_(num_slots - rebuild_pos_);
+      prepare_update_(key);
+      return;
+    }
+
+    const auto num_rests = num_slots - rebuild_pos_;
+    advance_rebuild_(num_rests * max_new_nodes / (num_frees - max_new_nodes) + 1);
+  }
+
+  // Advances the incremental rebuild, or starts compaction if many keys are erased or many
+  // values are rewritten
+  void prepare_erase_() {
+    if (next_trie_) {
+      advance_rebuild_(4 * trie_->num_slots() / (num_keys_ + 1) + 1);
+      return;
+    }
+    start_compaction_if_needed_();
+  }
+
+  // Starts compaction if the erased keys or the dead bytes of the label pool exceed
+  // compaction_ratio of the stored labels
+  void start_compaction_if_needed_() {
+    assert(!next_trie_);
+    if (setting_.compaction_ratio == 0.0) {
+      return;
+    }
+    if (num_erased() <= setting_.compaction_ratio * label_pool_->num_labels()
+        && label_pool_->dead_bytes() <= setting_.compaction_ratio * label_pool_->sum_bytes()) {
+      return;
+    }
+    // Nodes not leading to any live label are dropped in the rebuild
+    start_rebuild_(trie_->num_slots());
+    if (reclaimer_) {
+      advance_rebuild_(trie_->num_slots());
+    }
+  }
+
+  void start_rebuild_(uint64_t num_slots) {
+    assert(!next_trie_);
+
+    next_trie_ = make_trie_(num_slots);
+    next_label_pool_ = make_label_pool_(next_trie_->num_slots());
+    id_map_ = std::make_unique<FitVector<>>(trie_->num_slots(), num_bits(next_trie_->num_slots()));
+    id_map_->set(trie_->get_root(), next_trie_->get_root() + 1);
+    rebuild_pos_ = 0;
+  }
+
+  void advance_rebuild_(uint64_t num_steps) {
+    assert(next_trie_);
+
+    const auto num_slots = trie_->num_slots();
+    const auto end_pos = std::min(rebuild_pos_ + num_steps, num_slots);
+
+    for (; rebuild_pos_ < end_pos; ++rebuild_pos_) {
+      if (!trie_->is_used(rebuild_pos_)) {
+        continue;
+      }
+      if (id_map_->get(rebuild_pos_) == 0) {
+        // Step nodes and erased ones are migrated only when their descendants are.
+        uint64_t num_match = 0;
+        if (!label_pool_->compare_and_get(rebuild_pos_, CharRange(), num_match)) {
+          continue;
+        }
+      }
+      const auto new_id = migrate_node_(rebuild_pos_);
+      transfer_label_(rebuild_pos_, new_id);
+    }
+
+    if (rebuild_pos_ == num_slots) {
+      std::swap(trie_, next_trie_);
+      std::swap(label_pool_, next_label_pool_);
+      publish_view_();
+      retire_(std::move(next_trie_));
+      retire_(std::move(next_label_pool_));
+      id_map_.reset();
+      rebuild_pos_ = 0;
+      num_steps_ = next_num_steps_;
+      next_num_steps_ = 0;
+      ++num_rebuilds_;
+    }
+  }
+
+  // Inserts the node and its unmigrated ancestors into next_trie_, and returns the new id.
+  // The labels of inserted nodes behind rebuild_pos_ are also moved.
+  uint64_t migrate_node_(uint64_t node_id) {
+    auto new_id = id_map_->get(node_id);
+    path_.clear();
+
+    while (new_id == 0) {
+      uint64_t symbol = 0;
+      const auto parent_id = trie_->get_parent(node_id, symbol);
+      path_.emplace_back(node_id, symbol);
+      node_id = parent_id;
+      new_id = id_map_->get(node_id);
+    }
+    --new_id;
+
+    for (auto it = path_.rbegin(); it != path_.rend(); ++it) {
+      next_trie_->add_child(new_id, it->second, marks_of_(it->second));
+      if (it->second == kStepSymbol) {
+        ++next_num_steps_;
+      }
+      id_map_->set(it->first, new_id + 1);
+      if (it->first < rebuild_pos_) {
+        transfer_label_(it->first, new_id);
+      }
+    }
+
+    return new_id;
+  }
+
+  // A key ending inside the label of a node is stored as the child for '\0' at the position,
+  // whose parent is marked with kTerminalMark for common_prefix_search().
+  uint64_t marks_of_(uint64_t symbol) const {
+    if (symbol == kStepSymbol || (symbol & UINT8_MAX) != get_code_('\0')) {
+      return 0;
+    }
+    return kTerminalMark;
+  }
+
+  // Codes are read atomically since the writer assigns new ones during lookups of readers
+  uint8_t get_code_(uint8_t label) const {
+    return __atomic_load_n(&table_[label], __ATOMIC_RELAXED);
+  }
+
+  // In the concurrent mode, labels are copied since readers still refer to the old pool
+  void transfer_label_(uint64_t node_id, uint64_t new_id) {
+    if (reclaimer_) {
+      label_pool_->copy_to(node_id, *next_label_pool_, new_id);
+    } else {
+      label_pool_->move_to(node_id, *next_label_pool_, new_id);
+    }
+  }
+
+  // Returns the pointer to the value of node_id setting its label, or nullptr for a step node
+  ValueType* get_label_(uint64_t node_id, CharRange& label) const {
+    auto& label_pool = locate_label_(node_id);
+    return label_pool.get_label(node_id, label);
+  }
+
+  // Inverse of table_
+  std::array<uint8_t, 256> make_char_table_() const {
+    std::array<uint8_t, 256> chars;
+    chars.fill(0);
+    for (uint32_t c = 0; c < 256; ++c) {
+      const auto code = get_code_(static_cast<uint8_t>(c));
+      if (code != UINT8_MAX) {
+        chars[code] = static_cast<uint8_t>(c);
+      }
+    }
+    return chars;
+  }
+
+  // Sets prefix to the key of node_id without its label by following the parents up to the root.
+  // A child for the symbol <c, offset> of the k-th step node under a node branches at position
+  // k * fixed_len + offset of the node label with character c, where c = '\0' ends the key.
+  void restore_prefix_(uint64_t node_id, const std::array<uint8_t, 256>& chars,
+                       std::vector<std::pair<uint64_t, uint64_t>>& path, std::string& prefix) const {
+    path.clear();
+    const auto root_id = trie_->get_root();
+    while (node_id != root_id) {
+      uint64_t symbol = 0;
+      const auto parent_id = trie_->get_parent(node_id, symbol);
+      path.emplace_back(node_id, symbol);
+      node_id = parent_id;
+    }
+
+    prefix.clear();
+    uint64_t num_steps = 0;
+    for (auto it = path.rbegin(); it != path.rend(); ++it) {
+      if (it->second == kStepSymbol) {
+        ++num_steps;
+        continue;
+      }
+      CharRange label;
+      get_label_(node_id, label);
+      prefix.append(label.begin, label.begin + num_steps * fixed_len_() + (it->second >> 8));
+      const auto c = chars[it->second & UINT8_MAX];
+      if (c != '\0') {
+        prefix.push_back(static_cast<char>(c));
+      }
+      node_id = it->first;
+      num_steps = 0;
+    }
+  }
+
+  // Visits the keys under node_id in lexicographic order, where key is the prefix before the node
+  // label and only the children branching at pos or later are visited. At position p with label
+  // character l, the children with characters less than l precede the keys continuing with l,
+  // and the ones with characters greater than l follow them. Returns false if stopped.
+  template<typename Callback>
+  bool visit_(uint64_t node_id, uint64_t pos, const std::vector<uint8_t>& alphabet,
+              std::string& key, Callback& callback) const {
+    CharRange label;
+    const ValueType* value_ptr = get_label_(node_id, label);
+    const auto length = label.length();
+
+    // Children branching at p are under the (p / fixed_len)-th step node
+    std::vector<uint64_t> steps{node_id};
+    while (steps.size() * fixed_len_() <= length) {
+      auto step_id = steps.back();
+      if (!trie_->has_children(step_id) || !trie_->get_child(step_id, kStepSymbol)) {
+        break;
+      }
+      steps.push_back(step_id);
+    }
+    const auto end_pos = std::min(length + 1, steps.size() * fixed_len_());
+
+    const auto prefix_len = key.size();
+    auto visit_children = [&](uint64_t p, bool less) {
+      const auto parent_id = steps[p / fixed_len_()];
+      if (!trie_->has_children(parent_id)) {
+        return true;
+      }
+      const uint8_t l = p < length ? label.begin[p] : '\0';
+      for (auto c : alphabet) {
+        if (less && l <= c) {
+          break;
+        }
+        if (!less && c <= l) {
+          continue;
+        }
+        auto child_id = parent_id;
+        if (!trie_->get_child(child_id, make_symbol_(c, p % fixed_len_()))) {
+          continue;
+        }
+        key.append(label.begin, label.begin + p);
+        if (c != '\0') {
+          key.push_back(static_cast<char>(c));
+        }
+        const bool ret = visit_(child_id, 0, alphabet, key, callback);
+        key.resize(prefix_len);
+        if (!ret) {
+          return false;
+        }
+      }
+      return true;
+    };
+
+    for (auto p = pos; p < end_pos; ++p) {
+      if (!visit_children(p, true)) {
+        return false;
+      }
+    }
+
+    if (!is_erased_(node_id)) {
+      key.append(label.begin, label.end);
+      const bool ret = callback(key, *value_ptr);
+      key.resize(prefix_len);
+      if (!ret) {
+        return false;
+      }
+    }
+
+    for (auto p = end_pos; pos < p; --p) {
+      if (!visit_children(p - 1, false)) {
+        return false;
+      }
+    }
+    return true;
   }
 
   uint64_t make_symbol_(uint8_t label, uint64_t offset) const {
-    const auto symbol = static_cast<uint64_t>(table_[label]) | (offset << 8);
+    const auto symbol = static_cast<uint64_t>(get_code_(label)) | (offset << 8);
     assert(symbol != kStepSymbol);
     return symbol;
   }
 };
 
+// DynPDT whose fixed_len and width_1st are template constants, e.g., FixedDynPDT<Pool, 16, 6>
+template<typename LabelPoolType, uint64_t FixedLen, uint8_t Width1st,
+         typename HashType = Hash_Prime>
+using FixedDynPDT = DynPDT<LabelPoolType, HashType, NoStats, FixedLen, Width1st>;
+
 } // namespace - dynpdt
 
 #endif // DYNPDT_DYNPDT_HPP
@@ -0,0 +1,151 @@
+#ifndef DYNPDT_EPOCH_RECLAIMER_HPP
+#define DYNPDT_EPOCH_RECLAIMER_HPP
+
+#include <atomic>
+#include <functional>
+#include <thread>
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+/*
+ * Epoch-based reclamation for a single writer and many readers.
+ *
+ * A reader pins the current epoch while it refers to shared data, and the writer retires
+ * replaced data instead of deleting it. Retired data is deleted once no reader pinned at or
+ * before its retirement remains. Readers take no locks; pinning is a CAS on a slot that is
+ * usually taken by the same thread every time.
+ * */
+class EpochReclaimer {
+public:
+  static constexpr uint64_t kNumSlots = 128; // readers pinning at the same time
+  static constexpr uint64_t kReclaimInterval = 64; // retirements between reclaim()
+
+  class Guard {
+  public:
+    Guard(const EpochReclaimer* reclaimer, uint64_t slot_id)
+      : reclaimer_(reclaimer), slot_id_(slot_id) {}
+
+    Guard(Guard&& rhs) noexcept : reclaimer_(rhs.reclaimer_), slot_id_(rhs.slot_id_) {
+      rhs.reclaimer_ = nullptr;
+    }
+
+    ~Guard() {
+      if (reclaimer_) {
+        reclaimer_->unpin_(slot_id_);
+      }
+    }
+
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    Guard& operator=(Guard&&) = delete;
+
+  private:
+    const EpochReclaimer* reclaimer_;
+    uint64_t slot_id_;
+  };
+
+  EpochReclaimer() {
+    for (auto& slot : slots_) {
+      slot.epoch.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // No reader may be pinning then
+  ~EpochReclaimer() {
+    for (auto& item : retired_) {
+      item.deleter();
+    }
+  }
+
+  // Called by readers. Data reached while the guard lives is not deleted.
+  Guard pin() const {
+    static thread_local uint64_t hint = std::hash<std::thread::id>()(std::this_thread::get_id());
+
+    for (uint64_t i = hint;; ++i) {
+      auto& slot = slots_[i % kNumSlots];
+      uint64_t expected = 0;
+      if (slot.epoch.load(std::memory_order_relaxed) == 0
+          && slot.epoch.compare_exchange_strong(expected, epoch_.load())) {
+        hint = i;
+        return Guard(this, i % kNumSlots);
+      }
+    }
+  }
+
+  // Called by the writer after unlinking data from readers
+  template<typename T>
+  void retire(std::unique_ptr<T> data) {
+    static_assert(!std::is_array<T>::value, "use retire(CharArray)");
+    auto ptr = data.release();
+    retire_([ptr]() { delete ptr; });
+  }
+
+  void retire(CharArray array) {
+    auto ptr = array.release();
+    retire_([ptr]() { delete[] ptr; });
+  }
+
+  // Deletes the retired data no reader can refer to
+  void reclaim() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    epoch_.fetch_add(1);
+
+    uint64_t min_epoch = UINT64_MAX;
+    for (const auto& slot : slots_) {
+      const auto epoch = slot.epoch.load();
+      if (epoch != 0) {
+        min_epoch = std::min(min_epoch, epoch);
+      }
+    }
+
+    auto it = std::partition(retired_.begin(), retired_.end(), [&](const Retired& item) {
+      return min_epoch <= item.epoch;
+    });
+    for (auto it2 = it; it2 != retired_.end(); ++it2) {
+      it2->deleter();
+    }
+    retired_.erase(it, retired_.end());
+
+    next_reclaim_ = std::max<uint64_t>(+kReclaimInterval, retired_.size() * 2);
+  }
+
+  uint64_t num_retired() const {
+    return retired_.size();
+  }
+
+  EpochReclaimer(const EpochReclaimer&) = delete;
+  EpochReclaimer& operator=(const EpochReclaimer&) = delete;
+
+private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch; // 0 means free
+  };
+
+  struct Retired {
+    uint64_t epoch;
+    std::function<void()> deleter;
+  };
+
+  mutable std::array<Slot, kNumSlots> slots_;
+  std::atomic<uint64_t> epoch_{1};
+  std::vector<Retired> retired_;
+  uint64_t next_reclaim_ = kReclaimInterval;
+
+  void retire_(std::function<void()> deleter) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    retired_.push_back({epoch_.load(), std::move(deleter)});
+    if (next_reclaim_ <= retired_.size()) {
+      reclaim();
+    }
+  }
+
+  void unpin_(uint64_t slot_id) const {
+    slots_[slot_id].epoch.store(0, std::memory_order_release);
+  }
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_EPOCH_RECLAIMER_HPP
@@ -5,78 +5,315 @@
 
 namespace dynpdt {
 
+/*
+ * Array of values in width bits. With FixedWidth, the width is a compile-time constant so that
+ * the positions and the masks are folded; otherwise it is given at construction.
+ *
+ * In the blocked layout, values are packed into 64-byte lines aligned to cache lines, leaving
+ * the remainder bits of each line unused, so that no value straddles lines.
+ * */
+template <uint8_t FixedWidth = 0>
 class FitVector {
 public:
   static constexpr uint64_t kChunkWidth = 64;
+  static constexpr uint64_t kLineWidth = 512;
+  static constexpr uint64_t kChunksPerLine = kLineWidth / kChunkWidth;
 
-  FitVector(uint64_t length, uint8_t width) {
+  static_assert(FixedWidth <= 64, "FixedWidth must be at most 64");
+
+  /*
+   * Reads consecutive values from a position without recomputing the chunk position.
+   * It is invalidated by load() or map() of the vector.
+   * */
+  class Scanner {
+  public:
+    Scanner(const FitVector& vec, uint64_t i) : vec_(&vec) {
+      const auto bit_pos = vec.bit_pos_(i);
+      chunk_pos_ = bit_pos / kChunkWidth;
+      offset_ = bit_pos % kChunkWidth;
+      line_rest_ = vec.line_size_ ? vec.line_size_ - (i - vec.line_id_(i) * vec.line_size_) : 0;
+    }
+
+    template <int Order = __ATOMIC_RELAXED>
+    uint64_t get() const {
+      return vec_->template get_<Order>(chunk_pos_, offset_);
+    }
+
+    // Moves to the next value
+    void next() {
+      if (line_rest_ != 0 && --line_rest_ == 0) {
+        chunk_pos_ = (chunk_pos_ / kChunksPerLine + 1) * kChunksPerLine;
+        offset_ = 0;
+        line_rest_ = vec_->line_size_;
+        return;
+      }
+      offset_ += vec_->width();
+      if (kChunkWidth <= offset_) {
+        offset_ -= kChunkWidth;
+        ++chunk_pos_;
+      }
+    }
+
+  private:
+    const FitVector* vec_;
+    uint64_t chunk_pos_;
+    uint64_t offset_;
+    uint64_t line_rest_; // values left in the line including the current one (0 if not blocked)
+  };
+
+  FitVector() {}
+
+  // With blocked, the blocked layout is used unless length exceeds 32 bits.
+  FitVector(uint64_t length, uint8_t width, bool blocked = false) {
     if (width == 0 || 64 < width) {
       std::cerr << "ERROR: not 0 < width <= 64" << std::endl;
       exit(1);
     }
+    if (FixedWidth != 0 && width != FixedWidth) {
+      std::cerr << "ERROR: width differs from FixedWidth" << std::endl;
+      exit(1);
+    }
 
     length_ = length;
     width_ = width;
-    mask_ = (1U << width) - 1;
-    chunks_.resize(length_ * width_ / kChunkWidth + 1);
+    mask_ = make_mask_(width);
+    if (blocked && length < (1ULL << 32)) {
+      set_line_size_(kLineWidth / width);
+    }
+    allocate_(num_chunks_());
   }
 
-  FitVector(uint64_t length, uint8_t width, uint64_t init) : FitVector(length, width) {
-    for (uint64_t i = 0; i < length; ++i) {
-      set(i, init);
-    }
+  FitVector(uint64_t length, uint8_t width, uint64_t init, bool blocked = false)
+    : FitVector(length, width, blocked) {
+    fill(init);
   }
 
   ~FitVector() {}
 
+  // Order is the memory order of the chunk accesses, e.g., __ATOMIC_ACQUIRE for a reader that
+  // must see what the writer stored before set<__ATOMIC_RELEASE>() of the value.
+  template <int Order = __ATOMIC_RELAXED>
   uint64_t get(uint64_t i) const {
-    const auto chunk_pos = i * width_ / kChunkWidth;
-    const auto offset = i * width_ % kChunkWidth;
-    if (offset + width_ <= kChunkWidth) {
-      return (chunks_[chunk_pos] >> offset) & mask_;
-    } else {
-      return ((chunks_[chunk_pos] >> offset)
-              | (chunks_[chunk_pos + 1] << (kChunkWidth - offset))) & mask_;
-    }
+    const auto bit_pos = bit_pos_(i);
+    return get_<Order>(bit_pos / kChunkWidth, bit_pos % kChunkWidth);
   }
 
+  template <int Order = __ATOMIC_RELAXED>
   void set(uint64_t i, uint64_t val) {
-    const auto chunk_pos = i * width_ / kChunkWidth;
-    const auto offset = i * width_ % kChunkWidth;
-    chunks_[chunk_pos] &= ~(mask_ << offset);
-    chunks_[chunk_pos] |= (val & mask_) << offset;
-    if (kChunkWidth < offset + width_) {
-      chunks_[chunk_pos + 1] &= ~(mask_ >> (kChunkWidth - offset));
-      chunks_[chunk_pos + 1] |= (val & mask_) >> (kChunkWidth - offset);
+    const auto bit_pos = bit_pos_(i);
+    const auto chunk_pos = bit_pos / kChunkWidth;
+    const auto offset = bit_pos % kChunkWidth;
+    const auto mask = this->mask();
+    store_chunk_<Order>(chunk_pos,
+                        (words_[chunk_pos] & ~(mask << offset)) | ((val & mask) << offset));
+    if (kChunkWidth < offset + width()) {
+      store_chunk_<Order>(chunk_pos + 1,
+                          (words_[chunk_pos + 1] & ~(mask >> (kChunkWidth - offset)))
+                          | ((val & mask) >> (kChunkWidth - offset)));
+    }
+  }
+
+  // Sets all the values to val, writing the repeated bit pattern a chunk at a time
+  void fill(uint64_t val) {
+    val &= mask();
+
+    // The pattern repeats every line, or every lcm(width, 64) bits that a value never straddles
+    uint64_t period = kChunksPerLine, num_values = line_size_;
+    if (line_size_ == 0) {
+      uint64_t gcd = width(), rem = kChunkWidth;
+      while (rem != 0) {
+        std::swap(gcd, rem);
+        rem %= gcd;
+      }
+      period = width() / gcd;
+      num_values = period * kChunkWidth / width();
+    }
+
+    std::vector<uint64_t> pattern(period, 0);
+    for (uint64_t i = 0; i < num_values; ++i) {
+      const auto chunk_pos = i * width() / kChunkWidth;
+      const auto offset = i * width() % kChunkWidth;
+      pattern[chunk_pos] |= val << offset;
+      if (kChunkWidth < offset + width()) {
+        pattern[chunk_pos + 1] |= val >> (kChunkWidth - offset);
+      }
+    }
+
+    const auto num_chunks = num_chunks_();
+    for (uint64_t i = 0; i < num_chunks; ++i) {
+      store_chunk_(i, pattern[i % period]);
+    }
+
+    // The bits after the last value stay zero
+    const auto end = length_ ? bit_pos_(length_ - 1) + width() : 0;
+    store_chunk_(end / kChunkWidth, words_[end / kChunkWidth] & ((1ULL << (end % kChunkWidth)) - 1));
+    for (uint64_t i = end / kChunkWidth + 1; i < num_chunks; ++i) {
+      store_chunk_(i, 0);
     }
   }
 
+  Scanner scan(uint64_t i) const {
+    return Scanner(*this, i);
+  }
+
+  // Prefetches the chunk holding the i-th value
+  void prefetch(uint64_t i) const {
+    __builtin_prefetch(data_ + bit_pos_(i) / kChunkWidth);
+  }
+
   uint64_t length() const {
     return length_;
   }
 
   uint8_t width() const {
-    return width_;
+    return FixedWidth != 0 ? FixedWidth : width_;
+  }
+
+  uint64_t mask() const {
+    return FixedWidth != 0 ? make_mask_(FixedWidth) : mask_;
+  }
+
+  bool is_blocked() const {
+    return line_size_ != 0;
   }
 
   // returns output size
   uint64_t size_in_bytes() const {
     uint64_t ret = 0;
-    ret += chunks_.size() * sizeof(uint64_t) + sizeof(chunks_.size());
+    ret += num_chunks_() * sizeof(uint64_t) + sizeof(uint64_t);
     ret += sizeof(length_);
     ret += sizeof(width_);
     ret += sizeof(mask_);
+    ret += sizeof(line_size_);
     return ret;
   }
 
+  void save(std::ostream& os) const {
+    save_value(os, length_);
+    save_value(os, width_);
+    save_value(os, line_size_);
+    save_array(os, data_, num_chunks_());
+  }
+
+  void load(std::istream& is) {
+    load_value(is, length_);
+    load_value(is, width_);
+    load_value(is, line_size_);
+    check_width_();
+    mask_ = make_mask_(width_);
+    set_line_size_(line_size_);
+
+    std::vector<uint64_t> chunks;
+    load_array(is, chunks);
+    check_layout_(chunks.size());
+    allocate_(chunks.size());
+    std::memcpy(words_, chunks.data(), chunks.size() * sizeof(uint64_t));
+  }
+
+  // Refers to the chunks written by save() without copying; set() is no longer allowed.
+  // The lines are not aligned to cache lines then.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, length_);
+    map_value(ptr, end, width_);
+    map_value(ptr, end, line_size_);
+    uint64_t num_chunks = 0;
+    data_ = map_array<uint64_t>(ptr, end, num_chunks);
+    chunks_.clear();
+    words_ = nullptr;
+    check_width_();
+    mask_ = make_mask_(width_);
+    set_line_size_(line_size_);
+    check_layout_(num_chunks);
+  }
+
   FitVector(const FitVector&) = delete;
   FitVector& operator=(const FitVector&) = delete;
 
 private:
   std::vector<uint64_t> chunks_;
+  uint64_t* words_ = nullptr; // chunks_ aligned to a cache line
+  const uint64_t* data_ = nullptr; // words_ or a mapped region
   uint64_t length_ = 0;
   uint8_t width_ = 0;
   uint64_t mask_ = 0;
+  uint64_t line_size_ = 0; // values per line in the blocked layout, or 0
+  uint64_t line_magic_ = 0; // for dividing by line_size_
+
+  void set_line_size_(uint64_t line_size) {
+    line_size_ = line_size;
+    line_magic_ = line_size ? UINT64_MAX / line_size + 1 : 0;
+  }
+
+  // Division by multiplication, exact for i < 2^32
+  uint64_t line_id_(uint64_t i) const {
+    return static_cast<uint64_t>((static_cast<__uint128_t>(i) * line_magic_) >> 64);
+  }
+
+  // of the i-th value
+  uint64_t bit_pos_(uint64_t i) const {
+    if (line_size_ == 0) {
+      return i * width();
+    }
+    const auto line_id = line_id_(i);
+    return line_id * kLineWidth + (i - line_id * line_size_) * width();
+  }
+
+  void allocate_(uint64_t num_chunks) {
+    chunks_.assign(num_chunks + kChunksPerLine - 1, 0);
+    const auto addr = reinterpret_cast<uintptr_t>(chunks_.data());
+    words_ = chunks_.data() + (kLineWidth / 8 - addr % (kLineWidth / 8)) % (kLineWidth / 8) / 8;
+    data_ = words_;
+  }
+
+  static constexpr uint64_t make_mask_(uint8_t width) {
+    return (width == 64) ? UINT64_MAX : (1ULL << width) - 1;
+  }
+
+  uint64_t num_chunks_() const {
+    if (line_size_ != 0) {
+      return (length_ + line_size_ - 1) / line_size_ * kChunksPerLine + 1;
+    }
+    return length_ * width() / kChunkWidth + 1;
+  }
+
+  void check_width_() const {
+    check_consistent(0 < width_ && width_ <= 64);
+    if (FixedWidth != 0 && width_ != FixedWidth) {
+      std::cerr << "ERROR: width differs from FixedWidth" << std::endl;
+      exit(1);
+    }
+  }
+
+  // Checks the fields given by load() or map() against num_chunks read with them, so that get()
+  // never reads past the chunks
+  void check_layout_(uint64_t num_chunks) const {
+    check_consistent(length_ <= UINT64_MAX / kChunkWidth);
+    if (line_size_ != 0) {
+      check_consistent(line_size_ == kLineWidth / width_ && length_ < (1ULL << 32));
+    }
+    check_consistent(num_chunks == num_chunks_());
+  }
+
+  template <int Order = __ATOMIC_RELAXED>
+  uint64_t get_(uint64_t chunk_pos, uint64_t offset) const {
+    if (offset + width() <= kChunkWidth) {
+      return (load_chunk_<Order>(chunk_pos) >> offset) & mask();
+    } else {
+      return ((load_chunk_<Order>(chunk_pos) >> offset)
+              | (load_chunk_<Order>(chunk_pos + 1) << (kChunkWidth - offset))) & mask();
+    }
+  }
+
+  // Chunks are accessed atomically so that a reader on another thread never sees a torn chunk.
+  // A value is still torn if it straddles two chunks, which a width dividing 64 avoids.
+  template <int Order = __ATOMIC_RELAXED>
+  uint64_t load_chunk_(uint64_t chunk_pos) const {
+    return __atomic_load_n(data_ + chunk_pos, Order);
+  }
+  template <int Order = __ATOMIC_RELAXED>
+  void store_chunk_(uint64_t chunk_pos, uint64_t chunk) {
+    __atomic_store_n(words_ + chunk_pos, chunk, Order);
+  }
 };
 
 } // namespace - dynpdt
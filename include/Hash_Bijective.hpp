@@ -0,0 +1,139 @@
+#ifndef DYNPDT_HASH_BIJECTIVE_HPP
+#define DYNPDT_HASH_BIJECTIVE_HPP
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+// Inverse of an odd number modulo 2^64 by Newton's method
+constexpr uint64_t inverse_odd(uint64_t x) {
+  uint64_t y = x;
+  for (int i = 0; i < 6; ++i) {
+    y *= 2 - x * y;
+  }
+  return y;
+}
+
+/*
+ * Division-free invertible hashing for a power-of-two number of slots.
+ *
+ * The pair is packed into c = symbol * num_slots + node_id in the domain [0, alphabet_size * num_slots)
+ * and permuted within the domain by cycle-walking a xorshift-multiply bijection over [0, 2^k), where
+ * 2^k is the smallest power of two not less than the domain size. Because alphabet_size is close to
+ * a power of two in DynPDT, the walk almost always finishes in one round. The remainder and
+ * the quotient are obtained by masking and shifting, so 0 <= quo < alphabet_size.
+ * */
+class Hash_Bijective {
+public:
+  static constexpr uint64_t kMultiplier1 = 0xff51afd7ed558ccdULL;
+  static constexpr uint64_t kMultiplier2 = 0xc4ceb9fe1a85ec53ULL;
+  static constexpr uint64_t kInverse1 = inverse_odd(kMultiplier1);
+  static constexpr uint64_t kInverse2 = inverse_odd(kMultiplier2);
+
+  static std::string name() {
+    return "Hash_Bijective";
+  }
+
+  static uint64_t adjust_num_slots(uint64_t num_slots) {
+    uint64_t ret = 1;
+    while (ret < num_slots) {
+      ret <<= 1;
+    }
+    return ret;
+  }
+
+  Hash_Bijective() {}
+
+  Hash_Bijective(uint64_t num_slots, uint64_t alphabet_size) {
+    if (!is_power2(num_slots)) {
+      std::cerr << "ERROR: num_slots must be a power of 2." << std::endl;
+      exit(1);
+    }
+
+    slot_bits_ = num_bits(num_slots - 1);
+    if (num_slots == 1) {
+      slot_bits_ = 0;
+    }
+    slot_mask_ = num_slots - 1;
+    domain_ = alphabet_size << slot_bits_;
+
+    const auto univ_bits = num_bits(domain_ - 1);
+    univ_mask_ = (univ_bits == 64) ? UINT64_MAX : (1ULL << univ_bits) - 1;
+    shift_ = (univ_bits + 1) / 2;
+  }
+
+  HashValue hash(uint64_t node_id, uint64_t symbol) const {
+    uint64_t c = (symbol << slot_bits_) | node_id;
+    do {
+      c = permute_(c);
+    } while (domain_ <= c);
+    return {c & slot_mask_, c >> slot_bits_};
+  }
+
+  // Returns node_id such that hash(node_id, symbol) = hv
+  uint64_t unhash(HashValue hv, uint64_t& symbol) const {
+    uint64_t c = (hv.quo << slot_bits_) | hv.rem;
+    do {
+      c = unpermute_(c);
+    } while (domain_ <= c);
+    symbol = c >> slot_bits_;
+    return c & slot_mask_;
+  }
+
+  uint64_t num_slots() const {
+    return slot_mask_ + 1;
+  }
+
+  void save(std::ostream& os) const {
+    save_value(os, slot_bits_);
+    save_value(os, slot_mask_);
+    save_value(os, domain_);
+    save_value(os, univ_mask_);
+    save_value(os, shift_);
+  }
+
+  void load(std::istream& is) {
+    load_value(is, slot_bits_);
+    load_value(is, slot_mask_);
+    load_value(is, domain_);
+    load_value(is, univ_mask_);
+    load_value(is, shift_);
+  }
+
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, slot_bits_);
+    map_value(ptr, end, slot_mask_);
+    map_value(ptr, end, domain_);
+    map_value(ptr, end, univ_mask_);
+    map_value(ptr, end, shift_);
+  }
+
+private:
+  uint64_t slot_bits_ = 0;
+  uint64_t slot_mask_ = 0;
+  uint64_t domain_ = 0;
+  uint64_t univ_mask_ = 0;
+  uint64_t shift_ = 0; // at least half of the universe bits, so xorshift is inverted in one step
+
+  uint64_t permute_(uint64_t x) const {
+    x ^= x >> shift_;
+    x = (x * kMultiplier1) & univ_mask_;
+    x ^= x >> shift_;
+    x = (x * kMultiplier2) & univ_mask_;
+    x ^= x >> shift_;
+    return x;
+  }
+
+  uint64_t unpermute_(uint64_t x) const {
+    x ^= x >> shift_;
+    x = (x * kInverse2) & univ_mask_;
+    x ^= x >> shift_;
+    x = (x * kInverse1) & univ_mask_;
+    x ^= x >> shift_;
+    return x;
+  }
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_HASH_BIJECTIVE_HPP
@@ -0,0 +1,82 @@
+#ifndef DYNPDT_HASH_PRIME_HPP
+#define DYNPDT_HASH_PRIME_HPP
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+/*
+ * Invertible hashing with modular multiplication over a prime greater than the domain,
+ * used in the original m-Bonsai. It needs three 64-bit divisions for each hash value.
+ * */
+class Hash_Prime {
+public:
+  static std::string name() {
+    return "Hash_Prime";
+  }
+
+  static uint64_t adjust_num_slots(uint64_t num_slots) {
+    return num_slots;
+  }
+
+  Hash_Prime() {}
+
+  Hash_Prime(uint64_t num_slots, uint64_t alphabet_size) {
+    num_slots_ = num_slots;
+    prime_ = greater_prime(alphabet_size * num_slots + num_slots - 1);
+    multiplier_ = UINT64_MAX / prime_;
+    if (multiplier_ % prime_ == 0) {
+      --multiplier_; // to be invertible
+    }
+    inv_multiplier_ = mod_inverse(multiplier_, prime_);
+  }
+
+  // Expecting 0 <= quo <= alphabet_size + 1
+  HashValue hash(uint64_t node_id, uint64_t symbol) const {
+    uint64_t c = symbol * num_slots_ + node_id;
+    uint64_t c_rnd = ((c % prime_) * multiplier_) % prime_;
+    return {c_rnd % num_slots_, c_rnd / num_slots_};
+  }
+
+  // Returns node_id such that hash(node_id, symbol) = hv
+  uint64_t unhash(HashValue hv, uint64_t& symbol) const {
+    const auto c = mul_mod(hv.quo * num_slots_ + hv.rem, inv_multiplier_, prime_);
+    symbol = c / num_slots_;
+    return c % num_slots_;
+  }
+
+  uint64_t num_slots() const {
+    return num_slots_;
+  }
+
+  void save(std::ostream& os) const {
+    save_value(os, num_slots_);
+    save_value(os, prime_);
+    save_value(os, multiplier_);
+    save_value(os, inv_multiplier_);
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_slots_);
+    load_value(is, prime_);
+    load_value(is, multiplier_);
+    load_value(is, inv_multiplier_);
+  }
+
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_slots_);
+    map_value(ptr, end, prime_);
+    map_value(ptr, end, multiplier_);
+    map_value(ptr, end, inv_multiplier_);
+  }
+
+private:
+  uint64_t num_slots_ = 0;
+  uint64_t prime_ = 0;
+  uint64_t multiplier_ = 0;
+  uint64_t inv_multiplier_ = 0;
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_HASH_PRIME_HPP
@@ -0,0 +1,561 @@
+#ifndef DYNPDT_LABEL_POOL_ARENA_HPP
+#define DYNPDT_LABEL_POOL_ARENA_HPP
+
+#include "basics.hpp"
+#include "EpochReclaimer.hpp"
+#include "simd_tools.hpp"
+#include "vbyte.hpp"
+
+namespace dynpdt {
+
+/*
+ * Labels are bump-allocated from large chunks and referred to by 32-bit offsets, instead of
+ * a heap allocation and a pointer per label as in LabelPool_Plain.
+ *
+ * A record is the value followed by the label with the terminator, padded to kUnitSize bytes.
+ * Offsets are in units of kUnitSize, so a pool holds up to 32 GiB of records, and values are
+ * aligned. With VarBytes, the value follows the label instead, and set_value() rewrites it in
+ * place if it fits in the record or writes the record again at the tail otherwise. The k-th
+ * chunk has kFirstChunkSize << k bytes, so chunks are never reallocated and the number of them
+ * is bounded.
+ *
+ * compare_and_get() is safe on other threads while a single writer calls append(), erase(),
+ * restore() and set_value(), since records are written with their values before their offsets
+ * are published. With the reclaimer set, restore() and set_value() always write the record again
+ * so that readers never see a torn value.
+ * Space of moved labels and values is not reused but released with the pool, e.g., after a
+ * rebuild.
+ * */
+template <typename _ValueType>
+class LabelPool_Arena {
+public:
+  using ValueType = _ValueType;
+
+  static constexpr uint64_t kUnitSize = 8;
+  static constexpr uint64_t kFirstChunkSize = 1ULL << 16;
+  // The chunks total (kFirstChunkSize << kMaxChunks) - kFirstChunkSize < 32 GiB bytes, which
+  // 32-bit offsets in units can address
+  static constexpr uint64_t kMaxChunks = 19;
+  static_assert(((kFirstChunkSize << kMaxChunks) - kFirstChunkSize) / kUnitSize < UINT32_MAX,
+                "offsets must fit in 32 bits");
+
+  static_assert(alignof(ValueType) <= kUnitSize, "ValueType must be aligned within kUnitSize");
+
+  static constexpr bool kVarValue = std::is_same<ValueType, VarBytes>::value;
+
+  static std::string name() {
+    return "LabelPool_Arena";
+  }
+
+  LabelPool_Arena() {}
+
+  LabelPool_Arena(uint64_t size) {
+    offsets_.resize(size, 0);
+    erased_.resize((size + 63) / 64, 0);
+  }
+
+  ~LabelPool_Arena() {}
+
+  ValueType* compare_and_get(uint64_t id, CharRange label) {
+    uint64_t dummy;
+    return compare_and_get(id, label, dummy);
+  }
+
+  ValueType* compare_and_get(uint64_t id, CharRange label, uint64_t& num_match) {
+    num_match = 0;
+
+    auto record = get_record_(id);
+    if (!record) {
+      return nullptr;
+    }
+    const auto ptr = label_of_(record);
+
+    if (label.begin == label.end) {
+      return is_erased(id) ? nullptr : get_value_(record);
+    }
+
+    // The stored label is not read beyond its terminator
+    const auto length = label.length();
+    const auto bound = std::min(length, bounded_length_(ptr, length));
+    num_match = simd_tools::mismatch(label.begin, ptr, bound);
+    if (num_match != length) {
+      return nullptr;
+    }
+
+    // An erased label is reported as nullptr with the full num_match
+    return is_erased(id) ? nullptr : reinterpret_cast<ValueType*>(value_of_(record, length));
+  }
+
+  // The value is written before the label is published
+  ValueType* append(uint64_t id, CharRange label, const ValueType& value = ValueType()) {
+    const auto value_ptr = reinterpret_cast<const uint8_t*>(&value);
+    // An empty label is also stored with the terminator
+    if (label.begin == label.end) {
+      const uint8_t terminator = '\0';
+      return append_(id, &terminator, 1, value_ptr, value_size_(value_ptr));
+    }
+    return append_(id, label.begin, label.length(), value_ptr, value_size_(value_ptr));
+  }
+
+  // Appends the labels to their ids, which are given in increasing order
+  void append_sorted(const std::vector<LabelItem<ValueType>>& items) {
+    for (const auto& item : items) {
+      append(item.id, item.label, item.value);
+    }
+  }
+
+  // Sets the value of id to the bytes, returning the pointer to it, only with VarBytes
+  VarBytes* set_value(uint64_t id, const uint8_t* data, uint64_t size) {
+    static_assert(kVarValue, "set_value() needs VarBytes");
+
+    auto record = get_record_(id);
+    assert(record && !is_erased(id));
+    const auto length = label_length_(record);
+    const auto value_size = vbyte::size(size) + size;
+    const auto old_size = record_bytes_(record);
+    const auto new_size = record_size_(length, value_size);
+    sum_bytes_ = sum_bytes_ - old_size + new_size;
+
+    if (new_size <= old_size && !concurrent_) {
+      auto value = value_of_(record, length);
+      std::memcpy(value + vbyte::encode(value, size), data, size);
+      return reinterpret_cast<VarBytes*>(value);
+    }
+
+    uint64_t pos = 0;
+    auto new_record = allocate_record_(new_size, pos);
+    std::memcpy(new_record, record, length);
+    auto value = value_of_(new_record, length);
+    std::memcpy(value + vbyte::encode(value, size), data, size);
+    publish_record_(id, pos);
+    return reinterpret_cast<VarBytes*>(value);
+  }
+
+  // Marks the label of id as erased. The label itself is kept because it can be
+  // still referred by the descendants; it is released when the node is moved away.
+  void erase(uint64_t id) {
+    assert(get_record_(id) && !is_erased(id));
+    set_erased_(id, true);
+    ++num_erased_;
+  }
+
+  // Unmarks the erased label of id and returns its value set to value, which is a fixed-size one
+  // or an empty VarBytes
+  ValueType* restore(uint64_t id, const ValueType& value = ValueType()) {
+    assert(get_record_(id) && is_erased(id));
+    auto ret = write_value_(id, value);
+    set_erased_(id, false);
+    --num_erased_;
+    return ret;
+  }
+
+  // Sets the value of id as restore() does, returning the pointer to it
+  ValueType* set_value(uint64_t id, const ValueType& value) {
+    assert(get_record_(id) && !is_erased(id));
+    return write_value_(id, value);
+  }
+
+  // Sets label to the label of id without the terminator, and returns the pointer to its value,
+  // or nullptr if id has no label. An erased label is also returned.
+  ValueType* get_label(uint64_t id, CharRange& label) const {
+    auto record = get_record_(id);
+    if (!record) {
+      return nullptr;
+    }
+    label.begin = label_of_(record);
+    label.end = label.begin + label_length_(label.begin) - 1;
+    return get_value_(record);
+  }
+
+  bool is_erased(uint64_t id) const {
+    const auto word = mapped_offsets_ ? mapped_erased_[id / 64]
+                                      : __atomic_load_n(&erased_[id / 64], __ATOMIC_RELAXED);
+    return (word >> (id % 64)) & 1ULL;
+  }
+
+  // Labels are reached directly, without walking over others
+  uint64_t skip_length(uint64_t) const {
+    return 0;
+  }
+
+  // Prefetches for compare_and_get() in two stages since the label is reached through
+  // the offset; prefetch_label() touches the offset, so it should follow prefetch_ptr().
+  void prefetch_ptr(uint64_t id) const {
+    __builtin_prefetch((mapped_offsets_ ? mapped_offsets_ : offsets_.data()) + id);
+  }
+  void prefetch_label(uint64_t id) const {
+    __builtin_prefetch(get_record_(id));
+  }
+
+  // Moves the label of id to dst_id of dst, returning false if id has no label
+  bool move_to(uint64_t id, LabelPool_Arena& dst, uint64_t dst_id) {
+    if (!copy_to(id, dst, dst_id)) {
+      return false;
+    }
+
+    sum_bytes_ -= record_bytes_(get_record_(id));
+    --num_labels_;
+    if (is_erased(id)) {
+      set_erased_(id, false);
+      --num_erased_;
+    }
+    __atomic_store_n(&offsets_[id], 0U, __ATOMIC_RELEASE);
+    return true;
+  }
+
+  // Copies the label of id to dst_id of dst, returning false if id has no label
+  bool copy_to(uint64_t id, LabelPool_Arena& dst, uint64_t dst_id) const {
+    auto record = get_record_(id);
+    if (!record) {
+      return false;
+    }
+
+    const auto ptr = label_of_(record);
+    const auto value = reinterpret_cast<const uint8_t*>(get_value_(record));
+    dst.append_(dst_id, ptr, label_length_(ptr), value, value_size_(value));
+
+    if (is_erased(id)) {
+      dst.set_erased_(dst_id, true);
+      ++dst.num_erased_;
+    }
+    return true;
+  }
+
+  // No record is moved under readers in this pool, but values are not rewritten in place
+  void set_reclaimer(EpochReclaimer* reclaimer) {
+    concurrent_ = reclaimer != nullptr;
+  }
+
+  uint64_t num_ptrs() const {
+    return mapped_offsets_ ? num_mapped_ptrs_ : offsets_.size();
+  }
+
+  uint64_t num_labels() const {
+    return num_labels_;
+  }
+
+  uint64_t num_erased() const {
+    return num_erased_;
+  }
+
+  // of the records including the values and the padding
+  uint64_t sum_bytes() const {
+    return sum_bytes_;
+  }
+
+  // of the records left behind by set_value() and move_to(), which only a rebuild releases
+  uint64_t dead_bytes() const {
+    assert(mapped_offsets_ || sum_bytes_ <= tail_);
+    return mapped_offsets_ ? 0 : tail_ - sum_bytes_;
+  }
+
+  // of the chunks, including the space of moved labels and the unused tail
+  uint64_t allocated_bytes() const {
+    return mapped_offsets_ ? 0 : chunk_start_(num_chunks_);
+  }
+
+  // Estimated memory of the offsets, the erased bits and the records
+  uint64_t size_in_bytes() const {
+    const auto record_bytes = mapped_offsets_ ? sum_bytes_ : allocated_bytes();
+    return num_ptrs() * sizeof(uint32_t) + (num_ptrs() + 63) / 64 * sizeof(uint64_t)
+           + record_bytes;
+  }
+
+  void show_stat(std::ostream& os) const {
+    using std::endl;
+    os << "Show statistics of " << name() << endl;
+    os << " - num_ptrs:\t" << num_ptrs() << endl;
+    os << " - num_labels:\t" << num_labels() << endl;
+    os << " - num_erased:\t" << num_erased() << endl;
+    os << " - sum_bytes:\t" << sum_bytes() << endl;
+    os << " - ave_length:\t" << static_cast<double>(sum_bytes()) / num_labels() << endl;
+    os << " - num_chunks:\t" << num_chunks_ << endl;
+    os << " - allocated_bytes:\t" << allocated_bytes() << endl;
+    os << " - offset_bytes:\t" << num_ptrs() * sizeof(uint32_t) << endl;
+  }
+
+  // Records are written into a byte array with the offsets to them
+  void save(std::ostream& os) const {
+    save_value(os, num_labels_);
+    save_value(os, num_erased_);
+    save_value(os, sum_bytes_);
+
+    const auto size = num_ptrs();
+    std::vector<uint32_t> offsets(size, 0);
+    std::vector<uint64_t> erased((size + 63) / 64, 0);
+    std::vector<uint8_t> bytes;
+    bytes.reserve(sum_bytes_);
+
+    for (uint64_t id = 0; id < size; ++id) {
+      auto record = get_record_(id);
+      if (!record) {
+        continue;
+      }
+      const auto record_size = record_bytes_(record);
+      offsets[id] = static_cast<uint32_t>(bytes.size() / kUnitSize + 1);
+      bytes.insert(bytes.end(), record, record + record_size);
+      if (is_erased(id)) {
+        erased[id / 64] |= 1ULL << (id % 64);
+      }
+    }
+
+    save_array(os, offsets.data(), offsets.size());
+    save_array(os, erased.data(), erased.size());
+    save_array(os, bytes.data(), bytes.size());
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_labels_);
+    load_value(is, num_erased_);
+    load_value(is, sum_bytes_);
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint64_t> erased;
+    std::vector<uint8_t> bytes;
+    load_array(is, offsets);
+    load_array(is, erased);
+    load_array(is, bytes);
+    check_records_(offsets.data(), offsets.size(), erased.size(), bytes.data(), bytes.size());
+
+    clear_chunks_();
+    offsets_.assign(offsets.size(), 0);
+    erased_ = std::move(erased);
+    mapped_offsets_ = nullptr;
+
+    for (uint64_t id = 0; id < offsets.size(); ++id) {
+      if (offsets[id] == 0) {
+        continue;
+      }
+      auto record = bytes.data() + (offsets[id] - 1) * kUnitSize;
+      auto ptr = label_of_(record);
+      const auto value = reinterpret_cast<const uint8_t*>(get_value_(record));
+      write_record_(id, ptr, label_length_(ptr), value, value_size_(value));
+    }
+  }
+
+  // Refers to the data written by save() without copying; modifications are no longer allowed.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_labels_);
+    map_value(ptr, end, num_erased_);
+    map_value(ptr, end, sum_bytes_);
+
+    uint64_t num_words = 0, num_bytes = 0;
+    mapped_offsets_ = map_array<uint32_t>(ptr, end, num_mapped_ptrs_);
+    mapped_erased_ = map_array<uint64_t>(ptr, end, num_words);
+    mapped_bytes_ = map_array<uint8_t>(ptr, end, num_bytes);
+    check_records_(mapped_offsets_, num_mapped_ptrs_, num_words, mapped_bytes_, num_bytes);
+
+    clear_chunks_();
+    offsets_.clear();
+    erased_.clear();
+  }
+
+  LabelPool_Arena(const LabelPool_Arena&) = delete;
+  LabelPool_Arena& operator=(const LabelPool_Arena&) = delete;
+
+private:
+  std::vector<uint32_t> offsets_; // in units + 1 (0 means no label)
+  std::vector<uint64_t> erased_; // bits
+  std::array<AtomicCharArray, kMaxChunks> chunks_;
+  uint64_t num_chunks_ = 0;
+  uint64_t tail_ = 0; // offset of the next record in bytes
+  uint64_t num_labels_ = 0;
+  uint64_t num_erased_ = 0;
+  uint64_t sum_bytes_ = 0;
+  bool concurrent_ = false;
+
+  // data on a mapped region
+  const uint32_t* mapped_offsets_ = nullptr;
+  const uint64_t* mapped_erased_ = nullptr;
+  const uint8_t* mapped_bytes_ = nullptr;
+  uint64_t num_mapped_ptrs_ = 0;
+
+  static uint64_t chunk_start_(uint64_t chunk_id) {
+    return kFirstChunkSize * ((1ULL << chunk_id) - 1);
+  }
+
+  static uint64_t chunk_id_(uint64_t offset) {
+    return 63 - __builtin_clzll(offset / kFirstChunkSize + 1);
+  }
+
+  // length of the label including the terminator
+  static uint64_t record_size_(uint64_t length, uint64_t value_size) {
+    return (value_size + length + kUnitSize - 1) / kUnitSize * kUnitSize;
+  }
+
+  // Fixed-size values precede the labels so that they are aligned, and VarBytes ones follow them
+  static uint8_t* label_of_(uint8_t* record) {
+    return kVarValue ? record : record + sizeof(ValueType);
+  }
+  static uint8_t* value_of_(uint8_t* record, uint64_t length) {
+    return kVarValue ? record + length : record;
+  }
+  static ValueType* get_value_(uint8_t* record) {
+    return reinterpret_cast<ValueType*>(kVarValue ? record + label_length_(record) : record);
+  }
+
+  static uint64_t value_size_(const uint8_t* value) {
+    return kVarValue ? reinterpret_cast<const VarBytes*>(value)->encoded_size() : sizeof(ValueType);
+  }
+
+  static uint64_t record_bytes_(uint8_t* record) {
+    const auto length = label_length_(label_of_(record));
+    return record_size_(length, value_size_(value_of_(record, length)));
+  }
+
+  // Checks that the records at the offsets given by load() or map() end in the bytes
+  static void check_records_(const uint32_t* offsets, uint64_t num_ptrs, uint64_t num_words,
+                             const uint8_t* bytes, uint64_t num_bytes) {
+    check_consistent(num_words == (num_ptrs + 63) / 64);
+    for (uint64_t id = 0; id < num_ptrs; ++id) {
+      if (offsets[id] == 0) {
+        continue;
+      }
+      const auto pos = (offsets[id] - 1) * kUnitSize;
+      check_consistent(pos < num_bytes);
+      check_consistent(record_fits_(bytes + pos, num_bytes - pos));
+    }
+  }
+
+  // Whether the record at record ends in the rest bytes
+  static bool record_fits_(const uint8_t* record, uint64_t rest) {
+    const uint64_t label_pos = kVarValue ? 0 : sizeof(ValueType);
+    if (rest <= label_pos) {
+      return false;
+    }
+    const auto length = bounded_length_(record + label_pos, rest - label_pos);
+    if (rest - label_pos < length) {
+      return false;
+    }
+    uint64_t value_size = sizeof(ValueType);
+    if (kVarValue) {
+      const auto value_rest = rest - length;
+      uint64_t size = 0;
+      const auto code_size = vbyte::decode_bounded(record + length, value_rest, size);
+      if (code_size == 0 || value_rest - code_size < size) {
+        return false;
+      }
+      value_size = code_size + size;
+    }
+    return record_size_(length, value_size) <= rest;
+  }
+
+  // The mapped region is read-only, so the returned pointer must not be written then.
+  uint8_t* get_record_(uint64_t id) const {
+    if (mapped_offsets_) {
+      const auto offset = mapped_offsets_[id];
+      return offset ? const_cast<uint8_t*>(mapped_bytes_ + (offset - 1) * kUnitSize) : nullptr;
+    }
+    const uint64_t offset = __atomic_load_n(&offsets_[id], __ATOMIC_ACQUIRE);
+    if (offset == 0) {
+      return nullptr;
+    }
+    const auto pos = (offset - 1) * kUnitSize;
+    const auto chunk_id = chunk_id_(pos);
+    return chunks_[chunk_id].get() + (pos - chunk_start_(chunk_id));
+  }
+
+  // The value is initialized if not given
+  ValueType* append_(uint64_t id, const uint8_t* label, uint64_t length,
+                     const uint8_t* value = nullptr, uint64_t value_size = sizeof(ValueType)) {
+    if (offsets_[id] != 0) {
+      std::cerr << "ERROR: already exist" << std::endl;
+      exit(1);
+    }
+    ++num_labels_;
+    sum_bytes_ += record_size_(length, value_size);
+    return write_record_(id, label, length, value, value_size);
+  }
+
+  // Writes the record and publishes its offset
+  ValueType* write_record_(uint64_t id, const uint8_t* label, uint64_t length,
+                           const uint8_t* value, uint64_t value_size) {
+    uint64_t pos = 0;
+    auto record = allocate_record_(record_size_(length, value_size), pos);
+    std::memcpy(label_of_(record), label, length);
+    if (value) {
+      std::memcpy(value_of_(record, length), value, value_size);
+    }
+    publish_record_(id, pos);
+    return reinterpret_cast<ValueType*>(value_of_(record, length));
+  }
+
+  // Returns the zeroed record of size bytes at the tail, setting pos to its offset
+  uint8_t* allocate_record_(uint64_t size, uint64_t& pos) {
+    // A record does not straddle chunks
+    while (chunk_start_(num_chunks_) < tail_ + size) {
+      if (num_chunks_ == kMaxChunks) {
+        std::cerr << "ERROR: the arena is full" << std::endl;
+        exit(1);
+      }
+      if (num_chunks_ != 0 && tail_ < chunk_start_(num_chunks_)) {
+        tail_ = chunk_start_(num_chunks_);
+        continue;
+      }
+      chunks_[num_chunks_].exchange(make_char_array(kFirstChunkSize << num_chunks_));
+      ++num_chunks_;
+    }
+
+    const auto chunk_id = chunk_id_(tail_);
+    auto record = chunks_[chunk_id].get() + (tail_ - chunk_start_(chunk_id));
+    std::memset(record, 0, size);
+    pos = tail_;
+    tail_ += size;
+    return record;
+  }
+
+  // Readers may be reading the value with the reclaimer set, so the record is written again then.
+  // An old VarBytes value is left as the padding.
+  ValueType* write_value_(uint64_t id, const ValueType& value) {
+    auto record = get_record_(id);
+    const auto length = label_length_(label_of_(record));
+    const auto old_size = record_bytes_(record);
+    if (!concurrent_) {
+      auto ptr = value_of_(record, length);
+      std::memcpy(ptr, &value, sizeof(ValueType));
+      sum_bytes_ = sum_bytes_ - old_size + record_bytes_(record);
+      return reinterpret_cast<ValueType*>(ptr);
+    }
+
+    const auto value_ptr = reinterpret_cast<const uint8_t*>(&value);
+    const auto value_size = value_size_(value_ptr);
+    sum_bytes_ = sum_bytes_ - old_size + record_size_(length, value_size);
+    return write_record_(id, label_of_(record), length, value_ptr, value_size);
+  }
+
+  void publish_record_(uint64_t id, uint64_t pos) {
+    __atomic_store_n(&offsets_[id], static_cast<uint32_t>(pos / kUnitSize + 1), __ATOMIC_RELEASE);
+  }
+
+  void clear_chunks_() {
+    for (auto& chunk : chunks_) {
+      chunk.exchange(CharArray());
+    }
+    num_chunks_ = 0;
+    tail_ = 0;
+  }
+
+  void set_erased_(uint64_t id, bool erased) {
+    auto word = erased_[id / 64];
+    if (erased) {
+      word |= 1ULL << (id % 64);
+    } else {
+      word &= ~(1ULL << (id % 64));
+    }
+    __atomic_store_n(&erased_[id / 64], word, __ATOMIC_RELAXED);
+  }
+
+  // including the terminator, or max_length if longer
+  static uint64_t bounded_length_(const uint8_t* ptr, uint64_t max_length) {
+    return strnlen(reinterpret_cast<const char*>(ptr), max_length) + 1;
+  }
+
+  // including the terminator
+  static uint64_t label_length_(const uint8_t* ptr) {
+    return std::strlen(reinterpret_cast<const char*>(ptr)) + 1;
+  }
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_LABEL_POOL_ARENA_HPP
@@ -3,6 +3,8 @@
 
 #include "basics.hpp"
 #include "bit_tools.hpp"
+#include "EpochReclaimer.hpp"
+#include "simd_tools.hpp"
 #include "vbyte.hpp"
 
 namespace dynpdt {
@@ -14,26 +16,53 @@ namespace dynpdt {
  * Accessing a label is supported in O(kGroupSize) time using the skipping approach described in
  *  - Askitis and Zobel, Cache-conscious collision resolution in string hash tables, SPIRE, 2005.
  *
+ * A group is an array of the bitmap followed by the labels. compare_and_get() is safe on other
+ * threads while a single writer calls append(), erase(), restore() and set_value(), since a group
+ * is replaced by a new array published atomically with its bitmap and values, and the old one is
+ * retired to the reclaimer if set.
+ *
+ * With WithSlack, a group also has its capacity and the number of used bytes after the bitmap,
+ * and is allocated with spare bytes growing geometrically. Then, append() and move_to() shift the
+ * following labels in place unless the capacity is exceeded, and they decode only the labels
+ * before the splice point. Groups are still replaced as above if the reclaimer is set.
+ *
+ * With SkipStep, the header also has a directory of the offsets to every SkipStep-th label,
+ * so that a label is reached by decoding less than SkipStep labels from the nearest entry.
  * */
-template<typename _ValueType, int GroupTypeId>
+template<typename _ValueType, int GroupTypeId, bool WithSlack = false, uint64_t SkipStep = 0>
 class LabelPool_BitMap {
 public:
   using ValueType = _ValueType;
 
+  static_assert(!std::is_same<ValueType, VarBytes>::value,
+                "VarBytes values are supported only by LabelPool_Arena");
+
   using GroupTypes = std::tuple<uint8_t, uint16_t, uint32_t, uint64_t>;
   using GroupType = typename std::tuple_element<GroupTypeId, GroupTypes>::type;
 
   static constexpr uint64_t kGroupSize = sizeof(GroupType) * 8;
+  // offsets to the labels of ranks SkipStep, 2 * SkipStep, ...
+  static constexpr uint64_t kNumSkips = SkipStep ? (kGroupSize - 1) / SkipStep : 0;
+  static constexpr uint64_t kSlackFields = WithSlack ? 2 : 0;
+  // the bitmap, the capacity and the used bytes of the labels with WithSlack, and the directory
+  static constexpr uint64_t kHeaderSize = sizeof(GroupType)
+                                          + (kSlackFields + kNumSkips) * sizeof(uint32_t);
+  static constexpr uint64_t kSlackUnit = 16; // capacities are rounded up to this
 
   static std::string name() {
     std::ostringstream oss;
-    oss << "LabelPool_BitMap" << kGroupSize;
+    oss << "LabelPool_BitMap" << (WithSlack ? "Slack" : "") << kGroupSize;
+    if (SkipStep) {
+      oss << "Skip" << SkipStep;
+    }
     return oss.str();
   }
 
+  LabelPool_BitMap() {}
+
   LabelPool_BitMap(uint64_t size) {
     pools_.resize(size / kGroupSize + 1);
-    bitmap_.resize(size / kGroupSize + 1, 0);
+    erased_.resize(size / kGroupSize + 1, 0);
   }
 
   ~LabelPool_BitMap() {}
@@ -47,131 +76,263 @@ public:
     const auto group_id = id / kGroupSize;
     const auto offset = id % kGroupSize;
 
-    if (!bit_tools::get_bit(bitmap_[group_id], offset)) {
+    auto ptr = get_group_(group_id);
+    const auto bitmap = get_bitmap_(ptr);
+    if (!bit_tools::get_bit(bitmap, offset)) {
       num_match = 0;
       return nullptr;
     }
 
-    auto ptr = pools_[group_id].get();
-    const auto loc = bit_tools::popcount(bitmap_[group_id], offset);
+    ptr = seek_(ptr, bit_tools::popcount(bitmap, offset));
 
     uint64_t len = 0;
-    for (uint64_t i = 0; i < loc; ++i) {
-      ptr += vbyte::decode(ptr, len);
-      ptr += len + sizeof(ValueType);
-    }
     ptr += vbyte::decode(ptr, len);
+    const bool erased = bit_tools::get_bit(get_erased_(group_id), offset);
 
     if (label.begin == label.end) {
-      return reinterpret_cast<ValueType*>(ptr);
-    }
-
-    for (num_match = 0; num_match < len; ++num_match) {
-      if (ptr[num_match] != label.begin[num_match]) {
-        return nullptr;
-      }
+      return erased ? nullptr : reinterpret_cast<ValueType*>(ptr);
     }
 
-    if (label.begin[num_match]) {
+    // The query ends with the terminator, which differs from any byte of the stored label
+    num_match = simd_tools::mismatch(ptr, label.begin, std::min(len, label.length()));
+    if (num_match != len || label.begin[num_match]) {
       return nullptr;
     }
 
+    // An erased label is reported as nullptr with the full num_match
     ++num_match;
-    return reinterpret_cast<ValueType*>(ptr + len);
+    return erased ? nullptr : reinterpret_cast<ValueType*>(ptr + len);
+  }
+
+  // The value is written before the label is published
+  ValueType* append(uint64_t id, CharRange label, const ValueType& value = ValueType()) {
+    return append_(id, label.begin, label_length_(label), value);
+  }
+
+  // Appends the labels to their ids, which are given in increasing order. Each group without
+  // labels is written at once; the others are appended one by one.
+  void append_sorted(const std::vector<LabelItem<ValueType>>& items) {
+    for (uint64_t i = 0; i < items.size();) {
+      const auto group_id = items[i].id / kGroupSize;
+      uint64_t end = i;
+      while (end < items.size() && items[end].id / kGroupSize == group_id) {
+        assert(end == i || items[end - 1].id < items[end].id);
+        ++end;
+      }
+
+      if (pools_[group_id].get()) {
+        for (; i < end; ++i) {
+          append(items[i].id, items[i].label, items[i].value);
+        }
+        continue;
+      }
+
+      GroupType bitmap = 0;
+      uint64_t used = 0;
+      for (auto j = i; j < end; ++j) {
+        const auto label_len = label_length_(items[j].label);
+        used += vbyte::size(label_len) + label_len + sizeof(ValueType);
+        bit_tools::set_bit(bitmap, items[j].id % kGroupSize);
+      }
+
+      auto group = make_group_(bitmap, grow_capacity_(0, used), used);
+      auto ptr = group.get() + kHeaderSize;
+      for (; i < end; ++i) {
+        auto value_ptr = write_label_(ptr, items[i].label.begin, label_length_(items[i].label),
+                                      items[i].value);
+        ptr = reinterpret_cast<uint8_t*>(value_ptr) + sizeof(ValueType);
+      }
+      update_directory_(group.get(), 0);
+
+      num_labels_ += bit_tools::popcount(bitmap);
+      sum_bytes_ += used;
+      set_group_(group_id, std::move(group));
+    }
+  }
+
+  // Marks the label of id as erased. The label itself is kept because it can be
+  // still referred by the descendants; it is released when the node is moved away.
+  void erase(uint64_t id) {
+    const auto group_id = id / kGroupSize;
+    const auto offset = id % kGroupSize;
+    assert(bit_tools::get_bit(get_bitmap_(pools_[group_id].get()), offset));
+    assert(!bit_tools::get_bit(erased_[group_id], offset));
+    auto erased = erased_[group_id];
+    bit_tools::set_bit(erased, offset);
+    set_erased_(group_id, erased);
+    ++num_erased_;
   }
 
-  ValueType* append(uint64_t id, CharRange label) {
+  // Unmarks the erased label of id and returns its value set to value
+  ValueType* restore(uint64_t id, const ValueType& value = ValueType()) {
     const auto group_id = id / kGroupSize;
     const auto offset = id % kGroupSize;
+    assert(bit_tools::get_bit(erased_[group_id], offset));
+    auto ret = write_value_(id, value);
+    auto erased = erased_[group_id];
+    bit_tools::clear_bit(erased, offset);
+    set_erased_(group_id, erased);
+    --num_erased_;
+    return ret;
+  }
 
-    if (bit_tools::get_bit(bitmap_[group_id], offset)) {
-      std::cerr << "ERROR: already exist" << std::endl;
-      exit(1);
+  // Sets the value of id, returning the pointer to it
+  ValueType* set_value(uint64_t id, const ValueType& value) {
+    assert(!is_erased(id));
+    return write_value_(id, value);
+  }
+
+  // Sets label to the label of id without the terminator, and returns the pointer to its value,
+  // or nullptr if id has no label. An erased label is also returned.
+  ValueType* get_label(uint64_t id, CharRange& label) const {
+    const auto group_id = id / kGroupSize;
+    const auto offset = id % kGroupSize;
+
+    auto ptr = get_group_(group_id);
+    const auto bitmap = get_bitmap_(ptr);
+    if (!bit_tools::get_bit(bitmap, offset)) {
+      return nullptr;
     }
 
-    ++num_labels_;
-    bit_tools::set_bit(bitmap_[group_id], offset);
+    ptr = seek_(ptr, bit_tools::popcount(bitmap, offset));
 
-    if (!pools_[group_id]) {
-      const auto label_len = (label.begin == label.end) ? 0 : label.length() - 1;
-      const auto new_alloc = vbyte::size(label_len) + label_len + sizeof(ValueType);
-      sum_bytes_ += new_alloc;
+    uint64_t len = 0;
+    ptr += vbyte::decode(ptr, len);
 
-      pools_[group_id] = make_char_array(new_alloc);
-      auto ptr = pools_[group_id].get();
+    label.begin = ptr;
+    label.end = ptr + len;
+    return reinterpret_cast<ValueType*>(ptr + len);
+  }
 
-      ptr += vbyte::encode(ptr, label_len);
-      std::memcpy(ptr, label.begin, label_len);
-      ptr += label_len;
-      std::memset(ptr, 0, sizeof(ValueType));
+  bool is_erased(uint64_t id) const {
+    return bit_tools::get_bit(get_erased_(id / kGroupSize), id % kGroupSize);
+  }
+
+  // Returns the number of labels walked over in the group to reach the label of id,
+  // after the jump by the directory
+  uint64_t skip_length(uint64_t id) const {
+    const auto bitmap = get_bitmap_(get_group_(id / kGroupSize));
+    const auto loc = bit_tools::popcount(bitmap, id % kGroupSize);
+    const auto num_entries = SkipStep ? std::min<uint64_t>(loc / SkipStep, +kNumSkips) : 0;
+    return loc - num_entries * SkipStep;
+  }
 
-      return reinterpret_cast<ValueType*>(ptr);
+  // Prefetches for compare_and_get() in two stages since the group is reached through
+  // the pointer; prefetch_label() touches the pointer, so it should follow prefetch_ptr().
+  void prefetch_ptr(uint64_t id) const {
+    const auto group_id = id / kGroupSize;
+    if (mapped_offsets_) {
+      __builtin_prefetch(mapped_offsets_ + group_id);
+    } else {
+      __builtin_prefetch(pools_.data() + group_id);
     }
+  }
+  void prefetch_label(uint64_t id) const {
+    __builtin_prefetch(get_group_(id / kGroupSize));
+  }
 
-    uint64_t front_len = 0, back_len = 0;
-    {
-      const auto num_labels = bit_tools::popcount(bitmap_[group_id]) - 1;
-      const auto loc = bit_tools::popcount(bitmap_[group_id], offset);
-      auto ptr = pools_[group_id].get();
+  // Moves the label of id to dst_id of dst, returning false if id has no label
+  bool move_to(uint64_t id, LabelPool_BitMap& dst, uint64_t dst_id) {
+    if (!copy_to(id, dst, dst_id)) {
+      return false;
+    }
 
-      for (uint64_t i = 0; i < num_labels; ++i) {
-        uint64_t len = 0;
-        len += vbyte::decode(ptr, len) + sizeof(ValueType);
-        if (i < loc) {
-          front_len += len;
-        } else {
-          back_len += len;
-        }
-        ptr += len;
-      }
+    const auto group_id = id / kGroupSize;
+    const auto offset = id % kGroupSize;
+    if (bit_tools::get_bit(erased_[group_id], offset)) {
+      auto erased = erased_[group_id];
+      bit_tools::clear_bit(erased, offset);
+      set_erased_(group_id, erased);
+      --num_erased_;
     }
 
-    const auto label_len = (label.begin == label.end) ? 0 : label.length() - 1;
-    const auto new_alloc = vbyte::size(label_len) + label_len + sizeof(ValueType);
-    sum_bytes_ += new_alloc;
+    remove_(group_id, offset);
+    return true;
+  }
 
-    auto new_pool = make_char_array(front_len + back_len + new_alloc);
+  // Copies the label of id to dst_id of dst, returning false if id has no label
+  bool copy_to(uint64_t id, LabelPool_BitMap& dst, uint64_t dst_id) const {
+    const auto group_id = id / kGroupSize;
+    const auto offset = id % kGroupSize;
 
-    auto orig_ptr = pools_[group_id].get();
-    auto new_ptr = new_pool.get();
+    auto ptr = get_group_(group_id);
+    const auto bitmap = get_bitmap_(ptr);
+    if (!bit_tools::get_bit(bitmap, offset)) {
+      return false;
+    }
 
-    std::memcpy(new_ptr, orig_ptr, front_len);
-    orig_ptr += front_len;
-    new_ptr += front_len;
+    ptr = seek_(ptr, bit_tools::popcount(bitmap, offset));
 
-    new_ptr += vbyte::encode(new_ptr, label_len);
-    std::memcpy(new_ptr, label.begin, label_len);
-    new_ptr += label_len;
+    uint64_t len = 0;
+    ptr += vbyte::decode(ptr, len);
 
-    std::memset(new_ptr, 0, sizeof(ValueType));
-    auto ret = reinterpret_cast<ValueType*>(new_ptr);
-    new_ptr += sizeof(ValueType);
+    ValueType value;
+    std::memcpy(&value, ptr + len, sizeof(ValueType));
+    dst.append_(dst_id, ptr, len, value);
 
-    std::memcpy(new_ptr, orig_ptr, back_len);
-    pools_[group_id] = std::move(new_pool);
+    if (bit_tools::get_bit(get_erased_(group_id), offset)) {
+      const auto dst_group_id = dst_id / kGroupSize;
+      auto erased = dst.erased_[dst_group_id];
+      bit_tools::set_bit(erased, dst_id % kGroupSize);
+      dst.set_erased_(dst_group_id, erased);
+      ++dst.num_erased_;
+    }
+    return true;
+  }
 
-    return ret;
+  void set_reclaimer(EpochReclaimer* reclaimer) {
+    reclaimer_ = reclaimer;
   }
 
   uint64_t num_ptrs() const {
-    return pools_.size();
+    return mapped_offsets_ ? num_mapped_groups_ : pools_.size();
   }
 
   uint64_t num_labels() const {
     return num_labels_;
   }
 
+  uint64_t num_erased() const {
+    return num_erased_;
+  }
+
   uint64_t sum_bytes() const {
     return sum_bytes_;
   }
 
+  // Labels are released or shifted in place, leaving no dead space
+  uint64_t dead_bytes() const {
+    return 0;
+  }
+
+  // of the label areas including the spare bytes, which equals sum_bytes() without WithSlack
+  uint64_t capacity_bytes() const {
+    return capacity_bytes_;
+  }
+
+  // Estimated memory of the pointers, the erased bits and the groups
+  uint64_t size_in_bytes() const {
+    const auto num_groups = num_ptrs() - num_empty_groups_();
+    return num_ptrs() * (sizeof(uint64_t) + sizeof(GroupType)) + num_groups * kHeaderSize
+           + (mapped_offsets_ ? sum_bytes_ : capacity_bytes_);
+  }
+
   void show_stat(std::ostream& os) const {
     using std::endl;
     os << "Show statistics of " << name() << endl;
     os << " - num_ptrs:\t" << num_ptrs() << endl;
     os << " - num_labels:\t" << num_labels() << endl;
+    os << " - num_erased:\t" << num_erased() << endl;
     os << " - sum_bytes:\t" << sum_bytes() << endl;
     os << " - ave_length:\t" << static_cast<double>(sum_bytes()) / num_ptrs() << endl;
+    if (WithSlack) {
+      os << " - capacity_bytes:\t" << capacity_bytes() << endl;
+    }
+    if (kHeaderSize != sizeof(GroupType)) {
+      const auto num_groups = num_ptrs() - num_empty_groups_();
+      os << " - header_bytes:\t" << num_groups * kHeaderSize << endl;
+      os << " - directory_bytes:\t" << num_groups * kNumSkips * sizeof(uint32_t) << endl;
+    }
     os << " - rate_vbyte_counts:" << endl;
 
     auto vbyte_counts = count_vbytes_();
@@ -184,22 +345,463 @@ public:
     }
   }
 
+  // Groups are written into a byte array with the offsets to them
+  void save(std::ostream& os) const {
+    save_value(os, num_labels_);
+    save_value(os, num_erased_);
+    save_value(os, sum_bytes_);
+
+    const auto num_groups = num_ptrs();
+    std::vector<GroupType> erased(num_groups);
+    std::vector<uint64_t> offsets(num_groups + 1, 0);
+    std::vector<uint8_t> bytes;
+    bytes.reserve(sum_bytes_);
+
+    for (uint64_t group_id = 0; group_id < num_groups; ++group_id) {
+      erased[group_id] = get_erased_(group_id);
+      auto ptr = get_group_(group_id);
+      const auto size = group_size_(ptr);
+      bytes.insert(bytes.end(), ptr, ptr + size);
+      if (WithSlack && ptr) {
+        // The spare bytes are not written
+        set_header_(bytes.data() + bytes.size() - size, 0, size - kHeaderSize);
+      }
+      offsets[group_id + 1] = bytes.size();
+    }
+
+    save_array(os, erased.data(), erased.size());
+    save_array(os, offsets.data(), offsets.size());
+    save_array(os, bytes.data(), bytes.size());
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_labels_);
+    load_value(is, num_erased_);
+    load_value(is, sum_bytes_);
+    capacity_bytes_ = sum_bytes_;
+
+    std::vector<uint64_t> offsets;
+    std::vector<uint8_t> bytes;
+    load_array(is, erased_);
+    load_array(is, offsets);
+    load_array(is, bytes);
+    check_groups_(erased_.data(), erased_.size(), offsets.data(), offsets.size(), bytes.data(),
+                  bytes.size());
+
+    pools_.clear();
+    pools_.resize(erased_.size());
+    mapped_offsets_ = nullptr;
+
+    for (uint64_t group_id = 0; group_id < pools_.size(); ++group_id) {
+      const auto size = offsets[group_id + 1] - offsets[group_id];
+      if (size == 0) {
+        continue;
+      }
+      auto array = make_char_array(size);
+      std::memcpy(array.get(), bytes.data() + offsets[group_id], size);
+      pools_[group_id].exchange(std::move(array));
+    }
+  }
+
+  // Refers to the data written by save() without copying; modifications are no longer allowed.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_labels_);
+    map_value(ptr, end, num_erased_);
+    map_value(ptr, end, sum_bytes_);
+    capacity_bytes_ = sum_bytes_;
+
+    uint64_t num_offsets = 0, num_bytes = 0;
+    mapped_erased_ = map_array<GroupType>(ptr, end, num_mapped_groups_);
+    mapped_offsets_ = map_array<uint64_t>(ptr, end, num_offsets);
+    mapped_bytes_ = map_array<uint8_t>(ptr, end, num_bytes);
+    check_groups_(mapped_erased_, num_mapped_groups_, mapped_offsets_, num_offsets, mapped_bytes_,
+                  num_bytes);
+
+    pools_.clear();
+    erased_.clear();
+  }
+
   LabelPool_BitMap(const LabelPool_BitMap&) = delete;
   LabelPool_BitMap& operator=(const LabelPool_BitMap&) = delete;
 
 private:
-  std::vector<CharArray> pools_;
-  std::vector<GroupType> bitmap_;
+  std::vector<AtomicCharArray> pools_;
+  std::vector<GroupType> erased_;
   uint64_t num_labels_ = 0;
-  uint64_t sum_bytes_ = 0;
+  uint64_t num_erased_ = 0;
+  uint64_t sum_bytes_ = 0; // not including headers
+  uint64_t capacity_bytes_ = 0; // not including headers
+  EpochReclaimer* reclaimer_ = nullptr;
+
+  // data on a mapped region
+  const GroupType* mapped_erased_ = nullptr;
+  const uint64_t* mapped_offsets_ = nullptr;
+  const uint8_t* mapped_bytes_ = nullptr;
+  uint64_t num_mapped_groups_ = 0;
+
+  // The bitmap is at the head of the group, which can be unaligned on a mapped region
+  static GroupType get_bitmap_(const uint8_t* group) {
+    GroupType bitmap = 0;
+    if (group) {
+      std::memcpy(&bitmap, group, sizeof(GroupType));
+    }
+    return bitmap;
+  }
+
+  // The i-th field after the bitmap. With WithSlack, 0 is the capacity and 1 is the used bytes,
+  // and the directory follows.
+  static uint64_t get_header_(const uint8_t* group, uint64_t i) {
+    uint32_t value = 0;
+    std::memcpy(&value, group + sizeof(GroupType) + i * sizeof(uint32_t), sizeof(uint32_t));
+    return value;
+  }
+
+  static void set_header_(uint8_t* group, uint64_t i, uint64_t value) {
+    const auto value32 = static_cast<uint32_t>(value);
+    std::memcpy(group + sizeof(GroupType) + i * sizeof(uint32_t), &value32, sizeof(uint32_t));
+  }
+
+  // without the terminator
+  static uint64_t label_length_(CharRange label) {
+    return (label.begin == label.end) ? 0 : label.length() - 1;
+  }
+
+  // Spare bytes grow geometrically, so a group is reallocated O(log) times while filled
+  static uint64_t grow_capacity_(uint64_t capacity, uint64_t used) {
+    if (!WithSlack) {
+      return used;
+    }
+    if (used <= capacity) {
+      return capacity;
+    }
+    capacity = std::max(used, capacity + capacity / 2);
+    return (capacity + kSlackUnit - 1) / kSlackUnit * kSlackUnit;
+  }
+
+  // Checks that the groups at the offsets given by load() or map() lie in the bytes
+  static void check_groups_(const GroupType* erased, uint64_t num_groups, const uint64_t* offsets,
+                            uint64_t num_offsets, const uint8_t* bytes, uint64_t num_bytes) {
+    check_consistent(num_offsets == num_groups + 1 && offsets[0] == 0);
+    for (uint64_t group_id = 0; group_id < num_groups; ++group_id) {
+      const auto begin = offsets[group_id];
+      const auto end = offsets[group_id + 1];
+      check_consistent(begin <= end && end <= num_bytes);
+      check_consistent(group_fits_(bytes + begin, end - begin, erased[group_id]));
+    }
+  }
+
+  // Whether the labels of the group, and its header, end exactly in size bytes
+  static bool group_fits_(const uint8_t* group, uint64_t size, GroupType erased) {
+    if (size == 0) {
+      return erased == 0;
+    }
+    if (size < kHeaderSize) {
+      return false;
+    }
+    const auto bitmap = get_bitmap_(group);
+    if (bitmap == 0 || (erased & ~bitmap) != 0) {
+      return false;
+    }
+    const auto used = size - kHeaderSize;
+    if (WithSlack && (get_header_(group, 0) != used || get_header_(group, 1) != used)) {
+      return false;
+    }
+
+    const auto num_labels = bit_tools::popcount(bitmap);
+    std::array<uint64_t, kGroupSize + 1> ends; // of the labels before each rank
+    uint64_t pos = kHeaderSize;
+    for (uint64_t rank = 0; rank < num_labels; ++rank) {
+      ends[rank] = pos - kHeaderSize;
+      uint64_t len = 0;
+      const auto code_size = vbyte::decode_bounded(group + pos, size - pos, len);
+      if (code_size == 0) {
+        return false;
+      }
+      pos += code_size;
+      if (size - pos < len || size - pos - len < sizeof(ValueType)) {
+        return false;
+      }
+      pos += len + sizeof(ValueType);
+    }
+    ends[num_labels] = pos - kHeaderSize;
+
+    // As update_directory_() writes the entries
+    for (uint64_t entry_id = 0; entry_id < kNumSkips; ++entry_id) {
+      const auto rank = std::min<uint64_t>((entry_id + 1) * SkipStep, num_labels);
+      if (get_header_(group, kSlackFields + entry_id) != ends[rank]) {
+        return false;
+      }
+    }
+    return pos == size;
+  }
+
+  GroupType get_erased_(uint64_t group_id) const {
+    return mapped_offsets_ ? mapped_erased_[group_id]
+                           : __atomic_load_n(&erased_[group_id], __ATOMIC_RELAXED);
+  }
+
+  void set_erased_(uint64_t group_id, GroupType erased) {
+    __atomic_store_n(&erased_[group_id], erased, __ATOMIC_RELAXED);
+  }
+
+  // Returns nullptr for an empty group.
+  // The mapped region is read-only, so the returned pointer must not be written then.
+  uint8_t* get_group_(uint64_t group_id) const {
+    if (mapped_offsets_) {
+      const auto offset = mapped_offsets_[group_id];
+      return offset == mapped_offsets_[group_id + 1] ? nullptr
+                                                     : const_cast<uint8_t*>(mapped_bytes_ + offset);
+    }
+    return pools_[group_id].get();
+  }
+
+  // Publishes the group and retires the replaced one
+  void set_group_(uint64_t group_id, CharArray group) {
+    auto old_group = pools_[group_id].exchange(std::move(group));
+    if (reclaimer_ && old_group) {
+      reclaimer_->retire(std::move(old_group));
+    }
+  }
+
+  // including the header
+  uint64_t group_size_(const uint8_t* group) const {
+    if (!group) {
+      return 0;
+    }
+    if (WithSlack) {
+      return kHeaderSize + get_header_(group, 1);
+    }
+    return seek_(group, bit_tools::popcount(get_bitmap_(group))) - group;
+  }
+
+  // Returns the pointer to the loc-th label, or to the end of the labels if loc is their number.
+  // A directory entry has the offset to the label of its rank, or to the end if it is absent.
+  uint8_t* seek_(const uint8_t* group, uint64_t loc) const {
+    auto ptr = group + kHeaderSize;
+    uint64_t rank = 0;
+    const auto num_entries = SkipStep ? std::min<uint64_t>(loc / SkipStep, +kNumSkips) : 0;
+    if (num_entries) {
+      ptr += get_header_(group, kSlackFields + num_entries - 1);
+      rank = num_entries * SkipStep;
+    }
+    for (; rank < loc; ++rank) {
+      uint64_t len = 0;
+      ptr += vbyte::decode(ptr, len);
+      ptr += len + sizeof(ValueType);
+    }
+    return const_cast<uint8_t*>(ptr);
+  }
+
+  // Rewrites the directory entries after the label of loc was inserted or removed.
+  // The entries of ranks up to loc are unchanged, since so are the labels before loc.
+  void update_directory_(uint8_t* group, uint64_t loc) {
+    if (!SkipStep) {
+      return;
+    }
+
+    const auto num_labels = bit_tools::popcount(get_bitmap_(group));
+    const auto begin = group + kHeaderSize;
+
+    uint64_t rank = loc / SkipStep * SkipStep;
+    auto ptr = seek_(group, rank);
+    for (uint64_t entry_id = rank / SkipStep; entry_id < kNumSkips; ++entry_id) {
+      for (; rank < (entry_id + 1) * SkipStep && rank < num_labels; ++rank) {
+        uint64_t len = 0;
+        ptr += vbyte::decode(ptr, len);
+        ptr += len + sizeof(ValueType);
+      }
+      set_header_(group, kSlackFields + entry_id, ptr - begin);
+    }
+  }
+
+  // Copies the directory entries, which are valid up to the modified label
+  static void copy_directory_(const uint8_t* src, uint8_t* dst) {
+    const auto pos = sizeof(GroupType) + kSlackFields * sizeof(uint32_t);
+    std::memcpy(dst + pos, src + pos, kNumSkips * sizeof(uint32_t));
+  }
+
+  // Returns the bytes of the labels before loc, also setting back_len to those after them
+  uint64_t measure_(const uint8_t* group, uint64_t loc, uint64_t& back_len) const {
+    const auto ptr = seek_(group, loc);
+    const uint64_t front_len = ptr - (group + kHeaderSize);
+    if (WithSlack) {
+      back_len = get_header_(group, 1) - front_len;
+    } else {
+      back_len = seek_(group, bit_tools::popcount(get_bitmap_(group))) - ptr;
+    }
+    return front_len;
+  }
+
+  static ValueType* write_label_(uint8_t* ptr, const uint8_t* label, uint64_t label_len,
+                                 const ValueType& value) {
+    ptr += vbyte::encode(ptr, label_len);
+    std::memcpy(ptr, label, label_len);
+    ptr += label_len;
+    std::memcpy(ptr, &value, sizeof(ValueType));
+    return reinterpret_cast<ValueType*>(ptr);
+  }
+
+  // Readers may be reading the value with the reclaimer set, so the group is replaced then
+  ValueType* write_value_(uint64_t id, const ValueType& value) {
+    const auto group_id = id / kGroupSize;
+    const auto group = pools_[group_id].get();
+    if (!reclaimer_) {
+      return write_value_(group, id % kGroupSize, value);
+    }
+
+    const auto size = group_size_(group);
+    const auto capacity = WithSlack ? get_header_(group, 0) : size - kHeaderSize;
+    auto new_group = make_char_array(kHeaderSize + capacity);
+    std::memcpy(new_group.get(), group, size);
+    auto ret = write_value_(new_group.get(), id % kGroupSize, value);
+    set_group_(group_id, std::move(new_group));
+    return ret;
+  }
+
+  ValueType* write_value_(uint8_t* group, uint64_t offset, const ValueType& value) {
+    auto ptr = seek_(group, bit_tools::popcount(get_bitmap_(group), offset));
+    uint64_t len = 0;
+    ptr += vbyte::decode(ptr, len);
+    ptr += len;
+    std::memcpy(ptr, &value, sizeof(ValueType));
+    return reinterpret_cast<ValueType*>(ptr);
+  }
+
+  // Returns the group with the header written and the capacity for used bytes
+  CharArray make_group_(GroupType bitmap, uint64_t capacity, uint64_t used) {
+    auto group = make_char_array(kHeaderSize + capacity);
+    std::memcpy(group.get(), &bitmap, sizeof(GroupType));
+    if (WithSlack) {
+      set_header_(group.get(), 0, capacity);
+      set_header_(group.get(), 1, used);
+    }
+    capacity_bytes_ += capacity;
+    return group;
+  }
+
+  ValueType* append_(uint64_t id, const uint8_t* label, uint64_t label_len,
+                     const ValueType& value) {
+    const auto group_id = id / kGroupSize;
+    const auto offset = id % kGroupSize;
+
+    auto orig_ptr = pools_[group_id].get();
+    auto bitmap = get_bitmap_(orig_ptr);
+
+    if (bit_tools::get_bit(bitmap, offset)) {
+      std::cerr << "ERROR: already exist" << std::endl;
+      exit(1);
+    }
+
+    ++num_labels_;
+
+    const auto front_loc = bit_tools::popcount(bitmap, offset);
+    uint64_t front_len = 0, back_len = 0, capacity = 0;
+    if (orig_ptr) {
+      front_len = measure_(orig_ptr, front_loc, back_len);
+      capacity = WithSlack ? get_header_(orig_ptr, 0) : front_len + back_len;
+    }
+
+    const auto new_alloc = vbyte::size(label_len) + label_len + sizeof(ValueType);
+    const auto used = front_len + back_len + new_alloc;
+    sum_bytes_ += new_alloc;
+    bit_tools::set_bit(bitmap, offset);
+
+    // The following labels are shifted if the group has room and no reader can see it
+    if (WithSlack && orig_ptr && !reclaimer_ && used <= capacity) {
+      auto ptr = orig_ptr + kHeaderSize + front_len;
+      std::memmove(ptr + new_alloc, ptr, back_len);
+      std::memcpy(orig_ptr, &bitmap, sizeof(GroupType));
+      set_header_(orig_ptr, 1, used);
+      auto ret = write_label_(ptr, label, label_len, value);
+      update_directory_(orig_ptr, front_loc);
+      return ret;
+    }
+
+    // The new group is filled before published
+    capacity_bytes_ -= capacity;
+    auto new_pool = make_group_(bitmap, grow_capacity_(capacity, used), used);
+    auto new_ptr = new_pool.get() + kHeaderSize;
+
+    if (orig_ptr) {
+      copy_directory_(orig_ptr, new_pool.get());
+      orig_ptr += kHeaderSize;
+      std::memcpy(new_ptr, orig_ptr, front_len);
+      std::memcpy(new_ptr + front_len + new_alloc, orig_ptr + front_len, back_len);
+    }
+    auto ret = write_label_(new_ptr + front_len, label, label_len, value);
+    update_directory_(new_pool.get(), front_loc);
+    set_group_(group_id, std::move(new_pool));
+
+    return ret;
+  }
+
+  // Removes the label at offset from the group, shrinking its buffer
+  void remove_(uint64_t group_id, uint64_t offset) {
+    auto orig_ptr = pools_[group_id].get();
+    auto bitmap = get_bitmap_(orig_ptr);
+    const auto num_labels = bit_tools::popcount(bitmap);
+    const auto loc = bit_tools::popcount(bitmap, offset);
+
+    --num_labels_;
+
+    uint64_t back_len = 0, rm_len = 0;
+    const auto front_len = measure_(orig_ptr, loc, back_len);
+    const auto capacity = WithSlack ? get_header_(orig_ptr, 0) : front_len + back_len;
+    {
+      uint64_t len = 0;
+      rm_len = vbyte::decode(orig_ptr + kHeaderSize + front_len, len) + len + sizeof(ValueType);
+      back_len -= rm_len;
+    }
+
+    sum_bytes_ -= rm_len;
+
+    if (num_labels == 1) {
+      capacity_bytes_ -= capacity;
+      set_group_(group_id, CharArray());
+      return;
+    }
+
+    bit_tools::clear_bit(bitmap, offset);
+    const auto used = front_len + back_len;
+
+    // The group is kept until it becomes sparse
+    if (WithSlack && !reclaimer_ && capacity <= used * 4) {
+      auto ptr = orig_ptr + kHeaderSize + front_len;
+      std::memmove(ptr, ptr + rm_len, back_len);
+      std::memcpy(orig_ptr, &bitmap, sizeof(GroupType));
+      set_header_(orig_ptr, 1, used);
+      update_directory_(orig_ptr, loc);
+      return;
+    }
+
+    capacity_bytes_ -= capacity;
+    auto new_pool = make_group_(bitmap, grow_capacity_(0, used), used);
+    auto new_ptr = new_pool.get() + kHeaderSize;
+
+    copy_directory_(orig_ptr, new_pool.get());
+    orig_ptr += kHeaderSize;
+    std::memcpy(new_ptr, orig_ptr, front_len);
+    std::memcpy(new_ptr + front_len, orig_ptr + front_len + rm_len, back_len);
+    update_directory_(new_pool.get(), loc);
+    set_group_(group_id, std::move(new_pool));
+  }
+
+  uint64_t num_empty_groups_() const {
+    uint64_t num = 0;
+    for (uint64_t group_id = 0; group_id < num_ptrs(); ++group_id) {
+      num += get_group_(group_id) == nullptr;
+    }
+    return num;
+  }
 
   std::array<uint64_t, 8> count_vbytes_() const {
     std::array<uint64_t, 8> counts;
     counts.fill(0);
 
-    for (uint64_t group_id = 0; group_id < pools_.size(); ++group_id) {
-      auto ptr = pools_[group_id].get();
-      const auto num_labels = bit_tools::popcount(bitmap_[group_id]);
+    for (uint64_t group_id = 0; group_id < num_ptrs(); ++group_id) {
+      auto ptr = get_group_(group_id);
+      const auto num_labels = bit_tools::popcount(get_bitmap_(ptr));
+      ptr += num_labels ? kHeaderSize : 0;
 
       for (uint64_t i = 0; i < num_labels; ++i) {
         uint64_t len = 0;
@@ -2,20 +2,37 @@
 #define DYNPDT_LABEL_POOL_PLAIN_HPP
 
 #include "basics.hpp"
+#include "EpochReclaimer.hpp"
+#include "simd_tools.hpp"
+#include "vbyte.hpp"
 
 namespace dynpdt {
 
+/*
+ * Labels are stored in separate arrays.
+ *
+ * compare_and_get() is safe on other threads while a single writer calls append(), erase(),
+ * restore() and set_value(), since arrays are published atomically with their values. With the
+ * reclaimer set, restore() and set_value() replace the array instead of writing the value in
+ * place, and the old one is retired to the reclaimer.
+ * */
 template <typename _ValueType>
 class LabelPool_Plain {
 public:
   using ValueType = _ValueType;
 
+  static_assert(!std::is_same<ValueType, VarBytes>::value,
+                "VarBytes values are supported only by LabelPool_Arena");
+
   static std::string name() {
     return "LabelPool_Plain";
   }
 
+  LabelPool_Plain() {}
+
   LabelPool_Plain(uint64_t size) {
     pools_.resize(size);
+    erased_.resize((size + 63) / 64, 0);
   }
 
   ~LabelPool_Plain() {}
@@ -28,26 +45,29 @@ public:
   ValueType* compare_and_get(uint64_t id, CharRange label, uint64_t& num_match) {
     num_match = 0;
 
-    auto ptr = pools_[id].get();
+    auto ptr = get_ptr_(id);
     if (!ptr) {
       return nullptr;
     }
 
     if (label.begin == label.end) {
-      return reinterpret_cast<ValueType*>(ptr);
+      return is_erased(id) ? nullptr : reinterpret_cast<ValueType*>(ptr + label_length_(ptr));
     }
 
-    while (label.begin + num_match != label.end) {
-      if (label.begin[num_match] != ptr[num_match]) {
-        return nullptr;
-      }
-      ++num_match;
+    // The stored label is not read beyond its terminator
+    const auto length = label.length();
+    const auto bound = std::min(length, bounded_length_(ptr, length));
+    num_match = simd_tools::mismatch(label.begin, ptr, bound);
+    if (num_match != length) {
+      return nullptr;
     }
 
-    return reinterpret_cast<ValueType*>(ptr + num_match);
+    // An erased label is reported as nullptr with the full num_match
+    return is_erased(id) ? nullptr : reinterpret_cast<ValueType*>(ptr + num_match);
   }
 
-  ValueType* append(uint64_t id, CharRange label) {
+  // The value is written before the label is published
+  ValueType* append(uint64_t id, CharRange label, const ValueType& value = ValueType()) {
     if (pools_[id]) {
       std::cerr << "ERROR: already exist" << std::endl;
       exit(1);
@@ -55,48 +75,336 @@ public:
 
     ++num_labels_;
 
-    const auto length = label.length();
+    // An empty label is also stored with the terminator
+    const auto length = (label.begin == label.end) ? 1 : label.length();
     const auto new_alloc = length + sizeof(ValueType);
     sum_bytes_ += new_alloc;
 
-    pools_[id] = make_char_array(new_alloc);
-    auto ptr = pools_[id].get();
+    auto array = make_char_array(new_alloc);
+    auto ptr = array.get();
 
-    std::memcpy(ptr, label.begin, length);
+    if (label.begin == label.end) {
+      *ptr = '\0';
+    } else {
+      std::memcpy(ptr, label.begin, length);
+    }
     ptr += length;
 
-    std::memset(ptr, 0, sizeof(ValueType));
+    std::memcpy(ptr, &value, sizeof(ValueType));
+    pools_[id].exchange(std::move(array));
     return reinterpret_cast<ValueType*>(ptr);
   }
 
+  // Appends the labels to their ids, which are given in increasing order
+  void append_sorted(const std::vector<LabelItem<ValueType>>& items) {
+    for (const auto& item : items) {
+      append(item.id, item.label, item.value);
+    }
+  }
+
+  // Marks the label of id as erased. The label itself is kept because it can be
+  // still referred by the descendants; it is released when the node is moved away.
+  void erase(uint64_t id) {
+    assert(pools_[id] && !is_erased(id));
+    set_erased_(id, true);
+    ++num_erased_;
+  }
+
+  // Unmarks the erased label of id and returns its value set to value
+  ValueType* restore(uint64_t id, const ValueType& value = ValueType()) {
+    assert(pools_[id] && is_erased(id));
+    auto ret = write_value_(id, value);
+    set_erased_(id, false);
+    --num_erased_;
+    return ret;
+  }
+
+  // Sets the value of id, returning the pointer to it
+  ValueType* set_value(uint64_t id, const ValueType& value) {
+    assert(pools_[id] && !is_erased(id));
+    return write_value_(id, value);
+  }
+
+  // Sets label to the label of id without the terminator, and returns the pointer to its value,
+  // or nullptr if id has no label. An erased label is also returned.
+  ValueType* get_label(uint64_t id, CharRange& label) const {
+    auto ptr = get_ptr_(id);
+    if (!ptr) {
+      return nullptr;
+    }
+    const auto length = label_length_(ptr);
+    label.begin = ptr;
+    label.end = ptr + length - 1;
+    return reinterpret_cast<ValueType*>(ptr + length);
+  }
+
+  bool is_erased(uint64_t id) const {
+    const auto word = mapped_offsets_ ? mapped_erased_[id / 64]
+                                      : __atomic_load_n(&erased_[id / 64], __ATOMIC_RELAXED);
+    return (word >> (id % 64)) & 1ULL;
+  }
+
+  // Labels are reached directly, without walking over others
+  uint64_t skip_length(uint64_t) const {
+    return 0;
+  }
+
+  // Prefetches for compare_and_get() in two stages since the label is reached through
+  // the pointer; prefetch_label() touches the pointer, so it should follow prefetch_ptr().
+  void prefetch_ptr(uint64_t id) const {
+    if (mapped_offsets_) {
+      __builtin_prefetch(mapped_offsets_ + id);
+    } else {
+      __builtin_prefetch(pools_.data() + id);
+    }
+  }
+  void prefetch_label(uint64_t id) const {
+    __builtin_prefetch(get_ptr_(id));
+  }
+
+  // Moves the label of id to dst_id of dst, returning false if id has no label
+  bool move_to(uint64_t id, LabelPool_Plain& dst, uint64_t dst_id) {
+    if (!pools_[id]) {
+      return false;
+    }
+    if (dst.pools_[dst_id]) {
+      std::cerr << "ERROR: already exist" << std::endl;
+      exit(1);
+    }
+
+    const auto bytes = label_length_(pools_[id].get()) + sizeof(ValueType);
+    --num_labels_;
+    sum_bytes_ -= bytes;
+    ++dst.num_labels_;
+    dst.sum_bytes_ += bytes;
+
+    if (is_erased(id)) {
+      set_erased_(id, false);
+      --num_erased_;
+      dst.set_erased_(dst_id, true);
+      ++dst.num_erased_;
+    }
+
+    dst.pools_[dst_id].exchange(pools_[id].exchange(CharArray()));
+    return true;
+  }
+
+  // Copies the label of id to dst_id of dst, returning false if id has no label
+  bool copy_to(uint64_t id, LabelPool_Plain& dst, uint64_t dst_id) const {
+    auto ptr = get_ptr_(id);
+    if (!ptr) {
+      return false;
+    }
+    if (dst.pools_[dst_id]) {
+      std::cerr << "ERROR: already exist" << std::endl;
+      exit(1);
+    }
+
+    const auto bytes = label_length_(ptr) + sizeof(ValueType);
+    ++dst.num_labels_;
+    dst.sum_bytes_ += bytes;
+
+    if (is_erased(id)) {
+      dst.set_erased_(dst_id, true);
+      ++dst.num_erased_;
+    }
+
+    auto array = make_char_array(bytes);
+    std::memcpy(array.get(), ptr, bytes);
+    dst.pools_[dst_id].exchange(std::move(array));
+    return true;
+  }
+
+  void set_reclaimer(EpochReclaimer* reclaimer) {
+    reclaimer_ = reclaimer;
+  }
+
   uint64_t num_ptrs() const {
-    return pools_.size();
+    return mapped_offsets_ ? num_mapped_ptrs_ : pools_.size();
   }
 
   uint64_t num_labels() const {
     return num_labels_;
   }
 
+  uint64_t num_erased() const {
+    return num_erased_;
+  }
+
   uint64_t sum_bytes() const {
     return sum_bytes_;
   }
 
+  // Labels are released or shifted in place, leaving no dead space
+  uint64_t dead_bytes() const {
+    return 0;
+  }
+
+  // Estimated memory of the pointers, the erased bits and the label arrays
+  uint64_t size_in_bytes() const {
+    return num_ptrs() * sizeof(uint64_t) + (num_ptrs() + 63) / 64 * sizeof(uint64_t) + sum_bytes_;
+  }
+
   void show_stat(std::ostream& os) const {
     using std::endl;
     os << "Show statistics of " << name() << endl;
     os << " - num_ptrs:\t" << num_ptrs() << endl;
     os << " - num_labels:\t" << num_labels() << endl;
+    os << " - num_erased:\t" << num_erased() << endl;
     os << " - sum_bytes:\t" << sum_bytes() << endl;
     os << " - ave_length:\t" << static_cast<double>(sum_bytes()) / num_labels() << endl;
   }
 
+  // Labels are written into a byte array with the offsets to them
+  void save(std::ostream& os) const {
+    save_value(os, num_labels_);
+    save_value(os, num_erased_);
+    save_value(os, sum_bytes_);
+
+    const auto size = num_ptrs();
+    std::vector<uint64_t> offsets(size, 0); // offset + 1 (0 means no label)
+    std::vector<uint64_t> erased((size + 63) / 64, 0);
+    std::vector<uint8_t> bytes;
+    bytes.reserve(sum_bytes_);
+
+    for (uint64_t id = 0; id < size; ++id) {
+      auto ptr = get_ptr_(id);
+      if (!ptr) {
+        continue;
+      }
+      offsets[id] = bytes.size() + 1;
+      bytes.insert(bytes.end(), ptr, ptr + label_length_(ptr) + sizeof(ValueType));
+      if (is_erased(id)) {
+        erased[id / 64] |= 1ULL << (id % 64);
+      }
+    }
+
+    save_array(os, offsets.data(), offsets.size());
+    save_array(os, erased.data(), erased.size());
+    save_array(os, bytes.data(), bytes.size());
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_labels_);
+    load_value(is, num_erased_);
+    load_value(is, sum_bytes_);
+
+    std::vector<uint64_t> offsets, erased;
+    std::vector<uint8_t> bytes;
+    load_array(is, offsets);
+    load_array(is, erased);
+    load_array(is, bytes);
+    check_labels_(offsets.data(), offsets.size(), erased.size(), bytes.data(), bytes.size());
+
+    pools_.clear();
+    pools_.resize(offsets.size());
+    erased_ = std::move(erased);
+    mapped_offsets_ = nullptr;
+
+    for (uint64_t id = 0; id < offsets.size(); ++id) {
+      if (offsets[id] == 0) {
+        continue;
+      }
+      auto ptr = bytes.data() + offsets[id] - 1;
+      const auto length = label_length_(ptr) + sizeof(ValueType);
+      auto array = make_char_array(length);
+      std::memcpy(array.get(), ptr, length);
+      pools_[id].exchange(std::move(array));
+    }
+  }
+
+  // Refers to the data written by save() without copying; modifications are no longer allowed.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_labels_);
+    map_value(ptr, end, num_erased_);
+    map_value(ptr, end, sum_bytes_);
+
+    uint64_t num_words = 0, num_bytes = 0;
+    mapped_offsets_ = map_array<uint64_t>(ptr, end, num_mapped_ptrs_);
+    mapped_erased_ = map_array<uint64_t>(ptr, end, num_words);
+    mapped_bytes_ = map_array<uint8_t>(ptr, end, num_bytes);
+    check_labels_(mapped_offsets_, num_mapped_ptrs_, num_words, mapped_bytes_, num_bytes);
+
+    pools_.clear();
+    erased_.clear();
+  }
+
   LabelPool_Plain(const LabelPool_Plain&) = delete;
   LabelPool_Plain& operator=(const LabelPool_Plain&) = delete;
 
 private:
-  std::vector<CharArray> pools_;
+  std::vector<AtomicCharArray> pools_;
+  std::vector<uint64_t> erased_; // bits
   uint64_t num_labels_ = 0;
+  uint64_t num_erased_ = 0;
   uint64_t sum_bytes_ = 0;
+  EpochReclaimer* reclaimer_ = nullptr;
+
+  // data on a mapped region
+  const uint64_t* mapped_offsets_ = nullptr;
+  const uint64_t* mapped_erased_ = nullptr;
+  const uint8_t* mapped_bytes_ = nullptr;
+  uint64_t num_mapped_ptrs_ = 0;
+
+  // The mapped region is read-only, so the returned pointer must not be written then.
+  uint8_t* get_ptr_(uint64_t id) const {
+    if (mapped_offsets_) {
+      const auto offset = mapped_offsets_[id];
+      return offset ? const_cast<uint8_t*>(mapped_bytes_ + offset - 1) : nullptr;
+    }
+    return pools_[id].get();
+  }
+
+  // Checks that the labels at the offsets given by load() or map() end in the bytes
+  static void check_labels_(const uint64_t* offsets, uint64_t num_ptrs, uint64_t num_words,
+                            const uint8_t* bytes, uint64_t num_bytes) {
+    check_consistent(num_words == (num_ptrs + 63) / 64);
+    for (uint64_t id = 0; id < num_ptrs; ++id) {
+      if (offsets[id] == 0) {
+        continue;
+      }
+      check_consistent(offsets[id] - 1 < num_bytes);
+      const auto rest = num_bytes - (offsets[id] - 1);
+      const auto length = bounded_length_(bytes + offsets[id] - 1, rest);
+      check_consistent(length <= rest && sizeof(ValueType) <= rest - length);
+    }
+  }
+
+  // Readers may be reading the value with the reclaimer set, so the array is replaced then
+  ValueType* write_value_(uint64_t id, const ValueType& value) {
+    auto ptr = pools_[id].get();
+    const auto length = label_length_(ptr);
+    if (reclaimer_) {
+      auto array = make_char_array(length + sizeof(ValueType));
+      std::memcpy(array.get(), ptr, length);
+      ptr = array.get();
+      std::memcpy(ptr + length, &value, sizeof(ValueType));
+      reclaimer_->retire(pools_[id].exchange(std::move(array)));
+    } else {
+      std::memcpy(ptr + length, &value, sizeof(ValueType));
+    }
+    return reinterpret_cast<ValueType*>(ptr + length);
+  }
+
+  void set_erased_(uint64_t id, bool erased) {
+    auto word = erased_[id / 64];
+    if (erased) {
+      word |= 1ULL << (id % 64);
+    } else {
+      word &= ~(1ULL << (id % 64));
+    }
+    __atomic_store_n(&erased_[id / 64], word, __ATOMIC_RELAXED);
+  }
+
+  // including the terminator, or max_length if longer
+  static uint64_t bounded_length_(const uint8_t* ptr, uint64_t max_length) {
+    return strnlen(reinterpret_cast<const char*>(ptr), max_length) + 1;
+  }
+
+  // including the terminator
+  static uint64_t label_length_(const uint8_t* ptr) {
+    return std::strlen(reinterpret_cast<const char*>(ptr)) + 1;
+  }
 };
 
 } // namespace - dynpdt
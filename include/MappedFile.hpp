@@ -0,0 +1,64 @@
+#ifndef DYNPDT_MAPPED_FILE_HPP
+#define DYNPDT_MAPPED_FILE_HPP
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+/*
+ * Read-only memory mapping of a file, shared among processes mapping the same file.
+ * */
+class MappedFile {
+public:
+  MappedFile(const char* file_name) {
+    fd_ = ::open(file_name, O_RDONLY);
+    if (fd_ == -1) {
+      std::cerr << "ERROR: failed to open " << file_name << std::endl;
+      exit(1);
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) == -1) {
+      std::cerr << "ERROR: failed to stat " << file_name << std::endl;
+      exit(1);
+    }
+    size_ = static_cast<uint64_t>(st.st_size);
+
+    auto addr = ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      std::cerr << "ERROR: failed to mmap " << file_name << std::endl;
+      exit(1);
+    }
+    data_ = static_cast<const uint8_t*>(addr);
+  }
+
+  ~MappedFile() {
+    ::munmap(const_cast<uint8_t*>(data_), size_);
+    ::close(fd_);
+  }
+
+  const uint8_t* data() const {
+    return data_;
+  }
+
+  uint64_t size() const {
+    return size_;
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+  int fd_ = -1;
+  const uint8_t* data_ = nullptr;
+  uint64_t size_ = 0;
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_MAPPED_FILE_HPP
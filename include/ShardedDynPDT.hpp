@@ -0,0 +1,253 @@
+#ifndef DYNPDT_SHARDED_DYNPDT_HPP
+#define DYNPDT_SHARDED_DYNPDT_HPP
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "DynPDT.hpp"
+
+namespace dynpdt {
+
+/*
+ * Keys partitioned by hashing into independent DynPDT shards, each guarded by its own lock,
+ * so that insertions into different shards run in parallel.
+ *
+ * find(), update() and erase() can be called from any thread. With Setting::concurrent,
+ * find() takes no lock since each shard allows readers alongside its writer.
+ * */
+template<typename _LabelPoolType, typename _HashType = Hash_Prime>
+class ShardedDynPDT {
+public:
+  using DicType = DynPDT<_LabelPoolType, _HashType>;
+  using ValueType = typename DicType::ValueType;
+
+  static constexpr uint64_t kBulkBatchSize = 1U << 10; // keys handed to a worker at once
+  static constexpr uint64_t kMaxQueuedBatches = 64; // per worker, bounding the memory of bulk_load()
+
+  static std::string name() {
+    return "Sharded" + DicType::name();
+  }
+
+  // setting.num_keys is of all the shards and is divided among them.
+  ShardedDynPDT(Setting setting, uint64_t num_shards) {
+    if (num_shards == 0) {
+      std::cerr << "ERROR: num_shards must be positive." << std::endl;
+      exit(1);
+    }
+
+    setting.num_keys = (setting.num_keys + num_shards - 1) / num_shards;
+    shards_.reserve(num_shards);
+    for (uint64_t i = 0; i < num_shards; ++i) {
+      shards_.emplace_back(std::make_unique<Shard>(setting));
+    }
+  }
+
+  ~ShardedDynPDT() {}
+
+  bool find(const std::string& key, ValueType& value) const {
+    const auto& shard = *shards_[get_shard_id(key)];
+    if (shard.dic.is_concurrent()) {
+      return shard.dic.find(key, value);
+    }
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.dic.find(key, value);
+  }
+
+  // Sets the value of key, inserting key if not stored. The value is published with the key,
+  // so that find() without the lock never sees the key before its value.
+  void update(const std::string& key, const ValueType& value) {
+    auto& shard = *shards_[get_shard_id(key)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.dic.update(key, value);
+  }
+
+  bool erase(const std::string& key) {
+    auto& shard = *shards_[get_shard_id(key)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return shard.dic.erase(key);
+  }
+
+  // Inserts the non-empty keys read line by line from is, setting their values to
+  // value_of(line number). The caller thread reads the keys once and fans them out to
+  // num_threads workers, each of which owns a fixed subset of the shards, so workers insert
+  // without locking. No other call may run during the loading.
+  template<typename ValueOf>
+  void bulk_load(std::istream& is, uint64_t num_threads, ValueOf value_of) {
+    num_threads = std::max<uint64_t>(1, std::min<uint64_t>(num_threads, num_shards()));
+
+    std::vector<std::unique_ptr<BatchQueue>> queues;
+    std::vector<std::thread> workers;
+    for (uint64_t t = 0; t < num_threads; ++t) {
+      queues.emplace_back(std::make_unique<BatchQueue>());
+    }
+    for (uint64_t t = 0; t < num_threads; ++t) {
+      workers.emplace_back([this, queue = queues[t].get()]() {
+        Batch batch;
+        while (queue->pop(batch)) {
+          for (const auto& item : batch) {
+            shards_[item.shard_id]->dic.update(item.key, item.value);
+          }
+        }
+      });
+    }
+
+    // Each worker collects keys into its own batch, so the keys of a shard keep their order
+    std::vector<Batch> batches(num_threads);
+    std::string line;
+    for (uint64_t line_no = 0; std::getline(is, line); ++line_no) {
+      if (line.empty()) {
+        continue;
+      }
+      const auto shard_id = get_shard_id(line);
+      const auto t = shard_id % num_threads;
+      batches[t].push_back({std::move(line), value_of(line_no), shard_id});
+      if (batches[t].size() == kBulkBatchSize) {
+        queues[t]->push(std::move(batches[t]));
+        batches[t] = Batch();
+        batches[t].reserve(kBulkBatchSize);
+      }
+    }
+
+    for (uint64_t t = 0; t < num_threads; ++t) {
+      if (!batches[t].empty()) {
+        queues[t]->push(std::move(batches[t]));
+      }
+      queues[t]->close();
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  }
+
+  template<typename ValueOf>
+  void bulk_load(const std::string& file_name, uint64_t num_threads, ValueOf value_of) {
+    std::ifstream ifs(file_name);
+    if (!ifs) {
+      std::cerr << "ERROR: failed to open " << file_name << std::endl;
+      exit(1);
+    }
+    bulk_load(ifs, num_threads, value_of);
+  }
+
+  uint64_t get_shard_id(const std::string& key) const {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (auto c : key) {
+      h = (h ^ static_cast<uint8_t>(c)) * 0x100000001b3ULL;
+    }
+    return h % shards_.size();
+  }
+
+  // Not guarded; the caller must not access the shard while others update it.
+  const DicType& get_shard(uint64_t shard_id) const {
+    return shards_[shard_id]->dic;
+  }
+  DicType& get_shard(uint64_t shard_id) {
+    return shards_[shard_id]->dic;
+  }
+
+  uint64_t num_shards() const {
+    return shards_.size();
+  }
+
+  uint64_t num_keys() const {
+    uint64_t num_keys = 0;
+    for (const auto& shard : shards_) {
+      num_keys += shard->dic.num_keys();
+    }
+    return num_keys;
+  }
+
+  void show_stat(std::ostream& os) const {
+    using std::endl;
+
+    uint64_t min_keys = UINT64_MAX, max_keys = 0;
+    uint64_t num_nodes = 0, num_slots = 0, num_rebuilds = 0;
+    for (const auto& shard : shards_) {
+      const auto& dic = shard->dic;
+      min_keys = std::min(min_keys, dic.num_keys());
+      max_keys = std::max(max_keys, dic.num_keys());
+      num_nodes += dic.get_trie()->num_nodes();
+      num_slots += dic.get_trie()->num_slots();
+      num_rebuilds += dic.num_rebuilds();
+    }
+
+    os << "Show statistics of " << name() << endl;
+    os << " - num_shards:\t" << num_shards() << endl;
+    os << " - num_keys:\t" << num_keys() << endl;
+    os << " - min_shard_keys:\t" << min_keys << endl;
+    os << " - max_shard_keys:\t" << max_keys << endl;
+    os << " - num_nodes:\t" << num_nodes << endl;
+    os << " - num_slots:\t" << num_slots << endl;
+    os << " - load_factor:\t" << static_cast<double>(num_nodes) / num_slots << endl;
+    os << " - num_rebuilds:\t" << num_rebuilds << endl;
+
+    for (uint64_t i = 0; i < shards_.size(); ++i) {
+      os << "Shard " << i << endl;
+      shards_[i]->dic.show_stat(os);
+    }
+  }
+
+  ShardedDynPDT(const ShardedDynPDT&) = delete;
+  ShardedDynPDT& operator=(const ShardedDynPDT&) = delete;
+
+private:
+  struct Shard {
+    DicType dic;
+    mutable std::mutex mutex;
+
+    Shard(Setting setting) : dic(setting) {}
+  };
+
+  struct BatchItem {
+    std::string key;
+    ValueType value;
+    uint64_t shard_id;
+  };
+  using Batch = std::vector<BatchItem>;
+
+  // Bounded queue from the reading thread to a worker
+  class BatchQueue {
+  public:
+    void push(Batch batch) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_full_.wait(lock, [this]() { return batches_.size() < kMaxQueuedBatches; });
+      batches_.push_back(std::move(batch));
+      not_empty_.notify_one();
+    }
+
+    // Returns false when the queue is closed and drained
+    bool pop(Batch& batch) {
+      std::unique_lock<std::mutex> lock(mutex_);
+      not_empty_.wait(lock, [this]() { return !batches_.empty() || closed_; });
+      if (batches_.empty()) {
+        return false;
+      }
+      batch = std::move(batches_.front());
+      batches_.pop_front();
+      not_full_.notify_one();
+      return true;
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      closed_ = true;
+      not_empty_.notify_one();
+    }
+
+  private:
+    std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<Batch> batches_;
+    bool closed_ = false;
+  };
+
+  std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_SHARDED_DYNPDT_HPP
@@ -2,33 +2,72 @@
 #define DYNPDT_SIMPLE_BONSAI_HPP
 
 #include "basics.hpp"
+#include "AuxTable.hpp"
 #include "FitVector.hpp"
+#include "Hash_Bijective.hpp"
+#include "Hash_Prime.hpp"
+#include "Stats.hpp"
 
 namespace dynpdt {
 
 /*
  *  A simple modified version of m-Bonsai (recursive) described in
  *  - Poyias and Raman, Improved practical compact dynamic tries, SPIRE, 2015.
+ *
+ *  HashType is Hash_Prime or Hash_Bijective. StatsType is NoStats or LookupStats, which counts
+ *  the probes of get_child() into the object given by set_stats().
+ *
+ *  AlphabetSize and Width1st fix the arguments of the constructor at compile time if nonzero,
+ *  so that the shifts and masks of slots are folded. Symbols are then trusted to be in range,
+ *  and the range checks of prepare_child() and add_child() are only asserted.
+ *
+ *  get_child() is safe on other threads while a single writer calls add_child() if the trie is
+ *  made with aligned slots (so that each slot is written by an atomic store) and the reclaimer
+ *  is set (so that replaced aux tables are not deleted under readers).
  * */
+template<typename _HashType = Hash_Prime, typename _StatsType = NoStats,
+         uint64_t AlphabetSize = 0, uint8_t Width1st = 0>
 class SimpleBonsai {
 public:
+  using HashType = _HashType;
+  using StatsType = _StatsType;
+
+  static constexpr uint64_t kAlphabetSize = AlphabetSize; // 0 if given at runtime
+  static constexpr uint8_t kWidth1st = Width1st; // 0 if given at runtime
+  static_assert(kWidth1st < 32, "Width1st is too large");
+
+  static constexpr uint8_t kMarkWidth = 2;
+  static constexpr uint64_t kChildMark = 1; // the other bit is for users
+
+  using SlotVector = FitVector<>;
+  using MarkVector = FitVector<kMarkWidth>;
+
   static std::string name() {
-    return "SimpleBonsai";
+    std::ostringstream oss;
+    oss << "SimpleBonsai_" << HashType::name().substr(std::strlen("Hash_"));
+    return oss.str();
   }
 
-  SimpleBonsai(uint64_t num_slots, uint64_t alphabet_size, uint8_t width_1st) {
+  SimpleBonsai() {}
+
+  // With aligned, the slot width is rounded up to a power of two so that no slot straddles chunks.
+  // With marked, kMarkWidth bits per slot hold the marks given to add_child() (see has_marks()).
+  // With blocked, slots are packed per cache line so that probing a slot touches one line;
+  // it has no effect with aligned, whose slots already never straddle lines.
+  SimpleBonsai(uint64_t num_slots, uint64_t alphabet_size, uint8_t width_1st, bool aligned = false,
+               bool marked = false, bool blocked = false) {
     num_nodes_ = 1; // for root
-    num_slots_ = num_slots;
+    num_slots_ = HashType::adjust_num_slots(num_slots);
     alphabet_size_ = alphabet_size;
     width_1st_ = width_1st;
+    check_constants_();
 
     root_id_ = num_slots_ / 2; // no reason why
 
     empty_mark_ = alphabet_size + 2; // the maximum quotient value expected + 1
     max_dsp1st_ = (1U << width_1st) - 1;
 
-    prime_ = greater_prime(alphabet_size * num_slots + num_slots - 1);
-    multiplier_ = UINT64_MAX / prime_; // TODO: support invertible
+    hasher_ = HashType(num_slots_, alphabet_size);
 
     if (num_bits(alphabet_size - 1) < num_bits(empty_mark_)) {
       std::cerr << "#bits required for alphabet_size < #bits allocated practically" << std::endl;
@@ -36,8 +75,15 @@ public:
       std::cerr << "The latter is " << uint32_t(num_bits(empty_mark_)) << std::endl;
     }
 
-    slots_ = std::make_unique<FitVector>(num_slots, num_bits(empty_mark_) + width_1st,
-                                         empty_mark_ << width_1st);
+    uint8_t slot_width = num_bits(empty_mark_) + width_1st;
+    if (aligned) {
+      slot_width = static_cast<uint8_t>(std::max(8ULL, 1ULL << num_bits(slot_width - 1U)));
+    }
+    slots_ = std::make_unique<SlotVector>(num_slots_, slot_width, empty_mark_ << width_1st,
+                                          blocked && !aligned);
+    if (marked) {
+      marks_ = std::make_unique<MarkVector>(num_slots_, +kMarkWidth);
+    }
   }
 
   ~SimpleBonsai() {}
@@ -47,50 +93,85 @@ public:
   }
 
   bool get_child(uint64_t& node_id, uint64_t symbol) const {
-    if (alphabet_size_ <= symbol) {
-      std::cerr << "ERROR: out-of-range symbol in get_child()" << std::endl;
+    return get_child(node_id, prepare_child(node_id, symbol));
+  }
+
+  // The first half of get_child(), which hashes the transition and prefetches the slot
+  // to be probed. Batched lookups interleave other work before get_child(node_id, hv).
+  HashValue prepare_child(uint64_t node_id, uint64_t symbol) const {
+    assert(symbol < alphabet_size_);
+    if (!kAlphabetSize && alphabet_size_ <= symbol) {
+      std::cerr << "ERROR: out-of-range symbol in prepare_child()" << std::endl;
       exit(1);
     }
 
     const auto hv = hash_(node_id, symbol);
-    if (empty_mark_ <= hv.quo) {
-      std::cerr << "ERROR: out-of-range hv.quo in get_child()" << std::endl;
+    assert(hv.quo < empty_quo_());
+    if (!kAlphabetSize && empty_mark_ <= hv.quo) {
+      std::cerr << "ERROR: out-of-range hv.quo in prepare_child()" << std::endl;
       exit(1);
     }
 
-    for (uint64_t pos = hv.rem, cnt = 0;; pos = next_(pos), ++cnt) {
+    slots_->prefetch(hv.rem);
+    return hv;
+  }
+
+  bool get_child(uint64_t& node_id, HashValue hv) const {
+    auto scanner = slots_->scan(hv.rem);
+    for (uint64_t pos = hv.rem, cnt = 0;; next_(pos, scanner), ++cnt) {
       if (pos == root_id_) {
         continue;
       }
-      const auto quo = get_quo_(pos);
-      if (quo == empty_mark_) {
+      const auto slot = load_slot_(scanner);
+      const auto quo = slot >> dsp_width_();
+      if (quo == empty_quo_()) {
+        if (StatsType::kEnabled && stats_) {
+          stats_->count_get_child(cnt, false);
+        }
         return false;
       }
-      if (quo == hv.quo && get_dsp_(pos) == cnt) { // already registered?
+      if (quo != hv.quo) {
+        continue;
+      }
+      if (StatsType::kEnabled && stats_ && dsp_mask_() <= (slot & dsp_mask_())) {
+        stats_->count_aux_lookup();
+      }
+      if (get_dsp_(pos, slot) == cnt) { // already registered?
+        if (StatsType::kEnabled && stats_) {
+          stats_->count_get_child(cnt, true);
+        }
         node_id = pos;
         return true;
       }
     }
   }
 
-  bool add_child(uint64_t& node_id, uint64_t symbol) {
-    if (alphabet_size_ <= symbol) {
+  // The parent node_id is marked with kChildMark and marks if the child is added
+  bool add_child(uint64_t& node_id, uint64_t symbol, uint64_t marks = 0) {
+    assert(symbol < alphabet_size_);
+    if (!kAlphabetSize && alphabet_size_ <= symbol) {
       std::cerr << "ERROR: out-of-range symbol in add_child()" << std::endl;
       exit(1);
     }
 
     const auto hv = hash_(node_id, symbol);
-    if (empty_mark_ <= hv.quo) {
+    assert(hv.quo < empty_quo_());
+    if (!kAlphabetSize && empty_mark_ <= hv.quo) {
       std::cerr << "ERROR: out-of-range hv.quo in add_child()" << std::endl;
       exit(1);
     }
 
-    for (uint64_t pos = hv.rem, cnt = 0;; pos = next_(pos), ++cnt) {
+    auto scanner = slots_->scan(hv.rem);
+    for (uint64_t pos = hv.rem, cnt = 0;; next_(pos, scanner), ++cnt) {
       if (pos == root_id_) {
         continue;
       }
-      const uint64_t quo = get_quo_(pos);
-      if (quo == empty_mark_) {
+      const auto slot = scanner.get();
+      const uint64_t quo = slot >> dsp_width_();
+      if (quo == empty_quo_()) {
+        if (marks_) {
+          marks_->set(node_id, marks_->get(node_id) | kChildMark | marks);
+        }
         update_slot_(pos, hv.quo, cnt);
         node_id = pos;
         ++num_nodes_;
@@ -100,13 +181,42 @@ public:
         }
         return true;
       }
-      if (quo == hv.quo && get_dsp_(pos) == cnt) { // already registered?
+      if (quo == hv.quo && get_dsp_(pos, slot) == cnt) { // already registered?
         node_id = pos;
         return false;
       }
     }
   }
 
+  // Restores the parent and the symbol of a non-root node by inverting hash_()
+  uint64_t get_parent(uint64_t node_id, uint64_t& symbol) const {
+    assert(node_id != root_id_ && is_used(node_id));
+
+    const auto dsp = get_dsp_(node_id);
+    assert(dsp < num_slots_);
+
+    const auto rem = (node_id + num_slots_ - dsp) % num_slots_;
+    return hasher_.unhash({rem, get_quo_(node_id)}, symbol);
+  }
+
+  // Returns false if node_id surely has no child added with marks. Without marks, it is always
+  // true; with them, it can also be true for a node whose children have been dropped.
+  bool has_marks(uint64_t node_id, uint64_t marks) const {
+    return !marks_ || (marks_->get(node_id) & marks) == marks;
+  }
+
+  bool has_children(uint64_t node_id) const {
+    return has_marks(node_id, kChildMark);
+  }
+
+  bool is_marked() const {
+    return marks_ != nullptr;
+  }
+
+  bool is_used(uint64_t node_id) const {
+    return node_id == root_id_ || get_quo_(node_id) != empty_quo_();
+  }
+
   uint64_t num_slots() const {
     return num_slots_;
   }
@@ -114,39 +224,118 @@ public:
     return num_nodes_;
   }
 
+  uint64_t size_in_bytes() const {
+    return slots_->size_in_bytes() + aux_table_.size_in_bytes()
+           + (marks_ ? marks_->size_in_bytes() : 0);
+  }
+
   double average_dsp() const {
     uint64_t num_used_slots = 0, sum_dsp = 0;
-    for (uint64_t i = 0; i < num_slots_; ++i) {
-      if (get_quo_(i) != empty_mark_) {
+    auto scanner = slots_->scan(0);
+    for (uint64_t i = 0; i < num_slots_; ++i, scanner.next()) {
+      const auto slot = scanner.get();
+      if ((slot >> dsp_width_()) != empty_quo_()) {
         ++num_used_slots;
-        sum_dsp += get_dsp_(i);
+        sum_dsp += get_dsp_(i, slot);
       }
     }
     return double(sum_dsp) / num_used_slots;
   }
 
+  void set_reclaimer(EpochReclaimer* reclaimer) {
+    aux_table_.set_reclaimer(reclaimer);
+    concurrent_ = reclaimer != nullptr;
+  }
+
+  void set_stats(StatsType* stats) {
+    stats_ = stats;
+  }
+
   void show_stat(std::ostream& os) const {
     using std::endl;
     os << "Show statistics of " << name() << endl;
     os << " - num_nodes:\t" << num_nodes() << endl;
     os << " - num_slots:\t" << num_slots() << endl;
-    os << " - num_auxs:\t" << aux_map_.size() << endl;
+    os << " - num_auxs:\t" << aux_table_.size() << endl;
+    os << " - num_auxs_2nd:\t" << aux_table_.size_2nd() << endl;
+    os << " - num_auxs_3rd:\t" << aux_table_.size_3rd() << endl;
     os << " - load_factor:\t" << static_cast<double>(num_nodes_) / num_slots() << endl;
     os << " - slot_width:\t" << static_cast<uint32_t>(slots_->width()) << endl;
+    os << " - blocked_slots:\t" << (slots_->is_blocked() ? "on" : "off") << endl;
     os << " - slot_memory:\t" << slots_->size_in_bytes() << endl;
-    os << " - aux_memory:\t" << estimate_map_memory(aux_map_) << endl;
+    os << " - aux_memory:\t" << aux_table_.size_in_bytes() << endl;
+    os << " - mark_memory:\t" << (marks_ ? marks_->size_in_bytes() : 0) << endl;
     os << " - average_dsp:\t" << average_dsp() << endl;
   }
 
+  void save(std::ostream& os) const {
+    save_value(os, num_nodes_);
+    save_value(os, num_slots_);
+    save_value(os, alphabet_size_);
+    save_value(os, width_1st_);
+    save_value(os, root_id_);
+    save_value(os, empty_mark_);
+    save_value(os, max_dsp1st_);
+    hasher_.save(os);
+    slots_->save(os);
+    save_value(os, is_marked());
+    if (marks_) {
+      marks_->save(os);
+    }
+    aux_table_.save(os);
+  }
+
+  void load(std::istream& is) {
+    load_value(is, num_nodes_);
+    load_value(is, num_slots_);
+    load_value(is, alphabet_size_);
+    load_value(is, width_1st_);
+    load_value(is, root_id_);
+    load_value(is, empty_mark_);
+    load_value(is, max_dsp1st_);
+    check_constants_();
+    hasher_.load(is);
+    slots_ = std::make_unique<SlotVector>();
+    slots_->load(is);
+    bool marked = false;
+    load_value(is, marked);
+    marks_.reset();
+    if (marked) {
+      marks_ = std::make_unique<MarkVector>();
+      marks_->load(is);
+    }
+    aux_table_.load(is);
+    check_loaded_();
+  }
+
+  // Refers to the data written by save() without copying; add_child() is no longer allowed.
+  void map(const uint8_t*& ptr, const uint8_t* end) {
+    map_value(ptr, end, num_nodes_);
+    map_value(ptr, end, num_slots_);
+    map_value(ptr, end, alphabet_size_);
+    map_value(ptr, end, width_1st_);
+    map_value(ptr, end, root_id_);
+    map_value(ptr, end, empty_mark_);
+    map_value(ptr, end, max_dsp1st_);
+    check_constants_();
+    hasher_.map(ptr, end);
+    slots_ = std::make_unique<SlotVector>();
+    slots_->map(ptr, end);
+    bool marked = false;
+    map_value(ptr, end, marked);
+    marks_.reset();
+    if (marked) {
+      marks_ = std::make_unique<MarkVector>();
+      marks_->map(ptr, end);
+    }
+    aux_table_.map(ptr, end);
+    check_loaded_();
+  }
+
   SimpleBonsai(const SimpleBonsai&) = delete;
   SimpleBonsai& operator=(const SimpleBonsai&) = delete;
 
 private:
-  struct HashValue {
-    uint64_t rem;
-    uint64_t quo;
-  };
-
   uint64_t num_nodes_;
   uint64_t num_slots_;
   uint64_t alphabet_size_;
@@ -156,46 +345,96 @@ private:
   uint64_t empty_mark_;
   uint64_t max_dsp1st_; // maximum displacement value in the 1st layer
 
-  uint64_t prime_;
-  uint64_t multiplier_;
+  HashType hasher_;
+
+  std::unique_ptr<SlotVector> slots_;
+  AuxTable aux_table_; // for exceeding displacement values
+  std::unique_ptr<MarkVector> marks_; // optional bits of nodes having children
+  StatsType* stats_ = nullptr;
+  bool concurrent_ = false; // slots are published with release and read with acquire
+
+  // Checks the sizes given by load() or map() against num_slots_, which bounds the slot positions
+  void check_loaded_() const {
+    check_consistent(slots_->length() == num_slots_ && hasher_.num_slots() == num_slots_);
+    check_consistent(!marks_ || marks_->length() == num_slots_);
+    check_consistent(num_nodes_ <= num_slots_ && root_id_ < num_slots_);
+  }
+
+  void check_constants_() const {
+    if ((kAlphabetSize && alphabet_size_ != kAlphabetSize)
+        || (kWidth1st && width_1st_ != kWidth1st)) {
+      std::cerr << "ERROR: alphabet_size or width_1st differs from the template argument"
+                << std::endl;
+      exit(1);
+    }
+  }
 
-  std::unique_ptr<FitVector> slots_;
-  std::map<uint64_t, uint32_t> aux_map_; // for exceeding displacement values
+  // The template constants if given, otherwise the members
+  uint64_t empty_quo_() const {
+    return kAlphabetSize ? kAlphabetSize + 2 : empty_mark_;
+  }
+  uint8_t dsp_width_() const {
+    return kWidth1st ? kWidth1st : width_1st_;
+  }
+  uint64_t dsp_mask_() const {
+    return kWidth1st ? (1ULL << kWidth1st) - 1 : max_dsp1st_;
+  }
 
   // Expecting 0 <= quo <= alp_size + 1
   HashValue hash_(uint64_t node_id, uint64_t symbol) const {
-    uint64_t c = symbol * num_slots_ + node_id;
-    uint64_t c_rnd = ((c % prime_) * multiplier_) % prime_;
-    return {c_rnd % num_slots_, c_rnd / num_slots_};
+    return hasher_.hash(node_id, symbol);
+  }
+
+  // Moves to the next slot circularly with the scanner on it
+  void next_(uint64_t& pos, SlotVector::Scanner& scanner) const {
+    if (++pos == num_slots_) {
+      pos = 0;
+      scanner = slots_->scan(0);
+    } else {
+      scanner.next();
+    }
   }
 
-  uint64_t next_(uint64_t pos) const {
-    return ++pos >= num_slots_ ? 0 : pos;
+  // In the concurrent mode, the acquire load of a slot pairs with the release store in
+  // update_slot_(), so that a reader seeing the slot also sees its aux entry.
+  uint64_t load_slot_(const SlotVector::Scanner& scanner) const {
+    return concurrent_ ? scanner.get<__ATOMIC_ACQUIRE>() : scanner.get();
+  }
+  uint64_t load_slot_(uint64_t pos) const {
+    return concurrent_ ? slots_->get<__ATOMIC_ACQUIRE>(pos) : slots_->get(pos);
   }
 
   uint64_t get_quo_(uint64_t pos) const {
-    return slots_->get(pos) >> width_1st_;
+    return load_slot_(pos) >> dsp_width_();
   }
 
   uint64_t get_dsp_(uint64_t pos) const {
-    const auto dsp = slots_->get(pos) & max_dsp1st_;
-    if (dsp < max_dsp1st_) {
+    return get_dsp_(pos, load_slot_(pos));
+  }
+
+  // slot is the value at pos
+  uint64_t get_dsp_(uint64_t pos, uint64_t slot) const {
+    const auto dsp = slot & dsp_mask_();
+    if (dsp < dsp_mask_()) {
       return dsp;
     }
-    auto it = aux_map_.find(pos);
-    return it == aux_map_.end() ? UINT64_MAX : it->second;
+    return aux_table_.find(pos);
   }
 
   void update_slot_(uint64_t pos, uint64_t quo, uint64_t dsp) {
-    auto val = quo << width_1st_;
-    if (dsp < max_dsp1st_) {
+    auto val = quo << dsp_width_();
+    if (dsp < dsp_mask_()) {
       val |= dsp;
     } else {
-      val |= max_dsp1st_;
-      assert(aux_map_.find(pos) == aux_map_.end());
-      aux_map_.insert({pos, dsp});
+      val |= dsp_mask_();
+      // registered before the release store of the slot below publishes it
+      aux_table_.insert(pos, dsp);
+    }
+    if (concurrent_) {
+      slots_->set<__ATOMIC_RELEASE>(pos, val);
+    } else {
+      slots_->set(pos, val);
     }
-    slots_->set(pos, val);
   }
 };
 
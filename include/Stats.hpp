@@ -0,0 +1,161 @@
+#ifndef DYNPDT_STATS_HPP
+#define DYNPDT_STATS_HPP
+
+#include <atomic>
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+// Counters of the hot paths taken by lookups, copied out of LookupStats
+struct StatsSnapshot {
+  static constexpr uint64_t kNumDspBuckets = 16;
+
+  uint64_t num_finds = 0; // traversals by find_()
+  uint64_t num_steps = 0; // step nodes walked by them
+  uint64_t num_compares = 0; // labels compared by them
+  uint64_t num_label_bytes = 0; // bytes matched in the compared labels
+  uint64_t num_skips = 0; // labels walked over in groups to reach the compared ones
+  uint64_t num_get_childs = 0; // calls of get_child()
+  uint64_t num_misses = 0; // calls of get_child() finding no child
+  uint64_t num_probes = 0; // slots probed by get_child()
+  uint64_t num_aux_lookups = 0; // displacements looked up in the aux table by get_child()
+  // children found by get_child() whose displacement d has floor(log2(d + 1)) = i, or more
+  // for the last bucket
+  std::array<uint64_t, kNumDspBuckets> dsp_histogram{};
+
+  void show_stat(std::ostream& os) const {
+    using std::endl;
+    os << "Show statistics of lookups" << endl;
+    os << " - num_finds:\t" << num_finds << endl;
+    os << " - steps_per_find:\t" << ratio_(num_steps, num_finds) << endl;
+    os << " - compares_per_find:\t" << ratio_(num_compares, num_finds) << endl;
+    os << " - bytes_per_compare:\t" << ratio_(num_label_bytes, num_compares) << endl;
+    os << " - skips_per_compare:\t" << ratio_(num_skips, num_compares) << endl;
+    os << " - num_get_childs:\t" << num_get_childs << endl;
+    os << " - rate_misses:\t" << ratio_(num_misses, num_get_childs) << endl;
+    os << " - probes_per_get_child:\t" << ratio_(num_probes, num_get_childs) << endl;
+    os << " - aux_lookups_per_get_child:\t" << ratio_(num_aux_lookups, num_get_childs) << endl;
+    os << " - dsp_histogram:" << endl;
+    for (uint64_t i = 0; i < kNumDspBuckets; ++i) {
+      if (dsp_histogram[i] != 0) {
+        os << "   - " << (1ULL << i) - 1 << "-:\t" << dsp_histogram[i] << endl;
+      }
+    }
+  }
+
+private:
+  static double ratio_(uint64_t num, uint64_t den) {
+    return den ? static_cast<double>(num) / den : 0.0;
+  }
+};
+
+/*
+ * Statistics policies given to DynPDT and SimpleBonsai. Each count is guarded by kEnabled, which
+ * is a compile-time constant, so NoStats removes the counting entirely.
+ * */
+struct NoStats {
+  static constexpr bool kEnabled = false;
+
+  void count_find() {}
+  void count_step() {}
+  void count_compare(uint64_t, uint64_t) {}
+  void count_get_child(uint64_t, bool) {}
+  void count_aux_lookup() {}
+
+  StatsSnapshot snapshot() const {
+    return StatsSnapshot();
+  }
+  void reset() {}
+};
+
+// Counts with relaxed atomics, so that readers in the concurrent mode are counted as well
+class LookupStats {
+public:
+  static constexpr bool kEnabled = true;
+
+  LookupStats() {
+    reset();
+  }
+
+  void count_find() {
+    add_(num_finds_, 1);
+  }
+  void count_step() {
+    add_(num_steps_, 1);
+  }
+  void count_compare(uint64_t num_bytes, uint64_t num_skips) {
+    add_(num_compares_, 1);
+    add_(num_label_bytes_, num_bytes);
+    add_(num_skips_, num_skips);
+  }
+  // dsp is the displacement of the found child, or the number of probed slots - 1 if not found
+  void count_get_child(uint64_t dsp, bool found) {
+    add_(num_get_childs_, 1);
+    add_(num_probes_, dsp + 1);
+    if (!found) {
+      add_(num_misses_, 1);
+      return;
+    }
+    const auto bucket = std::min<uint64_t>(num_bits(dsp + 1) - 1,
+                                           StatsSnapshot::kNumDspBuckets - 1);
+    add_(dsp_histogram_[bucket], 1);
+  }
+  void count_aux_lookup() {
+    add_(num_aux_lookups_, 1);
+  }
+
+  StatsSnapshot snapshot() const {
+    StatsSnapshot ret;
+    ret.num_finds = get_(num_finds_);
+    ret.num_steps = get_(num_steps_);
+    ret.num_compares = get_(num_compares_);
+    ret.num_label_bytes = get_(num_label_bytes_);
+    ret.num_skips = get_(num_skips_);
+    ret.num_get_childs = get_(num_get_childs_);
+    ret.num_misses = get_(num_misses_);
+    ret.num_probes = get_(num_probes_);
+    ret.num_aux_lookups = get_(num_aux_lookups_);
+    for (uint64_t i = 0; i < StatsSnapshot::kNumDspBuckets; ++i) {
+      ret.dsp_histogram[i] = get_(dsp_histogram_[i]);
+    }
+    return ret;
+  }
+
+  void reset() {
+    for (auto counter : {&num_finds_, &num_steps_, &num_compares_, &num_label_bytes_,
+                         &num_skips_, &num_get_childs_, &num_misses_, &num_probes_,
+                         &num_aux_lookups_}) {
+      counter->store(0, std::memory_order_relaxed);
+    }
+    for (auto& counter : dsp_histogram_) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  LookupStats(const LookupStats&) = delete;
+  LookupStats& operator=(const LookupStats&) = delete;
+
+private:
+  std::atomic<uint64_t> num_finds_;
+  std::atomic<uint64_t> num_steps_;
+  std::atomic<uint64_t> num_compares_;
+  std::atomic<uint64_t> num_label_bytes_;
+  std::atomic<uint64_t> num_skips_;
+  std::atomic<uint64_t> num_get_childs_;
+  std::atomic<uint64_t> num_misses_;
+  std::atomic<uint64_t> num_probes_;
+  std::atomic<uint64_t> num_aux_lookups_;
+  std::array<std::atomic<uint64_t>, StatsSnapshot::kNumDspBuckets> dsp_histogram_;
+
+  static void add_(std::atomic<uint64_t>& counter, uint64_t n) {
+    counter.fetch_add(n, std::memory_order_relaxed);
+  }
+  static uint64_t get_(const std::atomic<uint64_t>& counter) {
+    return counter.load(std::memory_order_relaxed);
+  }
+};
+
+} // namespace - dynpdt
+
+#endif // DYNPDT_STATS_HPP
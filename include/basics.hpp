@@ -7,7 +7,6 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <map>
 #include <stdlib.h>
 #include <stdint.h>
 #include <cmath>
@@ -23,6 +22,58 @@ inline CharArray make_char_array(uint64_t length) {
   return CharArray(new uint8_t[length]);
 }
 
+/*
+ * Owning pointer to a char array whose replacement is published atomically, so that
+ * readers on other threads see either the old array or the new one fully written.
+ * */
+class AtomicCharArray {
+public:
+  AtomicCharArray() {}
+
+  AtomicCharArray(AtomicCharArray&& rhs) noexcept : ptr_(rhs.ptr_) {
+    rhs.ptr_ = nullptr;
+  }
+
+  AtomicCharArray& operator=(AtomicCharArray&& rhs) noexcept {
+    if (this != &rhs) {
+      delete[] ptr_;
+      ptr_ = rhs.ptr_;
+      rhs.ptr_ = nullptr;
+    }
+    return *this;
+  }
+
+  ~AtomicCharArray() {
+    delete[] ptr_;
+  }
+
+  uint8_t* get() const {
+    return __atomic_load_n(&ptr_, __ATOMIC_ACQUIRE);
+  }
+
+  explicit operator bool() const {
+    return get() != nullptr;
+  }
+
+  // Publishes array and returns the replaced one
+  CharArray exchange(CharArray array) {
+    CharArray old(ptr_);
+    __atomic_store_n(&ptr_, array.release(), __ATOMIC_RELEASE);
+    return old;
+  }
+
+  AtomicCharArray(const AtomicCharArray&) = delete;
+  AtomicCharArray& operator=(const AtomicCharArray&) = delete;
+
+private:
+  uint8_t* ptr_ = nullptr;
+};
+
+struct HashValue {
+  uint64_t rem;
+  uint64_t quo;
+};
+
 struct CharRange {
   const uint8_t* begin = nullptr;
   const uint8_t* end = nullptr;
@@ -31,6 +82,7 @@ struct CharRange {
   CharRange(const std::string& str)
     : begin(reinterpret_cast<const uint8_t*>(str.c_str())),
       end(begin + str.length() + 1) {}
+  CharRange(const uint8_t* begin, const uint8_t* end) : begin(begin), end(end) {}
 
   bool operator==(const CharRange& rhs) const {
     if (length() != rhs.length()) {
@@ -44,6 +96,14 @@ struct CharRange {
   }
 };
 
+// Label of a node with its value, given to append_sorted() of label pools
+template<typename ValueType>
+struct LabelItem {
+  uint64_t id;
+  CharRange label;
+  ValueType value;
+};
+
 inline bool is_power2(uint64_t n) {
   if (n == 0) {
     return false;
@@ -92,18 +152,138 @@ inline uint64_t greater_prime(uint64_t n) {
   return ret;
 }
 
-template<typename T, typename V>
-inline uint64_t estimate_map_memory(const std::map<T, V>& map) {
+inline uint64_t mul_mod(uint64_t a, uint64_t b, uint64_t m) {
+  return static_cast<uint64_t>(static_cast<unsigned __int128>(a) * b % m);
+}
+
+// Returns x such that a * x = 1 (mod m), assuming gcd(a, m) = 1
+inline uint64_t mod_inverse(uint64_t a, uint64_t m) {
+  __int128 t = 0, new_t = 1;
+  __int128 r = m, new_r = a % m;
+  while (new_r != 0) {
+    const auto q = r / new_r;
+    std::swap(t, new_t);
+    new_t -= q * t;
+    std::swap(r, new_r);
+    new_r -= q * r;
+  }
+  assert(r == 1);
+  return static_cast<uint64_t>(t < 0 ? t + m : t);
+}
+
+/*
+ * Serialization. Every item is padded to 8 bytes so that arrays can be used
+ * directly on a memory-mapped file.
+ * */
+inline uint64_t pad_size(uint64_t bytes) {
+  return (bytes + 7) / 8 * 8;
+}
+
+// Exits if the stream failed to give the bytes, as a truncated or corrupt file does
+inline void check_loaded(const std::istream& is) {
+  if (!is) {
+    std::cerr << "ERROR: failed to load, since the data is truncated or corrupt" << std::endl;
+    exit(1);
+  }
+}
+
+// Exits if fewer than num items of unit bytes are left in [ptr, end)
+inline void check_mapped(const uint8_t* ptr, const uint8_t* end, uint64_t num, uint64_t unit = 1) {
+  if (end < ptr || static_cast<uint64_t>(end - ptr) / unit < num) {
+    std::cerr << "ERROR: failed to map, since the data is truncated or corrupt" << std::endl;
+    exit(1);
+  }
+}
+
+// Exits unless the loaded or mapped data is consistent, which a corrupt file can break
+inline void check_consistent(bool consistent) {
+  if (!consistent) {
+    std::cerr << "ERROR: failed to load, since the data is corrupt" << std::endl;
+    exit(1);
+  }
+}
+
+template<typename T>
+inline void save_value(std::ostream& os, const T& val) {
   static_assert(std::is_pod<T>::value, "T must be POD");
-  static_assert(std::is_pod<V>::value, "V must be POD");
+  static_assert(sizeof(T) <= 8, "sizeof(T) must be at most 8");
+  uint64_t buf = 0;
+  std::memcpy(&buf, &val, sizeof(T));
+  os.write(reinterpret_cast<const char*>(&buf), sizeof(buf));
+}
 
-  uint64_t ret = 0;
-#if (defined(__GNUC__) || defined(__GNUG__)) && !(defined(__clang__) || defined(__INTEL_COMPILER))
-  // http://d.hatena.ne.jp/ny23/20111129/p1
-  ret = sizeof(std::_Rb_tree_node<typename std::map<T, V>::value_type>) * map.size();
-#endif
-  return ret;
-};
+template<typename T>
+inline void load_value(std::istream& is, T& val) {
+  static_assert(std::is_pod<T>::value, "T must be POD");
+  static_assert(sizeof(T) <= 8, "sizeof(T) must be at most 8");
+  uint64_t buf = 0;
+  is.read(reinterpret_cast<char*>(&buf), sizeof(buf));
+  check_loaded(is);
+  std::memcpy(&val, &buf, sizeof(T));
+}
+
+// Reads the value at ptr, which is bounded by end
+template<typename T>
+inline void map_value(const uint8_t*& ptr, const uint8_t* end, T& val) {
+  check_mapped(ptr, end, sizeof(uint64_t));
+  std::memcpy(&val, ptr, sizeof(T));
+  ptr += sizeof(uint64_t);
+}
+
+template<typename T>
+inline void save_array(std::ostream& os, const T* data, uint64_t size) {
+  static_assert(std::is_pod<T>::value, "T must be POD");
+  save_value(os, size);
+  os.write(reinterpret_cast<const char*>(data), sizeof(T) * size);
+  const uint64_t zeros = 0;
+  os.write(reinterpret_cast<const char*>(&zeros), pad_size(sizeof(T) * size) - sizeof(T) * size);
+}
+
+template<typename T>
+inline void load_array(std::istream& is, std::vector<T>& vec) {
+  static_assert(std::is_pod<T>::value, "T must be POD");
+  uint64_t size = 0;
+  load_value(is, size);
+
+  // Grown as the elements are read, so that a corrupt size does not allocate at once
+  const uint64_t max_step = (1ULL << 20) / sizeof(T) + 1;
+  vec.clear();
+  while (vec.size() < size) {
+    const auto pos = vec.size();
+    const auto step = std::min(size - pos, max_step);
+    vec.resize(pos + step);
+    is.read(reinterpret_cast<char*>(vec.data() + pos), sizeof(T) * step);
+    check_loaded(is);
+  }
+  is.ignore(pad_size(sizeof(T) * size) - sizeof(T) * size);
+  check_loaded(is);
+}
+
+template<typename T>
+inline const T* map_array(const uint8_t*& ptr, const uint8_t* end, uint64_t& size) {
+  map_value(ptr, end, size);
+  check_mapped(ptr, end, size, sizeof(T));
+  check_mapped(ptr, end, pad_size(sizeof(T) * size));
+  auto data = reinterpret_cast<const T*>(ptr);
+  ptr += pad_size(sizeof(T) * size);
+  return data;
+}
+
+inline void save_string(std::ostream& os, const std::string& str) {
+  save_array(os, str.data(), str.size());
+}
+
+inline std::string load_string(std::istream& is) {
+  std::vector<char> vec;
+  load_array(is, vec);
+  return std::string(vec.begin(), vec.end());
+}
+
+inline std::string map_string(const uint8_t*& ptr, const uint8_t* end) {
+  uint64_t size = 0;
+  auto data = map_array<char>(ptr, end, size);
+  return std::string(data, size);
+}
 
 } // namespace - dynpdt
 
@@ -1,9 +1,12 @@
 #ifndef DYNPDT_BIT_TOOLS_HPP
 #define DYNPDT_BIT_TOOLS_HPP
 
-#include <popcntintrin.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "basics.hpp"
+#include "cpu_features.hpp"
 #include "dynpdt_config.hpp"
 
 namespace dynpdt {
@@ -80,51 +83,104 @@ inline void set_bit(uint64_t& x, uint64_t i) {
 }
 
 /*
- * Popcount
+ * Clears a bit
  * */
-inline uint64_t popcount(uint8_t x) {
-  return kPopcountTable16[x];
+inline void clear_bit(uint8_t& x, uint64_t i) {
+  assert(i < 8);
+  x &= ~(1U << i);
 }
-inline uint64_t popcount(uint16_t x) {
-  return kPopcountTable16[x];
+inline void clear_bit(uint16_t& x, uint64_t i) {
+  assert(i < 16);
+  x &= ~(1U << i);
 }
-inline uint64_t popcount(uint32_t x) {
-#ifdef DYNPDT_USE_POPCNT
-  return _mm_popcnt_u32(x);
-#else
-  return kPopcountTable16[x & UINT16_MAX] + kPopcountTable16[(x >> 16) & UINT16_MAX];
-#endif
+inline void clear_bit(uint32_t& x, uint64_t i) {
+  assert(i < 32);
+  x &= ~(1U << i);
 }
-inline uint64_t popcount(uint64_t x) {
-#ifdef DYNPDT_USE_POPCNT
-  return _mm_popcnt_u64(x);
-#else
+inline void clear_bit(uint64_t& x, uint64_t i) {
+  assert(i < 64);
+  x &= ~(1ULL << i);
+}
+
+/*
+ * Popcount kernels. popcount_table() needs no CPU feature but occupies 64 KiB of cache,
+ * popcount_swar() computes with bit operations, and popcount_hw() is the instruction.
+ * */
+inline uint64_t popcount_table(uint64_t x) {
   return kPopcountTable16[x & UINT16_MAX] + kPopcountTable16[(x >> 16) & UINT16_MAX]
          + kPopcountTable16[(x >> 32) & UINT16_MAX] + kPopcountTable16[(x >> 48) & UINT16_MAX];
-#endif
 }
 
+inline uint64_t popcount_swar(uint64_t x) {
+  x = x - ((x >> 1) & 0x5555555555555555ULL);
+  x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+  x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+  return (x * 0x0101010101010101ULL) >> 56;
+}
+
+#if defined(__x86_64__)
+// In assembly, so that they are inlined into code built without -mpopcnt or -mbmi2
+inline uint64_t popcount_hw(uint64_t x) {
+  uint64_t count;
+  __asm__("popcntq %1, %0" : "=r"(count) : "r"(x) : "cc");
+  return count;
+}
+
+// of the lower i bits by BZHI
+inline uint64_t popcount_hw(uint64_t x, uint64_t i) {
+  uint64_t masked;
+  __asm__("bzhiq %2, %1, %0" : "=r"(masked) : "r"(x), "r"(i) : "cc");
+  return popcount_hw(masked);
+}
+#endif
+
 /*
- * Masked Popcount
+ * Popcount, by the instruction if the build enables it or the running CPU has it
  * */
-inline uint64_t popcount(uint8_t x, uint64_t i) {
-  assert(i < 8);
-  return kPopcountTable16[x & ((1U << i) - 1)];
+inline uint64_t popcount(uint64_t x) {
+#if defined(DYNPDT_USE_POPCNT)
+  return _mm_popcnt_u64(x);
+#elif defined(__x86_64__)
+  return cpu_features::has_popcnt() ? popcount_hw(x) : popcount_swar(x);
+#else
+  return __builtin_popcountll(x);
+#endif
 }
-inline uint64_t popcount(uint16_t x, uint64_t i) {
-  assert(i < 16);
-  return kPopcountTable16[x & ((1U << i) - 1)];
+inline uint64_t popcount(uint32_t x) {
+  return popcount(static_cast<uint64_t>(x));
 }
-inline uint64_t popcount(uint32_t x, uint64_t i) {
-  assert(i < 32);
-  uint32_t masked = x & ((1U << i) - 1);
-  return popcount(masked);
+inline uint64_t popcount(uint16_t x) {
+  return popcount(static_cast<uint64_t>(x));
 }
+inline uint64_t popcount(uint8_t x) {
+  return popcount(static_cast<uint64_t>(x));
+}
+
+/*
+ * Masked Popcount, i.e., rank of the lower i bits
+ * */
 inline uint64_t popcount(uint64_t x, uint64_t i) {
   assert(i < 64);
+#if !defined(DYNPDT_USE_POPCNT) && defined(__x86_64__)
+  if (cpu_features::has_bmi2() && cpu_features::has_popcnt()) {
+    return popcount_hw(x, i);
+  }
+#endif
   uint64_t masked = x & ((1ULL << i) - 1);
   return popcount(masked);
 }
+inline uint64_t popcount(uint32_t x, uint64_t i) {
+  assert(i < 32);
+  return popcount(static_cast<uint64_t>(x), i);
+}
+inline uint64_t popcount(uint16_t x, uint64_t i) {
+  assert(i < 16);
+  return popcount(static_cast<uint64_t>(x), i);
+}
+inline uint64_t popcount(uint8_t x, uint64_t i) {
+  assert(i < 8);
+  return popcount(static_cast<uint64_t>(x), i);
+}
 
 } // namespace - bit_tools
 } // namespace - dynpdt
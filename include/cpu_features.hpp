@@ -0,0 +1,58 @@
+#ifndef DYNPDT_CPU_FEATURES_HPP
+#define DYNPDT_CPU_FEATURES_HPP
+
+namespace dynpdt {
+namespace cpu_features {
+
+/*
+ * Instruction sets of the running CPU, detected once at start-up so that a single binary picks
+ * the fastest kernels on any x86-64 machine. They are read as plain flags on hot paths.
+ * Before the detection, i.e., in other static initializers, every feature is reported absent.
+ * */
+enum class Feature {
+  POPCNT, BMI2, AVX2
+};
+
+inline bool detect_(Feature feature) {
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  switch (feature) {
+    case Feature::POPCNT:
+      return __builtin_cpu_supports("popcnt");
+    case Feature::BMI2:
+      return __builtin_cpu_supports("bmi2");
+    case Feature::AVX2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi");
+  }
+#endif
+  return false;
+}
+
+template <typename Dummy = void>
+struct Flags {
+  static const bool popcnt;
+  static const bool bmi2;
+  static const bool avx2;
+};
+
+template <typename Dummy> const bool Flags<Dummy>::popcnt = detect_(Feature::POPCNT);
+template <typename Dummy> const bool Flags<Dummy>::bmi2 = detect_(Feature::BMI2);
+template <typename Dummy> const bool Flags<Dummy>::avx2 = detect_(Feature::AVX2);
+
+inline bool has_popcnt() {
+  return Flags<>::popcnt;
+}
+
+inline bool has_bmi2() {
+  return Flags<>::bmi2;
+}
+
+// with BMI1 for TZCNT
+inline bool has_avx2() {
+  return Flags<>::avx2;
+}
+
+} // namespace - cpu_features
+} // namespace - dynpdt
+
+#endif // DYNPDT_CPU_FEATURES_HPP
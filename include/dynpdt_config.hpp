@@ -0,0 +1,6 @@
+#ifndef DYNPDT_CONFIG_HPP
+#define DYNPDT_CONFIG_HPP
+
+/* #undef DYNPDT_USE_POPCNT */
+
+#endif // DYNPDT_CONFIG_HPP
@@ -0,0 +1,100 @@
+#ifndef DYNPDT_KEY_CODEC_HPP
+#define DYNPDT_KEY_CODEC_HPP
+
+#include "basics.hpp"
+
+namespace dynpdt {
+
+/*
+ * Encodings of binary and integer keys into strings without zero bytes, which DynPDT uses as the
+ * terminator. Both keep the order of keys, so encoded keys sorted for DynPDT::build() are in the
+ * order of the raw ones. A prefix of a binary key is encoded into a prefix of its encoding, so the
+ * prefix searches work on encoded binary keys.
+ *
+ * DynPDT codes at most kLabelMax distinct bytes of keys including the terminator, so the
+ * encoded keys use only the 251 bytes from kMinByte: a byte less than kMinPlain is escaped by
+ * kEscape followed by the byte plus kMinPlain. Integers are written in ten 7-bit digits from the
+ * most significant one, each in a byte with the top bit, so that all of them have kIntLength.
+ * */
+namespace key_codec {
+
+constexpr uint8_t kEscape = 0x05;
+constexpr uint8_t kMinByte = kEscape;
+constexpr uint8_t kMinPlain = kEscape + 1;
+constexpr uint64_t kIntLength = 10; // ceil(64 / 7)
+
+inline uint64_t encoded_size(const uint8_t* data, uint64_t size) {
+  uint64_t n = size;
+  for (uint64_t i = 0; i < size; ++i) {
+    n += data[i] < kMinPlain;
+  }
+  return n;
+}
+
+inline void encode_bytes(const uint8_t* data, uint64_t size, std::string& key) {
+  key.resize(encoded_size(data, size));
+  auto codes = reinterpret_cast<uint8_t*>(&key[0]);
+  for (uint64_t i = 0; i < size; ++i) {
+    if (data[i] < kMinPlain) {
+      *codes++ = kEscape;
+      *codes++ = static_cast<uint8_t>(data[i] + kMinPlain);
+    } else {
+      *codes++ = data[i];
+    }
+  }
+}
+
+// Returns false if key is not made by encode_bytes()
+inline bool decode_bytes(const std::string& key, std::string& bytes) {
+  bytes.clear();
+  bytes.reserve(key.size());
+  for (uint64_t i = 0; i < key.size(); ++i) {
+    const auto code = static_cast<uint8_t>(key[i]);
+    if (code == kEscape) {
+      if (++i == key.size() || static_cast<uint8_t>(key[i]) < kMinPlain
+          || static_cast<uint8_t>(key[i]) >= 2 * kMinPlain) {
+        return false;
+      }
+      bytes += static_cast<char>(static_cast<uint8_t>(key[i]) - kMinPlain);
+    } else if (code < kMinByte) {
+      return false;
+    } else {
+      bytes += static_cast<char>(code);
+    }
+  }
+  return true;
+}
+
+// Writes kIntLength bytes to codes
+inline void encode_int(uint64_t val, uint8_t* codes) {
+  for (uint64_t i = 0; i < kIntLength; ++i) {
+    codes[i] = static_cast<uint8_t>(0x80U | ((val >> (7 * (kIntLength - 1 - i))) & 127ULL));
+  }
+}
+
+inline uint64_t decode_int(const uint8_t* codes) {
+  uint64_t val = 0;
+  for (uint64_t i = 0; i < kIntLength; ++i) {
+    val = (val << 7) | (codes[i] & 127ULL);
+  }
+  return val;
+}
+
+// Returns false if key is not made by encode_int()
+inline bool decode_int(const std::string& key, uint64_t& val) {
+  if (key.size() != kIntLength) {
+    return false;
+  }
+  auto codes = reinterpret_cast<const uint8_t*>(key.data());
+  if (!std::all_of(codes, codes + kIntLength, [](uint8_t c) { return (c & 0x80U) != 0; })
+      || 1 < (codes[0] & 127U)) {
+    return false;
+  }
+  val = decode_int(codes);
+  return true;
+}
+
+} // namespace - key_codec
+} // namespace - dynpdt
+
+#endif // DYNPDT_KEY_CODEC_HPP
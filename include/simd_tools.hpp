@@ -0,0 +1,88 @@
+#ifndef DYNPDT_SIMD_TOOLS_HPP
+#define DYNPDT_SIMD_TOOLS_HPP
+
+#include "basics.hpp"
+#include "cpu_features.hpp"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace dynpdt {
+namespace simd_tools {
+
+using MismatchKernel = uint64_t (*)(const uint8_t*, const uint8_t*, uint64_t);
+
+constexpr uint64_t kMinVectorLength = 16; // shorter ranges are compared in scalar
+constexpr uint64_t kMinDispatchLength = 128; // shorter ranges are compared in SSE2 without dispatch
+
+/*
+ * Kernels returning the position of the first byte that differs in [0, n), or n if none.
+ * All of them read exactly n bytes from each side.
+ * */
+inline uint64_t mismatch_scalar(const uint8_t* a, const uint8_t* b, uint64_t n) {
+  for (uint64_t i = 0; i < n; ++i) {
+    if (a[i] != b[i]) {
+      return i;
+    }
+  }
+  return n;
+}
+
+#if defined(__x86_64__)
+
+inline uint64_t mismatch_sse2(const uint8_t* a, const uint8_t* b, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+    const auto y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+    const auto mask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(x, y))) & 0xFFFFU;
+    if (mask) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+  return i + mismatch_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2,bmi")))
+inline uint64_t mismatch_avx2(const uint8_t* a, const uint8_t* b, uint64_t n) {
+  uint64_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const auto y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    const auto mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+    if (mask) {
+      return i + _tzcnt_u32(mask);
+    }
+  }
+  return i + mismatch_sse2(a + i, b + i, n - i);
+}
+
+#endif
+
+// The fastest kernel on the running CPU
+inline MismatchKernel select_mismatch() {
+#if defined(__x86_64__)
+  return cpu_features::has_avx2() ? mismatch_avx2 : mismatch_sse2;
+#else
+  return mismatch_scalar;
+#endif
+}
+
+inline uint64_t mismatch(const uint8_t* a, const uint8_t* b, uint64_t n) {
+  if (n < kMinVectorLength) {
+    return mismatch_scalar(a, b, n);
+  }
+#if defined(__x86_64__)
+  if (n < kMinDispatchLength) {
+    return mismatch_sse2(a, b, n);
+  }
+#endif
+  static const auto kernel = select_mismatch();
+  return kernel(a, b, n);
+}
+
+} // namespace - simd_tools
+} // namespace - dynpdt
+
+#endif // DYNPDT_SIMD_TOOLS_HPP
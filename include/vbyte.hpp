@@ -26,6 +26,11 @@ inline uint64_t encode(uint8_t* codes, uint64_t val) {
 }
 
 inline uint64_t decode(const uint8_t* codes, uint64_t& val) {
+  // Most labels are shorter than 128 bytes
+  if (!(codes[0] & 0x80U)) {
+    val = codes[0];
+    return 1;
+  }
   val = 0;
   uint64_t i = 0, shift = 0;
   while (codes[i] & 0x80ULL) {
@@ -36,7 +41,46 @@ inline uint64_t decode(const uint8_t* codes, uint64_t& val) {
   return i;
 }
 
+// Decodes as decode() but reads at most size bytes, returning 0 if the code does not end in them
+inline uint64_t decode_bounded(const uint8_t* codes, uint64_t size, uint64_t& val) {
+  uint64_t i = 0;
+  while (i < size && i < 10 && (codes[i] & 0x80U)) {
+    ++i;
+  }
+  if (i == size || i == 10) {
+    return 0;
+  }
+  return decode(codes, val);
+}
+
 } // namespace - vbyte
+
+struct ByteSpan {
+  const uint8_t* data;
+  uint64_t size;
+};
+
+/*
+ * Value type for a byte string of any length, stored with its length in vbyte. A pointer to it
+ * refers to the first byte of the encoding, which is zero for the empty string, and span() reads
+ * the string. Supported by LabelPool_Arena. It must be referred to in place, never copied.
+ * */
+struct VarBytes {
+  uint8_t head;
+
+  ByteSpan span() const {
+    uint64_t size = 0;
+    const auto data = &head + vbyte::decode(&head, size);
+    return {data, size};
+  }
+
+  // including the length
+  uint64_t encoded_size() const {
+    const auto span = this->span();
+    return static_cast<uint64_t>(span.data - &head) + span.size;
+  }
+};
+
 } // namespace - dynpdt
 
 #endif // DYNPDT_VBYTE_HPP
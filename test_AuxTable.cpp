@@ -0,0 +1,80 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+#include <AuxTable.hpp>
+
+using namespace dynpdt;
+
+namespace {
+
+void check(const AuxTable& table, const std::vector<std::pair<uint64_t, uint64_t>>& entries,
+           uint64_t num_3rd) {
+  assert(table.size() == entries.size());
+  assert(table.size_3rd() == num_3rd);
+  for (const auto& entry : entries) {
+    assert(table.find(entry.first) == entry.second);
+    assert(table.find(entry.first + 1) == UINT64_MAX); // positions are even
+  }
+
+  uint64_t num_visited = 0;
+  table.for_each([&](uint64_t pos, uint64_t dsp) {
+    assert(table.find(pos) == dsp);
+    ++num_visited;
+  });
+  assert(num_visited == entries.size());
+}
+
+void test(uint64_t num_entries) {
+  std::cerr << "TEST: num_entries=" << num_entries << std::endl;
+
+  std::mt19937_64 rnd(13);
+  std::vector<std::pair<uint64_t, uint64_t>> entries;
+  uint64_t num_3rd = 0;
+
+  AuxTable table;
+  for (uint64_t i = 0; i < num_entries; ++i) {
+    const auto pos = i * 2 * 1000003 % (1ULL << 40) * 2;
+    // Some exceed the 2nd layer in the displacement or the position
+    auto dsp = rnd() % 100;
+    if (i % 97 == 0) {
+      dsp += 1ULL << AuxTable::kDspBits2nd;
+      ++num_3rd;
+    }
+    const auto wide_pos = (i % 89 == 0) ? pos | (1ULL << 50) : pos;
+    if (wide_pos != pos && dsp < (1ULL << AuxTable::kDspBits2nd)) {
+      ++num_3rd;
+    }
+    table.insert(wide_pos, dsp);
+    entries.emplace_back(wide_pos, dsp);
+  }
+  check(table, entries, num_3rd);
+
+  std::stringstream ss;
+  table.save(ss);
+  const auto bytes = ss.str();
+
+  AuxTable loaded;
+  loaded.load(ss);
+  check(loaded, entries, num_3rd);
+
+  AuxTable mapped;
+  auto ptr = reinterpret_cast<const uint8_t*>(bytes.data());
+  mapped.map(ptr, ptr + bytes.size());
+  assert(ptr == reinterpret_cast<const uint8_t*>(bytes.data()) + bytes.size());
+  check(mapped, entries, num_3rd);
+  assert(mapped.size_in_bytes() == (entries.size() - num_3rd) * 8 + num_3rd * 16);
+}
+
+}
+
+int main() {
+  test(0);
+  test(1);
+  test(10000);
+
+  return 0;
+}
@@ -6,6 +6,12 @@
 #include <random>
 #include <cstring>
 #include <fstream>
+#include <sstream>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <DynPDT.hpp>
 
@@ -25,9 +31,28 @@ std::string make_key(size_t max_length = 1000) {
   return key;
 }
 
-template <typename LabelPoolType>
+// Returns the exit status of func run in a child process without its error output, or -1 if
+// the child is killed, e.g., by a segmentation fault or by the alarm of a hang
+template <typename Func>
+int run_in_child(Func func) {
+  std::cout.flush();
+  std::cerr.flush();
+  const auto pid = fork();
+  assert(pid != -1);
+  if (pid == 0) {
+    dup2(open("/dev/null", O_WRONLY), 2);
+    alarm(60);
+    func();
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
 void test(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
-  std::cerr << "TEST: " << DynPDT<LabelPoolType>::name() << std::endl;
+  std::cerr << "TEST: " << DynPDT<LabelPoolType, HashType>::name() << std::endl;
 
   Setting setting;
   setting.num_keys = keys.size();
@@ -35,7 +60,7 @@ void test(const std::vector<std::string>& keys, const std::vector<std::string>&
   setting.fixed_len = 32;
   setting.width_1st = 6;
 
-  DynPDT<LabelPoolType> dic(setting);
+  DynPDT<LabelPoolType, HashType> dic(setting);
 
   for (size_t i = 0; i < keys.size(); ++i) {
     auto ptr = dic.update(keys[i]);
@@ -60,6 +85,1082 @@ void test(const std::vector<std::string>& keys, const std::vector<std::string>&
     auto ptr = dic.find(others[i]);
     assert(!ptr);
   }
+
+  // Values are set to stored keys and inserted ones
+  for (size_t i = 0; i < keys.size(); ++i) {
+    dic.update(keys[i], i + 2);
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    dic.update(others[i], i + 3);
+  }
+  assert(dic.num_keys() == keys.size() + others.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(*dic.find(keys[i]) == i + 2);
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(*dic.find(others[i]) == i + 3);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_rebuild(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+                  bool blocked_slots = false) {
+  std::cerr << "TEST_REBUILD: " << DynPDT<LabelPoolType, HashType>::name()
+            << (blocked_slots ? " (blocked_slots)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = 0;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 3;
+  setting.max_load_factor = 0.8;
+  setting.growth_factor = 1.5;
+  setting.blocked_slots = blocked_slots;
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto ptr = dic.update(keys[i]);
+    assert(*ptr == 0);
+    *ptr = i + 1;
+
+    // also during rebuilds
+    ptr = dic.update(keys[i / 2]);
+    assert(ptr);
+    assert(*ptr == i / 2 + 1);
+  }
+  assert(dic.num_keys() == keys.size());
+  assert(0 < dic.num_rebuilds());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto ptr = dic.find(keys[i]);
+    assert(ptr);
+    assert(*ptr == i + 1);
+  }
+
+  for (size_t i = 0; i < others.size(); ++i) {
+    auto ptr = dic.find(others[i]);
+    assert(!ptr);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_handle(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  using DicType = DynPDT<LabelPoolType, HashType>;
+  std::cerr << "TEST_HANDLE: " << DicType::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = 0;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 3;
+  setting.max_load_factor = 0.8;
+  setting.growth_factor = 1.5;
+
+  DicType dic(setting);
+  assert(!dic.find_handle(keys[0]).is_valid());
+
+  std::vector<typename DicType::ValueHandle> handles(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    handles[i] = dic.update_handle(keys[i]);
+    *dic.value_at(handles[i]) = i + 1;
+
+    // A handle keeps referring to the value across inserts until a rebuild completes
+    const auto& handle = handles[i / 2];
+    auto ptr = dic.value_at(handle);
+    if (handle.generation == dic.num_rebuilds()) {
+      assert(ptr);
+      assert(*ptr == i / 2 + 1);
+    } else {
+      assert(!ptr);
+    }
+  }
+  assert(0 < dic.num_rebuilds());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    handles[i] = dic.find_handle(keys[i]);
+    assert(handles[i].is_valid());
+    assert(*dic.value_at(handles[i]) == i + 1);
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(!dic.find_handle(others[i]).is_valid());
+  }
+
+  // An erased key has no value, and the handle refers to it again once restored
+  const auto num_rebuilds = dic.num_rebuilds();
+  dic.erase(keys[0]);
+  assert(dic.num_rebuilds() != num_rebuilds || !dic.value_at(handles[0]));
+  *dic.update(keys[0]) = 1;
+  if (dic.num_rebuilds() == num_rebuilds) {
+    assert(*dic.value_at(handles[0]) == 1);
+  }
+
+  // A handle found during a rebuild refers to the value in either trie; short keys make the
+  // rebuild span many updates
+  setting.num_keys = 8;
+  setting.load_factor = 0.5;
+  DicType short_dic(setting);
+  uint64_t num_rebuilding = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *short_dic.update(std::to_string(i)) = i + 1;
+    if (!short_dic.is_rebuilding()) {
+      continue;
+    }
+    ++num_rebuilding;
+    for (size_t j : {size_t(0), i / 2, i}) {
+      const auto handle = short_dic.find_handle(std::to_string(j));
+      assert(handle.is_valid());
+      assert(*short_dic.value_at(handle) == j + 1);
+    }
+  }
+  assert(0 < num_rebuilding);
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_stats(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  using DicType = DynPDT<LabelPoolType, HashType, LookupStats>;
+  std::cerr << "TEST_STATS: " << DicType::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = 0;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 2; // to make step nodes
+  setting.width_1st = 3;
+
+  DicType dic(setting);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *dic.update(keys[i]) = i + 1;
+  }
+  dic.reset_stats();
+  assert(dic.stats().num_finds == 0);
+  assert(dic.stats().num_get_childs == 0);
+
+  size_t value = 0;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(dic.find(keys[i], value));
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(!dic.find(others[i], value));
+  }
+  std::vector<const size_t*> out;
+  dic.find_batch(keys, out);
+
+  const auto stats = dic.stats();
+  assert(stats.num_finds == keys.size() * 2 + others.size());
+  assert(stats.num_finds <= stats.num_compares);
+  assert(0 < stats.num_get_childs);
+  assert(0 < dic.num_steps() && 0 < stats.num_steps);
+  assert(stats.num_get_childs <= stats.num_probes);
+
+  uint64_t num_found = 0;
+  for (auto count : stats.dsp_histogram) {
+    num_found += count;
+  }
+  assert(num_found + stats.num_misses == stats.num_get_childs);
+
+  std::ostringstream oss;
+  dic.show_stat(oss);
+  assert(oss.str().find("Show statistics of lookups") != std::string::npos);
+
+  dic.reset_stats();
+  assert(dic.stats().num_finds == 0);
+  assert(dic.stats().dsp_histogram[0] == 0);
+
+  // NoStats counts nothing
+  DynPDT<LabelPoolType, HashType> plain_dic(setting);
+  *plain_dic.update(keys[0]) = 1;
+  assert(plain_dic.find(keys[0], value));
+  assert(plain_dic.stats().num_finds == 0);
+  assert(plain_dic.stats().num_get_childs == 0);
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_fixed(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  using DicType = FixedDynPDT<LabelPoolType, 2, 3, HashType>;
+  std::cerr << "TEST_FIXED: " << DicType::name() << std::endl;
+
+  // Zero fixed_len and width_1st take the template arguments
+  Setting setting;
+  setting.num_keys = keys.size() / 4; // to be rebuilt
+  setting.load_factor = 0.8;
+
+  DicType dic(setting);
+  assert(dic.get_setting().fixed_len == 2);
+  assert(dic.get_setting().width_1st == 3);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *dic.update(keys[i]) = i + 1;
+  }
+  assert(dic.num_keys() == keys.size());
+  assert(0 < dic.num_rebuilds());
+  assert(0 < dic.num_steps());
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    assert(dic.erase(keys[i]));
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto ptr = dic.find(keys[i]);
+    assert((i % 2 == 0) == !ptr);
+    assert(!ptr || *ptr == i + 1);
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(!dic.find(others[i]));
+  }
+
+  // tune() has no other choice
+  const std::vector<std::string> sample(keys.begin(), keys.begin() + keys.size() / 8);
+  const auto result = DicType::tune(sample, setting, TuneBudget());
+  assert(result.setting.fixed_len == 2);
+  assert(result.setting.width_1st == 3);
+
+  // Files are shared with the runtime-configured type of the same setting
+  std::stringstream ss;
+  dic.save(ss);
+  DynPDT<LabelPoolType, HashType> loaded;
+  loaded.load(ss);
+  assert(loaded.get_setting().fixed_len == 2);
+  assert(loaded.num_keys() == dic.num_keys());
+  for (size_t i = 1; i < keys.size(); i += 2) {
+    auto ptr = loaded.find(keys[i]);
+    assert(ptr && *ptr == i + 1);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_binary(bool concurrent) {
+  using DicType = DynPDT<LabelPoolType, HashType>;
+  std::cerr << "TEST_BINARY: " << DicType::name() << (concurrent ? " (concurrent)" : "")
+            << std::endl;
+
+  // 8- and 16-byte ids full of zeros, half of which are stored
+  std::mt19937_64 rnd(13);
+  std::vector<std::string> ids(4000);
+  for (auto& id : ids) {
+    id.resize((rnd() % 2) ? 8 : 16);
+    for (auto& c : id) {
+      c = static_cast<char>((rnd() % 4) ? 0 : rnd() % 256);
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  std::shuffle(ids.begin(), ids.end(), rnd);
+  const auto num_stored = ids.size() / 2;
+  auto data = [&](size_t i) { return reinterpret_cast<const uint8_t*>(ids[i].data()); };
+
+  Setting setting;
+  setting.num_keys = num_stored / 4; // to be rebuilt
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 3;
+  setting.concurrent = concurrent;
+
+  DicType dic(setting);
+  for (size_t i = 0; i < num_stored; ++i) {
+    *dic.update_binary(data(i), ids[i].size()) = i + 1;
+  }
+  assert(dic.num_keys() == num_stored);
+  for (size_t i = 0; i < num_stored; i += 3) {
+    assert(dic.erase_binary(data(i), ids[i].size()));
+  }
+  for (size_t i = 0; i < ids.size(); ++i) {
+    const bool stored = i < num_stored && i % 3 != 0;
+    size_t value = 0;
+    assert(stored == dic.find_binary(data(i), ids[i].size(), value));
+    assert(!stored || value == i + 1);
+    auto ptr = dic.find_binary(data(i), ids[i].size());
+    assert(stored == (ptr != nullptr));
+  }
+  dic.for_each([&](const std::string& key, size_t value) {
+    std::string id;
+    assert(key_codec::decode_bytes(key, id));
+    assert(id == ids[value - 1]);
+    return true;
+  });
+
+  // Encoded keys sorted in the order of the raw ones can be given to build()
+  std::vector<std::string> raws(ids.begin(), ids.end());
+  std::sort(raws.begin(), raws.end());
+  std::vector<std::string> keys(raws.size());
+  for (size_t i = 0; i < raws.size(); ++i) {
+    key_codec::encode_bytes(reinterpret_cast<const uint8_t*>(raws[i].data()), raws[i].size(),
+                            keys[i]);
+  }
+  assert(std::is_sorted(keys.begin(), keys.end()));
+  setting.concurrent = false;
+  DicType built(setting);
+  built.build(keys, [](uint64_t i) { return i + 1; });
+  for (size_t i = 0; i < raws.size(); ++i) {
+    auto ptr = built.find_binary(reinterpret_cast<const uint8_t*>(raws[i].data()),
+                                 raws[i].size());
+    assert(ptr && *ptr == i + 1);
+  }
+
+  // Sequential and random integers
+  std::vector<uint64_t> ints;
+  for (uint64_t i = 0; i < 2000; ++i) {
+    ints.push_back(i);
+    ints.push_back(rnd());
+  }
+  ints.push_back(UINT64_MAX);
+  setting.concurrent = concurrent;
+  DicType int_dic(setting);
+  for (size_t i = 0; i < ints.size(); ++i) {
+    *int_dic.update_int(ints[i]) = i + 1;
+  }
+  for (size_t i = 0; i < ints.size(); i += 5) {
+    assert(int_dic.erase_int(ints[i]));
+  }
+  assert(!int_dic.erase_int(ints[0]));
+  for (size_t i = 0; i < ints.size(); ++i) {
+    size_t value = 0;
+    assert((i % 5 != 0) == int_dic.find_int(ints[i], value));
+    assert(i % 5 == 0 || value == i + 1);
+    assert((i % 5 != 0) == (int_dic.find_int(ints[i]) != nullptr));
+  }
+  assert(!int_dic.find_int(1ULL << 40));
+  int_dic.for_each([&](const std::string& key, size_t value) {
+    uint64_t val = 0;
+    assert(key_codec::decode_int(key, val));
+    assert(val == ints[value - 1]);
+    return true;
+  });
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_tune(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  using DicType = DynPDT<LabelPoolType, HashType>;
+  std::cerr << "TEST_TUNE: " << DicType::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size();
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 1;
+
+  // Unlimited, unreachable and loose budgets
+  const auto fastest = DicType::tune(keys, setting, TuneBudget());
+  assert(fastest.within_budget);
+  assert(fastest.setting.num_keys == setting.num_keys);
+
+  TuneBudget budget;
+  budget.bytes_per_key = 1.0;
+  auto result = DicType::tune(keys, setting, budget);
+  assert(!result.within_budget);
+  assert(result.bytes_per_key <= fastest.bytes_per_key);
+
+  budget.bytes_per_key = fastest.bytes_per_key * 2.0;
+  result = DicType::tune(keys, setting, budget);
+  assert(result.within_budget);
+  assert(result.bytes_per_key <= budget.bytes_per_key);
+
+  DicType dic(setting);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *dic.update(keys[i]) = i + 1;
+  }
+  for (size_t i = 0; i < keys.size(); i += 5) {
+    dic.erase(keys[i]);
+  }
+  const auto handle = dic.find_handle(keys[1]);
+
+  budget = TuneBudget();
+  budget.ns_per_lookup = 1e9;
+  result = dic.retune(budget, keys.size() / 4);
+  assert(dic.get_setting().fixed_len == result.setting.fixed_len);
+  assert(dic.get_setting().width_1st == result.setting.width_1st);
+  assert(!dic.value_at(handle));
+
+  assert(dic.num_keys() == keys.size() - (keys.size() + 4) / 5);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto ptr = dic.find(keys[i]);
+    if (i % 5 == 0) {
+      assert(!ptr);
+    } else {
+      assert(ptr);
+      assert(*ptr == i + 1);
+    }
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(!dic.find(others[i]));
+  }
+
+  // Still dynamic after that
+  for (size_t i = 0; i < keys.size(); i += 5) {
+    *dic.update(keys[i]) = i + 1;
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(*dic.find(keys[i]) == i + 1);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_erase(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  std::cerr << "TEST_ERASE: " << DynPDT<LabelPoolType, HashType>::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 3;
+  setting.compaction_ratio = 0.1;
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *dic.update(keys[i]) = i + 1;
+    if (i % 2 == 0 && i / 2 % 3 == 0) {
+      // also during rebuilds
+      assert(dic.erase(keys[i / 2]));
+    }
+  }
+
+  for (size_t i = 0; i < others.size(); ++i) {
+    assert(!dic.erase(others[i]));
+  }
+
+  for (size_t i = 0; i < keys.size(); i += 3) {
+    assert(dic.erase(keys[i]) == (keys.size() <= i * 2));
+  }
+  assert(0 < dic.num_rebuilds());
+  assert(dic.num_keys() == keys.size() - (keys.size() + 2) / 3);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    auto ptr = dic.find(keys[i]);
+    if (i % 3 == 0) {
+      assert(!ptr);
+    } else {
+      assert(ptr);
+      assert(*ptr == i + 1);
+    }
+  }
+
+  for (size_t i = 0; i < keys.size(); i += 3) {
+    auto ptr = dic.update(keys[i]);
+    assert(*ptr == 0);
+    *ptr = i + 1;
+  }
+  for (size_t i = 0; i < keys.size(); i += 3) {
+    auto ptr = dic.find(keys[i]);
+    assert(ptr);
+    assert(*ptr == i + 1);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_serialize(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+                    bool blocked_slots = false) {
+  std::cerr << "TEST_SERIALIZE: " << DynPDT<LabelPoolType, HashType>::name()
+            << (blocked_slots ? " (blocked_slots)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 16;
+  setting.width_1st = 2;
+  setting.blocked_slots = blocked_slots;
+
+  const char* file_name = "test_DynPDT.idx";
+  {
+    DynPDT<LabelPoolType, HashType> dic(setting);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      *dic.update(keys[i]) = i + 1;
+    }
+    for (size_t i = 0; i < keys.size(); i += 5) {
+      dic.erase(keys[i]);
+    }
+    dic.save(file_name);
+  }
+
+  DynPDT<LabelPoolType, HashType> loaded, mapped;
+  loaded.load(file_name);
+  mapped.map(file_name);
+  assert(!loaded.is_read_only());
+  assert(mapped.is_read_only());
+
+  for (const auto* dic : {&loaded, &mapped}) {
+    assert(dic->num_keys() == keys.size() - (keys.size() + 4) / 5);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      auto ptr = dic->find(keys[i]);
+      if (i % 5 == 0) {
+        assert(!ptr);
+      } else {
+        assert(ptr);
+        assert(*ptr == i + 1);
+      }
+    }
+    for (size_t i = 0; i < others.size(); ++i) {
+      assert(!dic->find(others[i]));
+    }
+  }
+
+  // The loaded one is still dynamic
+  for (size_t i = 0; i < others.size(); ++i) {
+    *loaded.update(others[i]) = i + 1;
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    auto ptr = loaded.find(others[i]);
+    assert(ptr);
+    assert(*ptr == i + 1);
+  }
+
+  // A truncated file is rejected, and a corrupt one is rejected or read without crashes
+  std::string bytes;
+  {
+    std::ifstream ifs(file_name, std::ios::binary);
+    bytes.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+  }
+  const char* corrupt_name = "test_DynPDT.corrupt.idx";
+  auto try_file = [&](const std::string& data) {
+    {
+      std::ofstream ofs(corrupt_name, std::ios::binary);
+      ofs.write(data.data(), data.size());
+    }
+    std::vector<int> statuses;
+    for (bool map : {false, true}) {
+      statuses.push_back(run_in_child([&]() {
+        DynPDT<LabelPoolType, HashType> dic;
+        if (map) {
+          dic.map(corrupt_name);
+        } else {
+          dic.load(corrupt_name);
+        }
+        for (const auto& key : keys) {
+          dic.find(key);
+        }
+      }));
+    }
+    return statuses;
+  };
+  const size_t num_cuts = 16;
+  for (size_t i = 1; i < num_cuts; ++i) {
+    for (int status : try_file(bytes.substr(0, bytes.size() * i / num_cuts))) {
+      assert(status == 1);
+    }
+  }
+  const size_t num_words = bytes.size() / 8;
+  for (size_t i = 0; i < 32; ++i) {
+    auto data = bytes;
+    // The head of the file has the sizes of the arrays, and the others are spread over the rest
+    const auto word_id = i < 16 ? i * 3 : num_words * (i - 16) / 16;
+    std::memset(&data[word_id * 8], 0xFF, 8);
+    for (int status : try_file(data)) {
+      assert(status == 0 || status == 1);
+    }
+  }
+
+  std::remove(corrupt_name);
+  std::remove(file_name);
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_build(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+                bool concurrent) {
+  std::cerr << "TEST_BUILD: " << DynPDT<LabelPoolType, HashType>::name()
+            << (concurrent ? " (concurrent)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = 0;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 3;
+  setting.concurrent = concurrent;
+
+  // Prefixes of keys make keys ending at the terminators of others, and long shared parts make
+  // step nodes
+  std::vector<std::string> sorted;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    sorted.push_back(keys[i]);
+    sorted.push_back(keys[i].substr(0, keys[i].size() / 3));
+    sorted.push_back(keys[i].substr(0, keys[i].size() / 2) + "#" + std::to_string(i));
+  }
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+  dic.build(sorted, [](uint64_t i) { return i + 1; });
+  assert(dic.num_keys() == sorted.size());
+
+  // The same trie as inserting the keys in order
+  DynPDT<LabelPoolType, HashType> inserted(setting);
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    *inserted.update(sorted[i]) = i + 1;
+  }
+  assert(dic.num_steps() == inserted.num_steps());
+  assert(dic.get_trie()->num_nodes() == inserted.get_trie()->num_nodes());
+
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(sorted[i], value));
+    assert(value == i + 1);
+  }
+  std::vector<std::pair<std::string, size_t>> visited;
+  dic.for_each_prefix("", [&](const std::string& key, size_t value) {
+    visited.emplace_back(key, value);
+    return true;
+  });
+  assert(visited.size() == sorted.size());
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    assert(visited[i].first == sorted[i] && visited[i].second == i + 1);
+  }
+
+  // Still dynamic. Others can equal the prefixes in sorted, which are skipped
+  std::vector<std::string> added;
+  for (const auto& other : others) {
+    if (!std::binary_search(sorted.begin(), sorted.end(), other)) {
+      added.push_back(other);
+    }
+  }
+  for (size_t i = 0; i < added.size(); ++i) {
+    *dic.update(added[i]) = i + 1;
+  }
+  for (size_t i = 0; i < sorted.size(); i += 2) {
+    assert(dic.erase(sorted[i]));
+  }
+  for (size_t i = 0; i < sorted.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(sorted[i], value) == (i % 2 == 1));
+    assert(i % 2 == 0 || value == i + 1);
+  }
+  for (size_t i = 0; i < added.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(added[i], value));
+    assert(value == i + 1);
+  }
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_find_batch(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  std::cerr << "TEST_FIND_BATCH: " << DynPDT<LabelPoolType, HashType>::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 32;
+  setting.width_1st = 6;
+  setting.max_load_factor = 0.5; // so that the rebuild takes several updates
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+
+  std::vector<std::string> queries(keys);
+  queries.insert(queries.end(), others.begin(), others.end());
+  std::shuffle(queries.begin(), queries.end(), std::mt19937());
+
+  auto check = [&]() {
+    std::vector<const size_t*> out;
+    dic.find_batch(queries, out);
+    assert(out.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+      assert(out[i] == dic.find(queries[i]));
+    }
+  };
+
+  bool checked_rebuilding = false;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    *dic.update(keys[i]) = i + 1;
+    if (dic.is_rebuilding() && !checked_rebuilding) {
+      check();
+      checked_rebuilding = true;
+    }
+  }
+  assert(checked_rebuilding);
+
+  for (size_t i = 0; i < keys.size(); i += 5) {
+    assert(dic.erase(keys[i]));
+  }
+  while (dic.is_rebuilding()) {
+    dic.update(keys[1]);
+  }
+  check();
+
+  std::vector<const size_t*> out;
+  dic.find_batch(std::vector<std::string>(), out);
+  assert(out.empty());
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_concurrent(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  std::cerr << "TEST_CONCURRENT: " << DynPDT<LabelPoolType, HashType>::name() << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 8;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 2;
+  setting.compaction_ratio = 0.1;
+  setting.concurrent = true;
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+  assert(dic.is_concurrent());
+
+  // Readers look up them while the others are inserted and erased
+  const size_t num_stables = keys.size() / 2;
+  for (size_t i = 0; i < num_stables; ++i) {
+    dic.update(keys[i], i + 1);
+  }
+
+  const size_t num_readers = 4;
+  std::atomic<bool> done(false);
+  std::atomic<size_t> num_passes(0);
+
+  std::vector<std::thread> readers;
+  for (size_t t = 0; t < num_readers; ++t) {
+    readers.emplace_back([&]() {
+      do {
+        size_t value = 0;
+        for (size_t i = 0; i < num_stables; ++i) {
+          assert(dic.find(keys[i], value));
+          assert(value == i + 1);
+        }
+        for (size_t i = 0; i < others.size(); ++i) {
+          assert(!dic.find(others[i], value));
+        }
+        // A key being erased and inserted again is found only with its value
+        for (size_t i = num_stables; i < keys.size(); ++i) {
+          if (dic.find(keys[i], value)) {
+            assert(value == i + 1);
+          }
+        }
+        ++num_passes;
+      } while (!done);
+    });
+  }
+
+  for (size_t i = num_stables; i < keys.size(); ++i) {
+    dic.update(keys[i], i + 1);
+  }
+  do {
+    for (size_t i = num_stables; i < keys.size(); i += 2) {
+      assert(dic.erase(keys[i]));
+    }
+    for (size_t i = num_stables; i < keys.size(); i += 2) {
+      dic.update(keys[i], i + 1);
+    }
+    // Values are also set again on stored keys
+    for (size_t i = 0; i < keys.size(); i += 3) {
+      dic.update(keys[i], i + 1);
+    }
+  } while (num_passes < num_readers * 2);
+
+  done = true;
+  for (auto& reader : readers) {
+    reader.join();
+  }
+  assert(0 < dic.num_rebuilds());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(keys[i], value));
+    assert(value == i + 1);
+  }
+}
+
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_for_each(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+                   bool child_marks) {
+  std::cerr << "TEST_FOR_EACH: " << DynPDT<LabelPoolType, HashType>::name()
+            << (child_marks ? " (child_marks)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 8;
+  setting.width_1st = 4;
+  setting.max_load_factor = 0.5;
+  setting.child_marks = child_marks;
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+
+  // Keys sharing prefixes make step nodes and branches at various positions.
+  // They are shortened since children are probed at every position of labels.
+  std::vector<std::string> stored;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const auto key = keys[i].substr(0, 64);
+    stored.push_back(key);
+    stored.push_back(key.substr(0, key.size() / 2) + "#" + std::to_string(i));
+  }
+  for (size_t i = 0; i < stored.size(); ++i) {
+    *dic.update(stored[i]) = i + 1;
+  }
+  for (size_t i = 0; i < stored.size(); i += 3) {
+    dic.erase(stored[i]);
+  }
+
+  std::vector<std::pair<std::string, size_t>> expected;
+  for (size_t i = 0; i < stored.size(); ++i) {
+    size_t value = 0;
+    if (dic.find(stored[i], value)) {
+      expected.emplace_back(stored[i], value);
+    }
+  }
+  std::sort(expected.begin(), expected.end());
+  expected.erase(std::unique(expected.begin(), expected.end()), expected.end());
+  assert(expected.size() == dic.num_keys());
+
+  auto check = [&]() {
+    std::vector<std::pair<std::string, size_t>> scanned;
+    dic.for_each([&](const std::string& key, size_t value) {
+      scanned.emplace_back(key, value);
+      return true;
+    });
+    std::sort(scanned.begin(), scanned.end());
+    assert(scanned == expected);
+
+    // Already in order
+    std::vector<std::pair<std::string, size_t>> visited;
+    dic.for_each_prefix("", [&](const std::string& key, size_t value) {
+      visited.emplace_back(key, value);
+      return true;
+    });
+    assert(visited == expected);
+
+    for (size_t i = 0; i < others.size(); i += 16) {
+      for (size_t len : {1, 2, 5}) {
+        const auto prefix = others[i].substr(0, len);
+        visited.clear();
+        dic.for_each_prefix(prefix, [&](const std::string& key, size_t value) {
+          visited.emplace_back(key, value);
+          return true;
+        });
+        auto it = std::lower_bound(expected.begin(), expected.end(), std::make_pair(prefix, 0UL));
+        for (const auto& item : visited) {
+          assert(it != expected.end() && item == *it++);
+        }
+        assert(it == expected.end() || it->first.compare(0, prefix.size(), prefix) != 0);
+      }
+    }
+
+    // Stopped by the callback
+    size_t num_visited = 0;
+    dic.for_each_prefix("", [&](const std::string&, size_t) {
+      return ++num_visited < 10;
+    });
+    assert(num_visited == std::min<size_t>(10, expected.size()));
+  };
+
+  check();
+  assert(0 < dic.num_rebuilds());
+
+  // While rebuilding, labels are in the two pools
+  for (size_t i = 0; !dic.is_rebuilding(); ++i) {
+    const auto key = others[i % others.size()] + "$" + std::to_string(i);
+    *dic.update(key) = 1;
+    expected.emplace_back(key, 1);
+  }
+  std::sort(expected.begin(), expected.end());
+  check();
+
+  // Marks are kept in the saved dictionary
+  std::stringstream ss;
+  dic.save(ss);
+  DynPDT<LabelPoolType, HashType> loaded;
+  loaded.load(ss);
+  assert(loaded.get_trie()->is_marked() == child_marks);
+  std::vector<std::pair<std::string, size_t>> visited;
+  loaded.for_each_prefix("", [&](const std::string& key, size_t value) {
+    visited.emplace_back(key, value);
+    return true;
+  });
+  assert(visited == expected);
+}
+
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_common_prefix_search(const std::vector<std::string>& keys,
+                               const std::vector<std::string>& others, bool child_marks) {
+  std::cerr << "TEST_COMMON_PREFIX_SEARCH: " << DynPDT<LabelPoolType, HashType>::name()
+            << (child_marks ? " (child_marks)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 4;
+  setting.width_1st = 4;
+  setting.max_load_factor = 0.5;
+  setting.child_marks = child_marks;
+
+  DynPDT<LabelPoolType, HashType> dic(setting);
+
+  // Prefixes of the keys are also stored so that keys end inside labels
+  std::vector<std::string> queries;
+  std::vector<std::string> stored;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const auto key = keys[i].substr(0, 40);
+    queries.push_back(key);
+    stored.push_back(key);
+    for (size_t len = i % 7; len < key.size(); len += 1 + (i + len) % 9) {
+      stored.push_back(key.substr(0, len));
+    }
+  }
+  for (size_t i = 0; i < others.size(); ++i) {
+    queries.push_back(others[i].substr(0, 40));
+  }
+  std::sort(stored.begin(), stored.end());
+  stored.erase(std::unique(stored.begin(), stored.end()), stored.end());
+  std::shuffle(stored.begin(), stored.end(), std::mt19937());
+
+  std::vector<std::string> live;
+  auto check = [&]() {
+    std::sort(live.begin(), live.end());
+    for (const auto& query : queries) {
+      std::vector<uint64_t> expected;
+      for (size_t len = 0; len <= query.size(); ++len) {
+        if (len != 0 && std::binary_search(live.begin(), live.end(), query.substr(0, len))) {
+          expected.push_back(len);
+        }
+      }
+
+      std::vector<uint64_t> found;
+      dic.common_prefix_search(query, [&](uint64_t length, const size_t* value_ptr) {
+        assert(value_ptr);
+        assert(*value_ptr == std::hash<std::string>()(query.substr(0, length)));
+        found.push_back(length);
+        return true;
+      });
+      assert(found == expected);
+
+      // Stopped by the callback
+      size_t num_found = 0;
+      dic.common_prefix_search(query, [&](uint64_t, const size_t*) {
+        return ++num_found < 2;
+      });
+      assert(num_found == std::min<size_t>(2, expected.size()));
+    }
+  };
+
+  for (size_t i = 0; i < stored.size(); ++i) {
+    if (stored[i].empty()) {
+      continue;
+    }
+    *dic.update(stored[i]) = std::hash<std::string>()(stored[i]);
+    live.push_back(stored[i]);
+  }
+  check();
+
+  for (size_t i = 0; i < stored.size(); i += 4) {
+    if (!stored[i].empty() && dic.erase(stored[i])) {
+      live.erase(std::find(live.begin(), live.end(), stored[i]));
+    }
+  }
+  check();
+
+  // While rebuilding, labels are in the two pools
+  for (size_t i = 0; !dic.is_rebuilding(); ++i) {
+    const auto key = queries[i % queries.size()] + "$" + std::to_string(i);
+    *dic.update(key) = std::hash<std::string>()(key);
+    live.push_back(key);
+  }
+  check();
+}
+
+std::string make_bytes(size_t i, size_t length) {
+  std::string bytes(length, '\0');
+  for (size_t j = 0; j < length; ++j) {
+    bytes[j] = static_cast<char>((i + j) * 31);
+  }
+  return bytes;
+}
+
+bool equals(const ByteSpan& span, const std::string& bytes) {
+  return span.size == bytes.size()
+         && std::memcmp(span.data, bytes.data(), bytes.size()) == 0;
+}
+
+void test_var_bytes(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+                    bool concurrent) {
+  using DicType = DynPDT<LabelPool_Arena<VarBytes>>;
+  std::cerr << "TEST_VAR_BYTES: " << DicType::name()
+            << (concurrent ? " (concurrent)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size() / 8; // to be rebuilt
+  setting.load_factor = 0.8;
+  setting.fixed_len = 16;
+  setting.width_1st = 2;
+  setting.concurrent = concurrent;
+
+  std::vector<std::string> values(keys.size());
+  const char* file_name = "test_DynPDT.idx";
+  {
+    DicType dic(setting);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      values[i] = make_bytes(i, i % 100);
+      assert(equals(dic.update_bytes(keys[i], values[i]), values[i]));
+    }
+    assert(0 < dic.num_rebuilds());
+
+    // Longer and shorter values overwrite the old ones
+    for (size_t i = 0; i < keys.size(); i += 3) {
+      values[i] = make_bytes(i + 1, (i % 2) ? values[i].size() + 50 : values[i].size() / 2);
+      dic.update_bytes(keys[i], values[i]);
+    }
+    // The value of a restored key is empty
+    for (size_t i = 0; i < keys.size(); i += 5) {
+      assert(dic.erase(keys[i]));
+      assert(dic.update(keys[i])->span().size == 0);
+      values[i].clear();
+    }
+
+    std::string bytes;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      assert(dic.find_bytes(keys[i], bytes));
+      assert(bytes == values[i]);
+    }
+    for (size_t i = 0; i < others.size(); ++i) {
+      assert(!dic.find_bytes(others[i], bytes));
+    }
+    dic.save(file_name);
+  }
+
+  DicType loaded, mapped;
+  loaded.load(file_name);
+  mapped.map(file_name);
+  for (const auto* dic : {&loaded, &mapped}) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      auto ptr = dic->find(keys[i]);
+      assert(ptr);
+      assert(equals(ptr->span(), values[i]));
+    }
+  }
+
+  std::remove(file_name);
+}
+
+void test_var_bytes_rewrite(const std::vector<std::string>& keys, bool concurrent) {
+  using DicType = DynPDT<LabelPool_Arena<VarBytes>>;
+  std::cerr << "TEST_VAR_BYTES_REWRITE: " << DicType::name()
+            << (concurrent ? " (concurrent)" : "") << std::endl;
+
+  Setting setting;
+  setting.num_keys = keys.size();
+  setting.load_factor = 0.8;
+  setting.fixed_len = 16;
+  setting.width_1st = 2;
+  setting.concurrent = concurrent;
+
+  // Bytes of the keys and the largest values, which bound the live records
+  uint64_t live_bytes = 0;
+  for (const auto& key : keys) {
+    live_bytes += key.size() + 32;
+  }
+
+  // Values growing and shrinking are relocated, as all are in the concurrent mode
+  DicType dic(setting);
+  std::vector<std::string> values(keys.size());
+  for (size_t r = 0; r < 200; ++r) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      values[i] = make_bytes(i + r, (i + r) % 2 ? 24 : 8);
+      dic.update_bytes(keys[i], values[i]);
+    }
+    // Dead records are released by compaction, also while a rebuild has two pools
+    assert(dic.size_in_bytes() <= 8 * live_bytes + 4 * LabelPool_Arena<VarBytes>::kFirstChunkSize);
+  }
+  assert(0 < dic.num_rebuilds());
+  assert(dic.num_keys() == keys.size());
+
+  std::string bytes;
+  for (size_t i = 0; i < keys.size(); ++i) {
+    assert(dic.find_bytes(keys[i], bytes));
+    assert(bytes == values[i]);
+  }
 }
 
 }
@@ -82,6 +1183,8 @@ int main() {
       others.push_back(key);
     }
   }
+  std::sort(std::begin(others), std::end(others));
+  others.erase(std::unique(std::begin(others), std::end(others)), std::end(others));
 
   std::shuffle(std::begin(keys), std::end(keys), std::mt19937());
 
@@ -90,6 +1193,116 @@ int main() {
   test<LabelPool_BitMap<size_t, 1>>(keys, others);
   test<LabelPool_BitMap<size_t, 2>>(keys, others);
   test<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test<LabelPool_Plain<size_t>, Hash_Bijective>(keys, others);
+  test<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test<LabelPool_Arena<size_t>>(keys, others);
+  test<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+  test<LabelPool_BitMap<size_t, 3, false, 8>>(keys, others);
+
+  test_rebuild<LabelPool_Plain<size_t>>(keys, others);
+  test_rebuild<LabelPool_BitMap<size_t, 0>>(keys, others);
+  test_rebuild<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_rebuild<LabelPool_Plain<size_t>, Hash_Bijective>(keys, others);
+  test_rebuild<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_rebuild<LabelPool_Arena<size_t>>(keys, others);
+  test_rebuild<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test_rebuild<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+  test_rebuild<LabelPool_Plain<size_t>>(keys, others, true);
+  test_rebuild<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others, true);
+
+  test_handle<LabelPool_Plain<size_t>>(keys, others);
+  test_handle<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_handle<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_handle<LabelPool_Arena<size_t>>(keys, others);
+  test_handle<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+
+  test_stats<LabelPool_Plain<size_t>>(keys, others);
+  test_stats<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_stats<LabelPool_BitMap<size_t, 3, true, 8>, Hash_Bijective>(keys, others);
+
+  test_fixed<LabelPool_Plain<size_t>>(keys, others);
+  test_fixed<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_fixed<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_fixed<LabelPool_Arena<size_t>>(keys, others);
+  test_fixed<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+
+  test_binary<LabelPool_Plain<size_t>>(false);
+  test_binary<LabelPool_BitMap<size_t, 0>>(false);
+  test_binary<LabelPool_BitMap<size_t, 3>>(true);
+  test_binary<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(false);
+  test_binary<LabelPool_Arena<size_t>>(true);
+  test_binary<LabelPool_BitMap<size_t, 3, true, 8>>(false);
+
+  test_tune<LabelPool_Plain<size_t>>(keys, others);
+  test_tune<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_tune<LabelPool_Arena<size_t>>(keys, others);
+
+  test_erase<LabelPool_Plain<size_t>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 0>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_erase<LabelPool_Arena<size_t>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+  test_erase<LabelPool_BitMap<size_t, 3, false, 8>>(keys, others);
+
+  test_serialize<LabelPool_Plain<size_t>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 0>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_serialize<LabelPool_Arena<size_t>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 3, false, 8>>(keys, others);
+  test_serialize<LabelPool_BitMap<size_t, 3>>(keys, others, true);
+
+  test_build<LabelPool_Plain<size_t>>(keys, others, false);
+  test_build<LabelPool_BitMap<size_t, 0>>(keys, others, false);
+  test_build<LabelPool_BitMap<size_t, 3>>(keys, others, true);
+  test_build<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others, false);
+  test_build<LabelPool_Arena<size_t>>(keys, others, true);
+  test_build<LabelPool_BitMap<size_t, 3, true>>(keys, others, false);
+  test_build<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others, false);
+
+  test_find_batch<LabelPool_Plain<size_t>>(keys, others);
+  test_find_batch<LabelPool_BitMap<size_t, 0>>(keys, others);
+  test_find_batch<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_find_batch<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_find_batch<LabelPool_Arena<size_t>>(keys, others);
+  test_find_batch<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test_find_batch<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+
+  test_concurrent<LabelPool_Plain<size_t>>(keys, others);
+  test_concurrent<LabelPool_BitMap<size_t, 0>>(keys, others);
+  test_concurrent<LabelPool_BitMap<size_t, 3>>(keys, others);
+  test_concurrent<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others);
+  test_concurrent<LabelPool_Arena<size_t>>(keys, others);
+  test_concurrent<LabelPool_BitMap<size_t, 3, true>>(keys, others);
+  test_concurrent<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others);
+
+  test_for_each<LabelPool_Plain<size_t>>(keys, others, false);
+  test_for_each<LabelPool_Plain<size_t>>(keys, others, true);
+  test_for_each<LabelPool_BitMap<size_t, 0>>(keys, others, true);
+  test_for_each<LabelPool_BitMap<size_t, 3>>(keys, others, true);
+  test_for_each<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others, true);
+  test_for_each<LabelPool_Arena<size_t>>(keys, others, true);
+  test_for_each<LabelPool_BitMap<size_t, 3, true>>(keys, others, true);
+  test_for_each<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others, false);
+
+  test_common_prefix_search<LabelPool_Plain<size_t>>(keys, others, false);
+  test_common_prefix_search<LabelPool_Plain<size_t>>(keys, others, true);
+  test_common_prefix_search<LabelPool_BitMap<size_t, 0>>(keys, others, true);
+  test_common_prefix_search<LabelPool_BitMap<size_t, 3>>(keys, others, false);
+  test_common_prefix_search<LabelPool_BitMap<size_t, 2>, Hash_Bijective>(keys, others, true);
+  test_common_prefix_search<LabelPool_Arena<size_t>>(keys, others, false);
+  test_common_prefix_search<LabelPool_BitMap<size_t, 3, true>>(keys, others, true);
+  test_common_prefix_search<LabelPool_BitMap<size_t, 3, true, 8>>(keys, others, false);
+
+  test_var_bytes(keys, others, false);
+  test_var_bytes(keys, others, true);
+  test_var_bytes_rewrite(keys, false);
+  test_var_bytes_rewrite(keys, true);
 
   return 0;
 }
@@ -0,0 +1,74 @@
+#undef NDEBUG
+
+#include <cassert>
+#include <iostream>
+#include <random>
+
+#include <FitVector.hpp>
+
+using namespace dynpdt;
+
+namespace {
+
+template <uint8_t FixedWidth>
+void test(uint64_t length, uint8_t width, bool blocked) {
+  std::cerr << "TEST: width=" << uint32_t(width) << (FixedWidth ? " (fixed)" : "")
+            << (blocked ? " (blocked)" : "") << std::endl;
+
+  std::mt19937_64 rnd(width);
+  const uint64_t mask = (width == 64) ? UINT64_MAX : (1ULL << width) - 1;
+
+  // fill() writes the same bits as set() for each value
+  const auto init = rnd() & mask;
+  FitVector<FixedWidth> filled(length, width, init, blocked);
+  FitVector<FixedWidth> vec(length, width, blocked);
+  assert(vec.is_blocked() == blocked);
+  for (uint64_t i = 0; i < length; ++i) {
+    assert(filled.get(i) == init);
+    vec.set(i, init);
+  }
+  std::ostringstream oss1, oss2;
+  filled.save(oss1);
+  vec.save(oss2);
+  assert(oss1.str() == oss2.str());
+
+  std::vector<uint64_t> values(length);
+  for (uint64_t i = 0; i < length; ++i) {
+    values[i] = rnd() & mask;
+    vec.set(i, values[i]);
+  }
+
+  for (uint64_t begin : {uint64_t(0), length / 3}) {
+    auto scanner = vec.scan(begin);
+    for (uint64_t i = begin; i < length; ++i, scanner.next()) {
+      assert(scanner.get() == values[i]);
+      assert(vec.get(i) == values[i]);
+    }
+  }
+
+  std::stringstream ss;
+  vec.save(ss);
+  FitVector<FixedWidth> loaded;
+  loaded.load(ss);
+  assert(loaded.is_blocked() == blocked);
+  for (uint64_t i = 0; i < length; ++i) {
+    assert(loaded.get(i) == values[i]);
+  }
+}
+
+}
+
+int main() {
+  const uint64_t length = 1000;
+
+  for (bool blocked : {false, true}) {
+    for (uint8_t width = 1; width <= 64; ++width) {
+      test<0>(length, width, blocked);
+    }
+    test<2>(length, 2, blocked);
+    test<13>(length, 13, blocked);
+    test<64>(length, 64, blocked);
+  }
+
+  return 0;
+}
@@ -6,9 +6,12 @@
 #include <random>
 #include <cstring>
 #include <fstream>
+#include <sstream>
 
+#include "include/LabelPool_Arena.hpp"
 #include "include/LabelPool_BitMap.hpp"
 #include "include/LabelPool_Plain.hpp"
+#include "include/simd_tools.hpp"
 
 using namespace dynpdt;
 
@@ -46,11 +49,123 @@ void test(const std::vector<CharRange>& ranges, std::vector<uint64_t>& ids) {
     assert(value == i);
     assert(ranges[i].length() == num_match);
   }
+
+  LablePoolType dst(ranges.size());
+  for (size_t i = 0; i < size; i += 2) {
+    assert(pool.move_to(ids[i], dst, ids[size - i - 1]));
+  }
+  assert(!pool.move_to(ids[size], dst, ids[size]));
+
+  for (size_t i = 0; i < size; ++i) {
+    uint64_t num_match = 0;
+    auto ptr = (i % 2 == 0) ? dst.compare_and_get(ids[size - i - 1], ranges[i], num_match)
+                            : pool.compare_and_get(ids[i], ranges[i], num_match);
+    assert(ptr);
+    assert(*ptr == i);
+    assert(ranges[i].length() == num_match);
+  }
+  assert(pool.num_labels() + dst.num_labels() == size);
+}
+
+std::string make_value(uint64_t i, uint64_t length) {
+  std::string value;
+  while (value.size() < length) {
+    value += std::to_string(i) + ",";
+  }
+  value.resize(length);
+  return value;
+}
+
+void check_values(LabelPool_Arena<VarBytes>& pool, const std::vector<CharRange>& ranges,
+                  const std::vector<uint64_t>& ids, const std::vector<std::string>& values) {
+  for (size_t i = 0; i < values.size(); ++i) {
+    uint64_t num_match = 0;
+    auto ptr = pool.compare_and_get(ids[i], ranges[i], num_match);
+    assert(ptr);
+    assert(ranges[i].length() == num_match);
+    const auto span = ptr->span();
+    assert(std::string(reinterpret_cast<const char*>(span.data), span.size) == values[i]);
+  }
+}
+
+void test_var_bytes(const std::vector<CharRange>& ranges, std::vector<uint64_t>& ids) {
+  std::cerr << "TEST_VAR_BYTES: " << LabelPool_Arena<VarBytes>::name() << std::endl;
+
+  LabelPool_Arena<VarBytes> pool(ranges.size());
+
+  const auto size = static_cast<uint64_t>(ranges.size() * 0.8);
+  std::vector<std::string> values(size);
+  for (size_t i = 0; i < size; ++i) {
+    // Appended with the empty value
+    assert(pool.append(ids[i], ranges[i])->span().size == 0);
+    values[i] = make_value(i, i % 300);
+    pool.set_value(ids[i], reinterpret_cast<const uint8_t*>(values[i].data()), values[i].size());
+  }
+  check_values(pool, ranges, ids, values);
+
+  // Shorter values are written in place, and longer ones are moved
+  for (size_t i = 0; i < size; ++i) {
+    auto old_ptr = pool.compare_and_get(ids[i], CharRange());
+    values[i] = make_value(i, (i % 2) ? values[i].size() / 2 : values[i].size() + 100);
+    auto ptr = pool.set_value(ids[i], reinterpret_cast<const uint8_t*>(values[i].data()),
+                              values[i].size());
+    assert((i % 2 == 1) == (ptr == old_ptr));
+  }
+  check_values(pool, ranges, ids, values);
+
+  // The value is emptied by restore()
+  pool.erase(ids[0]);
+  assert(pool.restore(ids[0])->span().size == 0);
+  values[0].clear();
+
+  std::stringstream ss;
+  pool.save(ss);
+  LabelPool_Arena<VarBytes> loaded;
+  loaded.load(ss);
+  assert(loaded.sum_bytes() == pool.sum_bytes());
+  check_values(loaded, ranges, ids, values);
+
+  LabelPool_Arena<VarBytes> dst(ranges.size());
+  for (size_t i = 0; i < size; ++i) {
+    assert(loaded.move_to(ids[i], dst, ids[i]));
+  }
+  assert(loaded.sum_bytes() == 0);
+  assert(dst.sum_bytes() == pool.sum_bytes());
+  check_values(dst, ranges, ids, values);
+}
+
+void test_mismatch() {
+  std::cerr << "TEST_MISMATCH" << std::endl;
+
+  std::vector<simd_tools::MismatchKernel> kernels = {simd_tools::mismatch_scalar, simd_tools::mismatch};
+#if defined(__x86_64__)
+  kernels.push_back(simd_tools::mismatch_sse2);
+  if (cpu_features::has_avx2()) {
+    kernels.push_back(simd_tools::mismatch_avx2);
+  }
+#endif
+
+  // Every position around the vector widths
+  for (uint64_t n = 0; n <= 100; ++n) {
+    std::vector<uint8_t> a(n, 'a'), b(n, 'a');
+    for (auto kernel : kernels) {
+      assert(kernel(a.data(), b.data(), n) == n);
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+      b[i] = 'b';
+      for (auto kernel : kernels) {
+        assert(kernel(a.data(), b.data(), n) == i);
+      }
+      b[i] = 'a';
+    }
+  }
 }
 
 }
 
 int main() {
+  test_mismatch();
+
   const size_t num_keys = 1U << 10;
 
   std::vector<std::string> keys(num_keys);
@@ -78,6 +193,12 @@ int main() {
   test<LabelPool_BitMap<size_t, 1>>(ranges, ids);
   test<LabelPool_BitMap<size_t, 2>>(ranges, ids);
   test<LabelPool_BitMap<size_t, 3>>(ranges, ids);
+  test<LabelPool_Arena<size_t>>(ranges, ids);
+  test<LabelPool_BitMap<size_t, 0, true>>(ranges, ids);
+  test<LabelPool_BitMap<size_t, 3, true>>(ranges, ids);
+  test<LabelPool_BitMap<size_t, 3, false, 8>>(ranges, ids);
+  test<LabelPool_BitMap<size_t, 2, true, 4>>(ranges, ids);
+  test_var_bytes(ranges, ids);
 
   return 0;
 }
@@ -0,0 +1,171 @@
+#undef NDEBUG
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#include <ShardedDynPDT.hpp>
+
+using namespace dynpdt;
+
+namespace {
+
+std::string make_key(size_t max_length = 1000) {
+  static std::random_device rnd;
+
+  std::string key;
+  size_t length = (rnd() % max_length);
+
+  for (size_t i = 0; i < length; ++i) {
+    key += 'A' + (rnd() % 26);
+  }
+  return key;
+}
+
+Setting make_setting(uint64_t num_keys, bool concurrent) {
+  Setting setting;
+  setting.num_keys = num_keys / 4;
+  setting.load_factor = 0.8;
+  setting.fixed_len = 16;
+  setting.width_1st = 4;
+  setting.concurrent = concurrent;
+  return setting;
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test(const std::vector<std::string>& keys, const std::vector<std::string>& others,
+          bool concurrent) {
+  using DicType = ShardedDynPDT<LabelPoolType, HashType>;
+  std::cerr << "TEST: " << DicType::name() << (concurrent ? " (concurrent)" : "") << std::endl;
+
+  const size_t num_shards = 8;
+  DicType dic(make_setting(keys.size(), concurrent), num_shards);
+  assert(dic.num_shards() == num_shards);
+
+  // Writers update disjoint keys in parallel while readers look up
+  const size_t num_threads = 4;
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < num_threads; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = t; i < keys.size(); i += num_threads) {
+        dic.update(keys[i], i + 1);
+      }
+    });
+    threads.emplace_back([&]() {
+      size_t value = 0;
+      for (size_t i = 0; i < others.size(); ++i) {
+        assert(!dic.find(others[i], value));
+      }
+      // A key being inserted is found only with its value
+      for (size_t i = 0; i < keys.size(); ++i) {
+        if (dic.find(keys[i], value)) {
+          assert(value == i + 1);
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  assert(dic.num_keys() == keys.size());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(keys[i], value));
+    assert(value == i + 1);
+    assert(dic.get_shard(dic.get_shard_id(keys[i])).find(keys[i]));
+  }
+
+  for (size_t i = 0; i < keys.size(); i += 2) {
+    assert(dic.erase(keys[i]));
+    assert(!dic.erase(keys[i]));
+  }
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t value = 0;
+    assert(dic.find(keys[i], value) == (i % 2 == 1));
+  }
+
+  std::ostringstream oss;
+  dic.show_stat(oss);
+  assert(oss.str().find(" - num_shards:\t8") != std::string::npos);
+}
+
+template <typename LabelPoolType, typename HashType = Hash_Prime>
+void test_bulk_load(const std::vector<std::string>& keys, const std::vector<std::string>& others) {
+  using DicType = ShardedDynPDT<LabelPoolType, HashType>;
+  std::cerr << "TEST_BULK_LOAD: " << DicType::name() << std::endl;
+
+  // The batch size is exceeded so that workers get several batches
+  std::stringstream ss;
+  size_t num_lines = 0;
+  for (size_t r = 0; r < 4; ++r) {
+    for (const auto& key : keys) {
+      ss << key << '\n';
+      ++num_lines;
+    }
+  }
+  assert(DicType::kBulkBatchSize < num_lines);
+
+  for (size_t num_threads : {1, 3, 16}) {
+    std::stringstream is(ss.str());
+    DicType dic(make_setting(keys.size(), false), 5);
+    dic.bulk_load(is, num_threads, [](uint64_t line_no) { return line_no + 1; });
+
+    size_t num_keys = 0;
+    for (size_t i = 0; i < keys.size(); ++i) {
+      size_t value = 0;
+      if (keys[i].empty()) {
+        assert(!dic.find(keys[i], value));
+        continue;
+      }
+      ++num_keys;
+      // The last occurrence wins
+      assert(dic.find(keys[i], value));
+      assert(value == 3 * keys.size() + i + 1);
+    }
+    assert(dic.num_keys() == num_keys);
+
+    for (size_t i = 0; i < others.size(); ++i) {
+      size_t value = 0;
+      assert(!dic.find(others[i], value));
+    }
+  }
+}
+
+}
+
+int main() {
+  const size_t num_keys = 1U << 10;
+
+  std::vector<std::string> keys(num_keys);
+  for (size_t i = 0; i < num_keys; ++i) {
+    keys[i] = make_key();
+  }
+  std::sort(std::begin(keys), std::end(keys));
+  keys.erase(std::unique(std::begin(keys), std::end(keys)), std::end(keys));
+
+  std::vector<std::string> others;
+  others.reserve(num_keys);
+  for (size_t i = 0; i < num_keys; ++i) {
+    auto key = make_key();
+    if (!std::binary_search(std::begin(keys), std::end(keys), key)) {
+      others.push_back(key);
+    }
+  }
+
+  std::shuffle(std::begin(keys), std::end(keys), std::mt19937());
+
+  test<LabelPool_Plain<size_t>>(keys, others, false);
+  test<LabelPool_BitMap<size_t, 2>>(keys, others, false);
+  test<LabelPool_Plain<size_t>>(keys, others, true);
+  test<LabelPool_BitMap<size_t, 3>, Hash_Bijective>(keys, others, true);
+
+  test_bulk_load<LabelPool_Plain<size_t>>(keys, others);
+  test_bulk_load<LabelPool_BitMap<size_t, 0>>(keys, others);
+
+  return 0;
+}
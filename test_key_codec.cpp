@@ -0,0 +1,104 @@
+#undef NDEBUG
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <random>
+
+#include <key_codec.hpp>
+
+using namespace dynpdt;
+
+namespace {
+
+std::string encode(const std::string& bytes) {
+  std::string key;
+  key_codec::encode_bytes(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size(), key);
+  return key;
+}
+
+std::string encode(uint64_t val) {
+  uint8_t codes[key_codec::kIntLength];
+  key_codec::encode_int(val, codes);
+  return std::string(reinterpret_cast<const char*>(codes), key_codec::kIntLength);
+}
+
+void test_bytes() {
+  std::cerr << "TEST: bytes" << std::endl;
+
+  // Biased to small bytes, which are escaped
+  std::mt19937_64 rnd(13);
+  std::vector<std::string> raws(10000);
+  for (auto& raw : raws) {
+    raw.resize(rnd() % 20);
+    for (auto& c : raw) {
+      c = static_cast<char>((rnd() % 2) ? rnd() % 8 : rnd() % 256);
+    }
+  }
+  raws.push_back("");
+  raws.push_back(std::string(16, '\0'));
+
+  for (const auto& raw : raws) {
+    const auto key = encode(raw);
+    assert(key.size() == key_codec::encoded_size(reinterpret_cast<const uint8_t*>(raw.data()),
+                                                 raw.size()));
+    for (auto c : key) {
+      assert(key_codec::kMinByte <= static_cast<uint8_t>(c));
+    }
+    std::string decoded;
+    assert(key_codec::decode_bytes(key, decoded));
+    assert(decoded == raw);
+  }
+
+  // The order and the prefixes are kept
+  std::sort(raws.begin(), raws.end());
+  for (size_t i = 1; i < raws.size(); ++i) {
+    const auto prev = encode(raws[i - 1]), curr = encode(raws[i]);
+    assert(prev <= curr);
+    const bool is_prefix = raws[i].compare(0, raws[i - 1].size(), raws[i - 1]) == 0;
+    assert(is_prefix == (curr.compare(0, prev.size(), prev) == 0));
+  }
+
+  std::string decoded;
+  assert(!key_codec::decode_bytes(std::string(1, '\x01'), decoded));
+  assert(!key_codec::decode_bytes(std::string(1, key_codec::kEscape), decoded));
+  assert(!key_codec::decode_bytes(std::string(2, key_codec::kEscape), decoded));
+}
+
+void test_int() {
+  std::cerr << "TEST: int" << std::endl;
+
+  std::mt19937_64 rnd(13);
+  std::vector<uint64_t> vals = {0, 1, 127, 128, UINT64_MAX - 1, UINT64_MAX};
+  for (uint64_t i = 0; i < 10000; ++i) {
+    vals.push_back(rnd() >> (rnd() % 64));
+  }
+  std::sort(vals.begin(), vals.end());
+
+  for (size_t i = 0; i < vals.size(); ++i) {
+    const auto key = encode(vals[i]);
+    for (auto c : key) {
+      assert(key_codec::kMinByte <= static_cast<uint8_t>(c));
+    }
+    uint64_t val = 0;
+    assert(key_codec::decode_int(key, val));
+    assert(val == vals[i]);
+    if (0 < i) {
+      assert(encode(vals[i - 1]) <= key);
+    }
+  }
+
+  uint64_t val = 0;
+  assert(!key_codec::decode_int("short", val));
+  assert(!key_codec::decode_int(std::string(key_codec::kIntLength, 'a'), val));
+  assert(!key_codec::decode_int(std::string(key_codec::kIntLength, '\xff'), val));
+}
+
+} // namespace
+
+int main() {
+  test_bytes();
+  test_int();
+
+  return 0;
+}